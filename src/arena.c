@@ -0,0 +1,198 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <errno.h> /* EOWNERDEAD */
+
+#include "arena.h"
+
+#define BLOCK(base, off) ((struct arena_buf *) (void *) ((base) + (off)))
+
+/**
+* arena_lock() - take the arena mutex, recovering it from a dead owner
+* @arena: the arena
+*
+* Block headers are only written after the block is consistent, so a
+* holder that died mid-call leaves at worst a block that is never reused.
+*
+* Return: 0 with the mutex held, -1 with errno set if it cannot be taken
+*/
+static int arena_lock(struct arena *arena)
+{
+    int rc = pthread_mutex_lock(&arena->lock);
+
+    if (rc == EOWNERDEAD)
+        pthread_mutex_consistent(&arena->lock);
+    else if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* arena_init() - format an arena as one large free block
+* @arena: bookkeeping in the shared memory header
+* @base: start of the arena bytes
+* @size: number of bytes at base, a multiple of ARENA_ALIGN
+*
+* Return: 0 on success, -1 with errno set if the mutex cannot be created
+*/
+int arena_init(struct arena *arena, char *base, size_t size)
+{
+    pthread_mutexattr_t attr;
+    int rc;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    rc = pthread_mutex_init(&arena->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+
+    arena->size = size;
+    if (size >= sizeof(struct arena_buf)) {
+        BLOCK(base, 0)->size = size;
+        BLOCK(base, 0)->len = 0;
+        BLOCK(base, 0)->used = 0;
+    }
+    return 0;
+}
+
+/**
+* arena_alloc() - reserve a buffer for len payload bytes
+* @arena: bookkeeping in the shared memory header
+* @base: start of the arena bytes in the caller's mapping
+* @len: payload size; the buffer's length prefix is set to it
+* @owner: the caller's request slot, so arena_free_owner() can take the
+*         buffer back if the caller dies holding it
+*
+* First fit over the block list.  Runs of free blocks are merged while
+* walking, so arena_free() stays O(1).
+*
+* Return: offset of the buffer header, or ARENA_NONE with errno set to
+*         ENOMEM if nothing fits
+*/
+uint64_t arena_alloc(struct arena *arena, char *base, size_t len, uint32_t owner)
+{
+    uint64_t need, off, next, found = ARENA_NONE;
+    struct arena_buf *blk;
+
+    need = (sizeof(struct arena_buf) + len + ARENA_ALIGN - 1) & ~(uint64_t) (ARENA_ALIGN - 1);
+
+    if (arena_lock(arena) == -1)
+        return ARENA_NONE;
+    for (off = 0; off + sizeof(struct arena_buf) <= arena->size; off += blk->size) {
+        blk = BLOCK(base, off);
+        if (blk->size < sizeof(struct arena_buf))
+            break; /* corrupted header, stop rather than loop forever */
+        if (blk->used)
+            continue;
+
+        /* coalesce with the free blocks that follow */
+        for (next = off + blk->size; next < arena->size && !BLOCK(base, next)->used;
+             next = off + blk->size)
+            blk->size += BLOCK(base, next)->size;
+
+        if (blk->size < need)
+            continue;
+
+        /* split off the tail if it can hold another buffer */
+        if (blk->size - need >= sizeof(struct arena_buf) + ARENA_ALIGN) {
+            BLOCK(base, off + need)->size = blk->size - need;
+            BLOCK(base, off + need)->len = 0;
+            BLOCK(base, off + need)->used = 0;
+            blk->size = need;
+        }
+        blk->len = len;
+        blk->owner = owner;
+        blk->used = 1;
+        found = off;
+        break;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    if (found == ARENA_NONE)
+        errno = ENOMEM;
+    return found;
+}
+
+/**
+* arena_free() - release a buffer returned by arena_alloc()
+* @arena: bookkeeping in the shared memory header
+* @base: start of the arena bytes in the caller's mapping
+* @off: the buffer offset
+*
+*/
+void arena_free(struct arena *arena, char *base, uint64_t off)
+{
+    if (arena_get(arena, base, off) == NULL)
+        return;
+
+    if (arena_lock(arena) == -1)
+        return;
+    BLOCK(base, off)->used = 0;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/**
+* arena_free_owner() - release every buffer a request slot's client holds
+* @arena: bookkeeping in the shared memory header
+* @base: start of the arena bytes in the caller's mapping
+* @owner: the request slot
+*
+* For a client that died without freeing its buffers; nothing else may
+* be using them.
+*
+* Return: number of buffers released
+*/
+unsigned int arena_free_owner(struct arena *arena, char *base, uint32_t owner)
+{
+    struct arena_buf *blk;
+    uint64_t off;
+    unsigned int n = 0;
+
+    if (arena_lock(arena) == -1)
+        return 0;
+    for (off = 0; off + sizeof(struct arena_buf) <= arena->size; off += blk->size) {
+        blk = BLOCK(base, off);
+        if (blk->size < sizeof(struct arena_buf))
+            break; /* corrupted header, stop rather than loop forever */
+        if (blk->used && blk->owner == owner) {
+            blk->used = 0;
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&arena->lock);
+    return n;
+}
+
+/**
+* arena_get() - validate an offset received from another process
+* @arena: bookkeeping in the shared memory header
+* @base: start of the arena bytes in the caller's mapping
+* @off: the buffer offset
+*
+* Return: the buffer, or NULL if off does not name an allocated buffer
+*         whose payload fits inside the arena
+*/
+struct arena_buf *arena_get(struct arena *arena, char *base, uint64_t off)
+{
+    struct arena_buf *blk;
+
+    if (off == ARENA_NONE || off % ARENA_ALIGN != 0 ||
+        off + sizeof(struct arena_buf) > arena->size)
+        return NULL;
+
+    blk = BLOCK(base, off);
+    if (!blk->used || blk->len > arena->size - off - sizeof(struct arena_buf))
+        return NULL;
+    return blk;
+}
@@ -0,0 +1,60 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h> /* Needed for size_t */
+#include <stdint.h> /* Fixed-width offsets shared between processes */
+#include <pthread.h> /* Process-shared mutex */
+
+/* Default payload arena size in MiB */
+#define DEFAULT_ARENA_MB 64
+
+/* Offset meaning "no buffer" */
+#define ARENA_NONE UINT64_MAX
+
+/* Buffers and their headers are kept on cache line boundaries */
+#define ARENA_ALIGN 64
+
+/*
+* The arena is a run of contiguous blocks, each starting with this header.
+* Blocks are addressed by their offset from the start of the arena since
+* every process maps the segment at a different address.  'len' is the
+* length prefix of the payload stored in an allocated block.
+*/
+struct arena_buf {
+  uint64_t size;  /* whole block including this header */
+  uint64_t len;   /* payload bytes in use */
+  uint32_t used;
+  uint32_t owner; /* request slot of the client that allocated it */
+  char pad[ARENA_ALIGN - 2 * sizeof(uint64_t) - 2 * sizeof(uint32_t)];
+  char data[];
+};
+
+/*
+* Arena bookkeeping in the shared memory header.  The mutex is robust so a
+* client dying inside arena_alloc() cannot wedge every other process.
+*/
+struct arena {
+  pthread_mutex_t lock;
+  uint64_t size;
+};
+
+int arena_init(struct arena *arena, char *base, size_t size);
+
+uint64_t arena_alloc(struct arena *arena, char *base, size_t len, uint32_t owner);
+
+void arena_free(struct arena *arena, char *base, uint64_t off);
+
+unsigned int arena_free_owner(struct arena *arena, char *base, uint32_t owner);
+
+struct arena_buf *arena_get(struct arena *arena, char *base, uint64_t off);
+
+#endif
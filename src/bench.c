@@ -0,0 +1,784 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+\*************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> /* Nanosecond timestamps */
+#include <unistd.h> /* Needed for getopt cli parsing */
+#include <getopt.h> /* Needed for getopt_long */
+#include <string.h> /* Needed for strcmp */
+#include <errno.h> /* Why the library turned a call down */
+#include <time.h> /* clock_gettime and clock_nanosleep */
+#include <pthread.h> /* One thread per simulated client */
+#include "service_api.h"
+#include "errors.h"
+
+#define VERSION "0.1"
+#define BUFSIZE 256
+
+/* Most priorities accepted in a -p mix */
+#define MAX_PRIOS 16
+
+/* Measured protocol phases */
+enum phase {
+  PHASE_REGISTER,
+  PHASE_ROTATE,
+  PHASE_DEREGISTER,
+  NPHASES
+};
+
+static const char *phase_names[NPHASES] = { "register", "rotate", "deregister" };
+
+/* The load to generate, from the command line */
+struct bench_config {
+  unsigned int clients;
+  unsigned int requests;         /* per client */
+  size_t size;                   /* message bytes */
+  int shift;                     /* fixed shift, unless shift_uniform */
+  int shift_uniform;             /* uniform over -25..25, never 0 */
+  unsigned int prios[MAX_PRIOS]; /* client i registers with prios[i % nprios] */
+  unsigned int nprios;
+  double rate;                   /* requests per second per client, 0 = unpaced */
+  unsigned int depth;            /* requests in flight per client */
+  unsigned long deadline_us;     /* per-request deadline, 0 = none */
+  unsigned int pool;             /* sessions shared by all clients, 0 = one each */
+  enum service_transport transport;
+  int all_transports;            /* run the workload over each transport in turn */
+  const char *prefix;
+  int json;
+};
+
+/* One simulated client and its latency samples in nanoseconds */
+struct bench_client {
+  pthread_t thread;
+  unsigned int id;
+  unsigned int prio;
+  unsigned int seed;
+  uint64_t register_ns;
+  uint64_t deregister_ns;
+  uint64_t *rotate_ns;
+  char *msg[CAESAR_MAX_INFLIGHT]; /* config.depth messages, filled before the rotate phase */
+  unsigned int nrotate;
+  unsigned int failures;
+  int busy;                  /* the service turned the registration away */
+};
+
+/* Latency summary of one set of samples, in nanoseconds */
+struct summary {
+  size_t count;
+  uint64_t p50, p90, p99, p999, max;
+  double mean;
+};
+
+static struct bench_config config;
+
+/* Lines all clients up before and after the rotate phase, with main() */
+static pthread_barrier_t phase_barrier;
+
+/* With -P, the sessions every client thread shares */
+static caesar_pool_t *shared_pool;
+
+static const struct option long_options[] = {
+    { "clients", required_argument, NULL, 'c' },
+    { "requests", required_argument, NULL, 'n' },
+    { "size", required_argument, NULL, 'S' },
+    { "shift", required_argument, NULL, 's' },
+    { "prio", required_argument, NULL, 'p' },
+    { "rate", required_argument, NULL, 'r' },
+    { "depth", required_argument, NULL, 'd' },
+    { "deadline", required_argument, NULL, 'D' },
+    { "pool", required_argument, NULL, 'P' },
+    { "transport", required_argument, NULL, 't' },
+    { "shards", required_argument, NULL, 'x' },
+    { "json", no_argument, NULL, 'j' },
+    { NULL, 0, NULL, 0 }
+};
+
+/**
+* now_ns() - monotonic clock in nanoseconds
+*/
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+* sleep_until() - sleep until a monotonic clock time
+* @t: deadline in nanoseconds
+*/
+static void sleep_until(uint64_t t)
+{
+    struct timespec ts;
+
+    ts.tv_sec = t / 1000000000u;
+    ts.tv_nsec = t % 1000000000u;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+/**
+* next_shift() - draw a shift from the configured distribution
+* @cli: the client, whose seed is advanced
+*/
+static int next_shift(struct bench_client *cli)
+{
+    int s;
+
+    if (!config.shift_uniform)
+        return config.shift;
+    s = (int) (rand_r(&cli->seed) % 50) - 25;
+    return s >= 0 ? s + 1 : s;
+}
+
+/**
+* fill_message() - fill a message buffer with random letters
+* @cli: the client, whose seed is advanced
+* @buf: at least config.size + 1 bytes
+*/
+static void fill_message(struct bench_client *cli, char *buf)
+{
+    size_t i;
+
+    for (i = 0; i < config.size; i++)
+        buf[i] = (rand_r(&cli->seed) & 1 ? 'a' : 'A') + rand_r(&cli->seed) % 26;
+    buf[config.size] = '\0';
+}
+
+/**
+* scheduled() - when a client's i-th request is due
+* @start: start of the rotate phase
+* @i: request number
+*
+* With a rate set, latency is measured from this time rather than from the
+* actual submission, so a stalled service is not hidden by requests that
+* were sent late (coordinated omission).
+*
+* Return: the due time, or 0 when requests are not paced
+*/
+static uint64_t scheduled(uint64_t start, unsigned int i)
+{
+    if (config.rate <= 0)
+        return 0;
+    return start + (uint64_t) (i * (1e9 / config.rate));
+}
+
+/**
+* fill_messages() - fill a client's message buffers for the rotate phase
+* @cli: the client
+*
+* Each buffer is reused for every request it carries: a rotated message
+* is still random letters of the same size, so generating new ones would
+* only add work to the timed phase.
+*/
+static void fill_messages(struct bench_client *cli)
+{
+    unsigned int i;
+
+    for (i = 0; i < config.depth; i++)
+        fill_message(cli, cli->msg[i]);
+}
+
+/**
+* run_sync() - issue a client's requests one at a time with caesar_rotate()
+* @cli: the client
+* @sess: its open session, or NULL to go through the shared pool
+*/
+static void run_sync(struct bench_client *cli, caesar_session_t *sess)
+{
+    char *msg = cli->msg[0];
+    uint64_t start = now_ns(), due, t0;
+    unsigned int i;
+
+    for (i = 0; i < config.requests; i++) {
+        due = scheduled(start, i);
+        if (due != 0)
+            sleep_until(due);
+        t0 = now_ns();
+        if ((sess != NULL ? caesar_rotate(sess, msg, next_shift(cli))
+                          : caesar_pool_rotate(shared_pool, msg, next_shift(cli))) != 0)
+            cli->failures++;
+        cli->rotate_ns[cli->nrotate++] = now_ns() - (due != 0 ? due : t0);
+    }
+}
+
+/**
+* run_async() - keep up to config.depth requests in flight per client
+* @cli: the client
+* @sess: its open session
+*
+* Submits with caesar_rotate_async() while there is room and the next
+* request is due, collects with caesar_poll(), and blocks in caesar_wait()
+* on the oldest request when it has nothing else to do.
+*/
+static void run_async(struct bench_client *cli, caesar_session_t *sess)
+{
+    struct caesar_completion done[CAESAR_MAX_INFLIGHT];
+    caesar_token_t token[CAESAR_MAX_INFLIGHT];
+    uint64_t sent[CAESAR_MAX_INFLIGHT];
+    char **msg = cli->msg;
+    uint64_t start, due;
+    unsigned int issued = 0, inflight = 0, i, j, oldest;
+    int n, status;
+
+    for (i = 0; i < config.depth; i++)
+        token[i] = CAESAR_TOKEN_NONE;
+
+    start = now_ns();
+    while (cli->nrotate < config.requests) {
+        /* Fill free entries with requests that are due */
+        for (i = 0; i < config.depth && issued < config.requests; i++) {
+            if (token[i] != CAESAR_TOKEN_NONE)
+                continue;
+            due = scheduled(start, issued);
+            if (due > now_ns())
+                break;
+            sent[i] = due != 0 ? due : now_ns();
+            token[i] = caesar_rotate_async(sess, msg[i], next_shift(cli));
+            if (token[i] == CAESAR_TOKEN_NONE) {
+                /* With nothing in flight to free arena room, the request fails */
+                if (inflight == 0) {
+                    cli->failures++;
+                    cli->rotate_ns[cli->nrotate++] = now_ns() - sent[i];
+                    issued++;
+                }
+                break;
+            }
+            issued++;
+            inflight++;
+        }
+
+        n = caesar_poll(sess, done, config.depth);
+        if (n == 0) {
+            if (inflight == 0) {
+                sleep_until(scheduled(start, issued));
+                continue;
+            }
+            for (oldest = config.depth, i = 0; i < config.depth; i++) {
+                if (token[i] != CAESAR_TOKEN_NONE &&
+                    (oldest == config.depth || sent[i] < sent[oldest]))
+                    oldest = i;
+            }
+            status = caesar_wait(sess, token[oldest]);
+            done[0].token = token[oldest];
+            done[0].status = status;
+            n = 1;
+        }
+
+        for (j = 0; j < (unsigned int) n; j++) {
+            for (i = 0; i < config.depth && token[i] != done[j].token; i++)
+                ;
+            if (i == config.depth)
+                continue;
+            if (done[j].status != 0)
+                cli->failures++;
+            cli->rotate_ns[cli->nrotate++] = now_ns() - sent[i];
+            token[i] = CAESAR_TOKEN_NONE;
+            inflight--;
+        }
+    }
+}
+
+/**
+* client_main() - body of one simulated client thread
+* @arg: its struct bench_client
+*
+* Fills its messages, registers, waits for every client to be registered,
+* runs its requests, waits for every client to finish, then deregisters.
+*
+*/
+static void *client_main(void *arg)
+{
+    struct bench_client *cli = arg;
+    caesar_session_t *sess;
+    char name[BUFSIZE];
+    uint64_t t0;
+
+    fill_messages(cli);
+
+    /* Pooled clients only rotate; main() opens and closes the pool */
+    if (shared_pool != NULL) {
+        pthread_barrier_wait(&phase_barrier);
+        run_sync(cli, NULL);
+        pthread_barrier_wait(&phase_barrier);
+        return NULL;
+    }
+
+    snprintf(name, sizeof(name), "%s_%ld_%u", config.prefix, (long) getpid(), cli->id);
+
+    t0 = now_ns();
+    sess = caesar_session_open(name, cli->prio, config.transport);
+    cli->register_ns = now_ns() - t0;
+
+    /* A client the service would not take still keeps the others in step */
+    if (sess == NULL) {
+        if (errno != EBUSY)
+            fprintf(stderr, "client %u: caesar_session_open: %s\n", cli->id, strerror(errno));
+        cli->busy = 1;
+        pthread_barrier_wait(&phase_barrier);
+        pthread_barrier_wait(&phase_barrier);
+        return NULL;
+    }
+    caesar_set_deadline(sess, config.deadline_us);
+
+    pthread_barrier_wait(&phase_barrier);
+    if (config.depth > 1)
+        run_async(cli, sess);
+    else
+        run_sync(cli, sess);
+    pthread_barrier_wait(&phase_barrier);
+
+    t0 = now_ns();
+    caesar_session_close(sess);
+    cli->deregister_ns = now_ns() - t0;
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+* percentile() - nearest-rank percentile of sorted samples
+* @v: samples, sorted ascending
+* @n: number of samples, at least 1
+* @p: percentile, 0 < p <= 100
+*/
+static uint64_t percentile(const uint64_t *v, size_t n, double p)
+{
+    size_t rank = (size_t) (p / 100.0 * n + 0.999999);
+
+    if (rank < 1)
+        rank = 1;
+    if (rank > n)
+        rank = n;
+    return v[rank - 1];
+}
+
+/**
+* summarize() - sort samples and compute their summary
+* @v: samples; sorted in place
+* @n: number of samples
+*/
+static struct summary summarize(uint64_t *v, size_t n)
+{
+    struct summary s;
+    double sum = 0;
+    size_t i;
+
+    memset(&s, 0, sizeof(s));
+    s.count = n;
+    if (n == 0)
+        return s;
+
+    qsort(v, n, sizeof(*v), cmp_u64);
+    for (i = 0; i < n; i++)
+        sum += v[i];
+    s.mean = sum / n;
+    s.p50 = percentile(v, n, 50);
+    s.p90 = percentile(v, n, 90);
+    s.p99 = percentile(v, n, 99);
+    s.p999 = percentile(v, n, 99.9);
+    s.max = v[n - 1];
+    return s;
+}
+
+/**
+* collect() - gather one phase's samples from the clients
+* @clients: all clients
+* @ph: the phase
+* @prio: only clients registered with this priority, or -1 for all
+* @n: set to the number of samples
+*
+* With -P the pool's open and close are client 0's register and
+* deregister samples.
+*
+* Return: a malloc'd array of samples
+*/
+static uint64_t *collect(struct bench_client *clients, enum phase ph, long prio, size_t *n)
+{
+    uint64_t *v;
+    unsigned int i;
+
+    v = malloc(((size_t) config.clients * config.requests + 1) * sizeof(*v));
+    if (v == NULL)
+        error_exit("malloc (bench samples)");
+
+    *n = 0;
+    for (i = 0; i < config.clients; i++) {
+        if (prio >= 0 && clients[i].prio != (unsigned int) prio)
+            continue;
+        if (config.pool > 0 && i > 0 && ph != PHASE_ROTATE)
+            continue;
+        switch (ph) {
+            case PHASE_REGISTER:
+                v[(*n)++] = clients[i].register_ns;
+                break;
+            case PHASE_DEREGISTER:
+                if (!clients[i].busy)
+                    v[(*n)++] = clients[i].deregister_ns;
+                break;
+            case PHASE_ROTATE:
+            case NPHASES:
+                memcpy(v + *n, clients[i].rotate_ns, clients[i].nrotate * sizeof(*v));
+                *n += clients[i].nrotate;
+                break;
+        }
+    }
+    return v;
+}
+
+static void print_summary_json(const char *name, const struct summary *s)
+{
+    printf("\"%s\": {\"count\": %zu, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+           "\"p99_us\": %.3f, \"p99.9_us\": %.3f, \"max_us\": %.3f}",
+           name, s->count, s->mean / 1e3, s->p50 / 1e3, s->p90 / 1e3,
+           s->p99 / 1e3, s->p999 / 1e3, s->max / 1e3);
+}
+
+static void print_summary_text(const char *name, const struct summary *s)
+{
+    printf("%-14s %9zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+           name, s->count, s->mean / 1e3, s->p50 / 1e3, s->p90 / 1e3,
+           s->p99 / 1e3, s->p999 / 1e3, s->max / 1e3);
+}
+
+/**
+* report() - print throughput and per-phase latency percentiles
+* @clients: all clients, finished
+* @elapsed: wall time of the rotate phase in nanoseconds
+* @rotate: receives the rotate phase summary, for comparing transports
+*
+* Return: rotate phase throughput in requests per second
+*/
+static double report(struct bench_client *clients, uint64_t elapsed, struct summary *rotate)
+{
+    struct summary phases[NPHASES], by_prio[MAX_PRIOS];
+    char label[32];
+    unsigned long failures = 0, busy = 0;
+    size_t total, n;
+    uint64_t *v;
+    unsigned int i, k;
+    double rps;
+
+    for (i = 0; i < NPHASES; i++) {
+        v = collect(clients, i, -1, &n);
+        phases[i] = summarize(v, n);
+        free(v);
+    }
+    for (k = 0; k < config.nprios; k++) {
+        v = collect(clients, PHASE_ROTATE, config.prios[k], &n);
+        by_prio[k] = summarize(v, n);
+        free(v);
+    }
+    for (i = 0; i < config.clients; i++) {
+        failures += clients[i].failures;
+        busy += clients[i].busy;
+    }
+    total = phases[PHASE_ROTATE].count;
+    rps = elapsed > 0 ? total / (elapsed / 1e9) : 0;
+    *rotate = phases[PHASE_ROTATE];
+
+    if (config.json) {
+        printf("{\"clients\": %u, \"requests_per_client\": %u, \"size\": %zu, ",
+               config.clients, config.requests, config.size);
+        if (config.shift_uniform)
+            printf("\"shift\": \"uniform\", ");
+        else
+            printf("\"shift\": %d, ", config.shift);
+        printf("\"rate\": %.3f, \"depth\": %u, \"deadline_us\": %lu, \"pool\": %u, \"transport\": \"%s\",\n",
+               config.rate, config.depth, config.deadline_us, config.pool,
+               caesar_transport_name(config.transport));
+        printf(" \"requests\": %zu, \"failures\": %lu, \"busy_clients\": %lu, \"elapsed_s\": %.6f, \"throughput_rps\": %.1f,\n",
+               total, failures, busy, elapsed / 1e9, rps);
+        printf(" \"phases\": {");
+        for (i = 0; i < NPHASES; i++) {
+            printf(i ? ",\n   " : "");
+            print_summary_json(phase_names[i], &phases[i]);
+        }
+        printf("},\n \"rotate_by_priority\": {");
+        for (k = 0; k < config.nprios; k++) {
+            snprintf(label, sizeof(label), "%u", config.prios[k]);
+            printf(k ? ",\n   " : "");
+            print_summary_json(label, &by_prio[k]);
+        }
+        printf("}}");
+        return rps;
+    }
+
+    printf("%u clients x %u requests of %zu bytes over %s, depth %u",
+           config.clients, config.requests, config.size,
+           caesar_transport_name(config.transport), config.depth);
+    if (config.rate > 0)
+        printf(", %.1f req/s per client", config.rate);
+    if (config.deadline_us > 0)
+        printf(", deadline %lu us", config.deadline_us);
+    if (config.pool > 0)
+        printf(", sharing %u sessions", config.pool);
+    printf("\n%zu requests (%lu failed) in %.3f s: %.1f req/s\n",
+           total, failures, elapsed / 1e9, rps);
+    if (busy > 0)
+        printf("%lu clients turned away by a busy service\n", busy);
+    printf("\n");
+    printf("%-14s %9s %10s %10s %10s %10s %10s %10s\n",
+           "phase (us)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < NPHASES; i++)
+        print_summary_text(phase_names[i], &phases[i]);
+    if (config.nprios > 1) {
+        for (k = 0; k < config.nprios; k++) {
+            snprintf(label, sizeof(label), "rotate prio %u", config.prios[k]);
+            print_summary_text(label, &by_prio[k]);
+        }
+    }
+    return rps;
+}
+
+/**
+* run_clients() - run the configured workload once, over config.transport
+* @clients: config.clients entries, with their sample arrays
+*
+* Return: wall time of the rotate phase in nanoseconds
+*/
+static uint64_t run_clients(struct bench_client *clients)
+{
+    caesar_session_t *sess[CAESAR_POOL_MAX];
+    char prefix[BUFSIZE];
+    uint64_t start, elapsed, pool_open = 0;
+    unsigned int i, n;
+
+    if (config.pool > 0) {
+        snprintf(prefix, sizeof(prefix), "%s_%ld_pool", config.prefix, (long) getpid());
+        start = now_ns();
+        shared_pool = caesar_pool_open(prefix, config.pool, config.prios[0], config.transport);
+        if (shared_pool == NULL)
+            error_exit("caesar_pool_open (%u sessions)", config.pool);
+        pool_open = now_ns() - start;
+
+        /* Every session is borrowed once to set its deadline */
+        n = caesar_pool_sessions(shared_pool);
+        for (i = 0; i < n; i++) {
+            sess[i] = caesar_pool_acquire(shared_pool);
+            caesar_set_deadline(sess[i], config.deadline_us);
+        }
+        for (i = 0; i < n; i++)
+            caesar_pool_release(shared_pool, sess[i]);
+    }
+
+    for (i = 0; i < config.clients; i++) {
+        clients[i].id = i;
+        clients[i].prio = config.prios[i % config.nprios];
+        clients[i].seed = 0x9e3779b9u * (i + 1);
+        clients[i].register_ns = clients[i].deregister_ns = 0;
+        clients[i].nrotate = clients[i].failures = 0;
+        clients[i].busy = 0;
+        if (pthread_create(&clients[i].thread, NULL, client_main, &clients[i]) != 0)
+            error_exit("pthread_create (client %u)", i);
+    }
+
+    /* Throughput only counts the rotate phase, between the two barriers */
+    pthread_barrier_wait(&phase_barrier);
+    start = now_ns();
+    pthread_barrier_wait(&phase_barrier);
+    elapsed = now_ns() - start;
+
+    for (i = 0; i < config.clients; i++)
+        pthread_join(clients[i].thread, NULL);
+
+    if (shared_pool != NULL) {
+        clients[0].register_ns = pool_open;
+        start = now_ns();
+        caesar_pool_close(shared_pool);
+        clients[0].deregister_ns = now_ns() - start;
+        shared_pool = NULL;
+    }
+    return elapsed;
+}
+
+/**
+* compare() - print one line per transport of the rotate phase
+* @rps: throughput of each transport
+* @rotate: rotate phase summary of each transport
+*
+*/
+static void compare(const double rps[], const struct summary rotate[])
+{
+    unsigned int t;
+
+    printf("\n%-14s %12s %10s %10s %10s %10s %10s\n",
+           "transport (us)", "req/s", "mean", "p50", "p90", "p99", "p99.9");
+    for (t = 0; t < CAESAR_NTRANSPORTS; t++)
+        printf("%-14s %12.1f %10.2f %10.2f %10.2f %10.2f %10.2f\n", caesar_transport_name(t), rps[t],
+               rotate[t].mean / 1e3, rotate[t].p50 / 1e3, rotate[t].p90 / 1e3,
+               rotate[t].p99 / 1e3, rotate[t].p999 / 1e3);
+}
+
+/**
+* parse_prios() - parse a comma-separated priority mix such as '0,5,9'
+* @arg: the -p argument
+*
+* Return: 0 on success, -1 if it is malformed
+*/
+static int parse_prios(const char *arg)
+{
+    char *end;
+    long p;
+
+    config.nprios = 0;
+    do {
+        p = strtol(arg, &end, 10);
+        if (end == arg || p < 0 || p > 10 || config.nprios == MAX_PRIOS)
+            return -1;
+        config.prios[config.nprios++] = p;
+        arg = end + 1;
+    } while (*end == ',');
+    return *end == '\0' ? 0 : -1;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench_client *clients;
+    struct summary rotate[CAESAR_NTRANSPORTS];
+    double rps[CAESAR_NTRANSPORTS];
+    unsigned int i, j, t;
+    int opt;
+
+    config.clients = 4;
+    config.requests = 10000;
+    config.size = 64;
+    config.shift = 3;
+    config.prios[0] = 0;
+    config.nprios = 1;
+    config.depth = 1;
+    config.transport = CAESAR_TRANSPORT_RING;
+    config.prefix = "bench";
+
+    if (argc > 1 && !strcmp(argv[1],"--version")) {
+      printf("Caesar Bench v%s\n",VERSION);
+      exit(EXIT_SUCCESS);
+    }
+
+    while ((opt = getopt_long(argc, argv, "hc:n:S:s:p:r:d:D:P:t:q:x:j", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                if (atoi(optarg) < 1)
+                    usage_error(argv[0], BENCH);
+                config.clients = atoi(optarg);
+                break;
+            case 'n':
+                if (atoi(optarg) < 1)
+                    usage_error(argv[0], BENCH);
+                config.requests = atoi(optarg);
+                break;
+            case 'S':
+                if (atol(optarg) < 0)
+                    usage_error(argv[0], BENCH);
+                config.size = atol(optarg);
+                break;
+            case 's': /* a fixed shift, or 'uniform' */
+                if (!strcmp(optarg, "uniform"))
+                    config.shift_uniform = 1;
+                else
+                    config.shift = atoi(optarg);
+                break;
+            case 'p':
+                if (parse_prios(optarg) == -1)
+                    usage_error(argv[0], BENCH);
+                break;
+            case 'r':
+                config.rate = atof(optarg);
+                break;
+            case 'd':
+                if (atoi(optarg) < 1 || atoi(optarg) > CAESAR_MAX_INFLIGHT)
+                    usage_error(argv[0], BENCH);
+                config.depth = atoi(optarg);
+                break;
+            case 'D':
+                config.deadline_us = strtoul(optarg, NULL, 10);
+                break;
+            case 'P': /* client threads share this many sessions */
+                if (atoi(optarg) < 1 || atoi(optarg) > CAESAR_POOL_MAX)
+                    usage_error(argv[0], BENCH);
+                config.pool = atoi(optarg);
+                break;
+            case 't': /* a transport, or 'all' to compare them */
+                if (!strcmp(optarg, "all"))
+                    config.all_transports = 1;
+                else if (caesar_transport_lookup(optarg, &config.transport) == -1)
+                    usage_error(argv[0], BENCH);
+                break;
+            case 'q':
+                if (strlen(optarg) > 200)
+                    usage_error(argv[0], BENCH);
+                config.prefix = optarg;
+                break;
+            case 'x': /* service instances to spread the clients over */
+                if (caesar_set_shards(optarg) == -1)
+                    usage_error(argv[0], BENCH);
+                break;
+            case 'j':
+                config.json = 1;
+                break;
+            case 'h':
+            default:
+                usage_error(argv[0], BENCH);
+        }
+    }
+
+    /* Pooled clients borrow a session per request, so they cannot keep requests in flight */
+    if (config.pool > 0 && config.depth > 1)
+        usage_error(argv[0], BENCH);
+
+    clients = calloc(config.clients, sizeof(*clients));
+    if (clients == NULL)
+        error_exit("calloc (bench clients)");
+    if (pthread_barrier_init(&phase_barrier, NULL, config.clients + 1) != 0)
+        error_exit("pthread_barrier_init");
+
+    for (i = 0; i < config.clients; i++) {
+        clients[i].rotate_ns = malloc(config.requests * sizeof(uint64_t));
+        if (clients[i].rotate_ns == NULL)
+            error_exit("malloc (bench samples)");
+        for (j = 0; j < config.depth; j++) {
+            clients[i].msg[j] = malloc(config.size + 1);
+            if (clients[i].msg[j] == NULL)
+                error_exit("malloc (bench message)");
+        }
+    }
+
+    if (!config.all_transports) {
+        report(clients, run_clients(clients), &rotate[0]);
+        printf(config.json ? "\n" : "");
+    } else {
+        /* The same workload over each transport in turn, then side by side */
+        printf(config.json ? "[" : "");
+        for (t = 0; t < CAESAR_NTRANSPORTS; t++) {
+            config.transport = t;
+            if (t > 0)
+                printf(config.json ? ",\n " : "\n");
+            rps[t] = report(clients, run_clients(clients), &rotate[t]);
+        }
+        if (config.json)
+            printf("]\n");
+        else
+            compare(rps, rotate);
+    }
+
+    for (i = 0; i < config.clients; i++) {
+        free(clients[i].rotate_ns);
+        for (j = 0; j < config.depth; j++)
+            free(clients[i].msg[j]);
+    }
+    free(clients);
+    return EXIT_SUCCESS;
+}
@@ -7,6 +7,8 @@
 * any later version. This program is distributed without any warranty.    *
 * See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
 \*************************************************************************/
+#include <pthread.h> /* pthread_once for one-time kernel selection */
+
 #include "caesar.h"
 
 /**
@@ -71,6 +73,186 @@ int getindex(char c, char *alphabet)
     return -1;
 }
 
+/*
+* rotx kernels
+*
+* Every kernel takes a shift that has already been normalized to 0..25 and
+* rewrites len bytes in place.  A letter keeps its case and moves shift
+* places forward in its own alphabet; every other byte is left untouched.
+* The SIMD kernels compute this with branch-free byte arithmetic: the case
+* bit is folded in to get the alphabet index, letters are masked, and the
+* shift (or shift-26 when the index wraps past 'z') is added to the masked
+* lanes only.  Tails shorter than a vector fall back to the scalar table.
+*/
+typedef void (*rotx_kernel)(unsigned char *buf, size_t len, unsigned int shift);
+
+static unsigned char rot_table[26][256];
+static rotx_kernel rotx_impl;
+static const char *rotx_impl_name = "scalar";
+static pthread_once_t rotx_once = PTHREAD_ONCE_INIT;
+
+static void
+rotx_scalar(unsigned char *buf, size_t len, unsigned int shift)
+{
+    const unsigned char *table = rot_table[shift];
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = table[buf[i]];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__ ((target ("sse2")))
+static void
+rotx_sse2(unsigned char *buf, size_t len, unsigned int shift)
+{
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i first = _mm_set1_epi8('a');
+    const __m128i below = _mm_set1_epi8(-1);
+    const __m128i last = _mm_set1_epi8(25);
+    const __m128i span = _mm_set1_epi8(26);
+    const __m128i amt = _mm_set1_epi8((char) shift);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+        __m128i idx = _mm_sub_epi8(_mm_or_si128(v, case_bit), first);
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(idx, below), _mm_cmpgt_epi8(span, idx));
+        __m128i wrap = _mm_cmpgt_epi8(_mm_add_epi8(idx, amt), last);
+        __m128i delta = _mm_sub_epi8(amt, _mm_and_si128(wrap, span));
+        v = _mm_add_epi8(v, _mm_and_si128(alpha, delta));
+        _mm_storeu_si128((__m128i *) (buf + i), v);
+    }
+    rotx_scalar(buf + i, len - i, shift);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+rotx_avx2(unsigned char *buf, size_t len, unsigned int shift)
+{
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i first = _mm256_set1_epi8('a');
+    const __m256i below = _mm256_set1_epi8(-1);
+    const __m256i last = _mm256_set1_epi8(25);
+    const __m256i span = _mm256_set1_epi8(26);
+    const __m256i amt = _mm256_set1_epi8((char) shift);
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i idx = _mm256_sub_epi8(_mm256_or_si256(v, case_bit), first);
+        __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(idx, below), _mm256_cmpgt_epi8(span, idx));
+        __m256i wrap = _mm256_cmpgt_epi8(_mm256_add_epi8(idx, amt), last);
+        __m256i delta = _mm256_sub_epi8(amt, _mm256_and_si256(wrap, span));
+        v = _mm256_add_epi8(v, _mm256_and_si256(alpha, delta));
+        _mm256_storeu_si256((__m256i *) (buf + i), v);
+    }
+    rotx_scalar(buf + i, len - i, shift);
+}
+
+__attribute__ ((target ("avx512f,avx512bw")))
+static void
+rotx_avx512bw(unsigned char *buf, size_t len, unsigned int shift)
+{
+    const __m512i case_bit = _mm512_set1_epi8(0x20);
+    const __m512i first = _mm512_set1_epi8('a');
+    const __m512i last = _mm512_set1_epi8(25);
+    const __m512i span = _mm512_set1_epi8(26);
+    const __m512i amt = _mm512_set1_epi8((char) shift);
+    const __m512i back = _mm512_set1_epi8((char) (shift - 26));
+    __mmask64 lanes = ~(__mmask64) 0;
+    size_t i;
+
+    for (i = 0; i < len; i += 64) {
+        __m512i v, idx, delta;
+        __mmask64 alpha, wrap;
+
+        if (len - i < 64) /* masked load/store handles the tail */
+            lanes = ((__mmask64) 1 << (len - i)) - 1;
+        v = _mm512_maskz_loadu_epi8(lanes, buf + i);
+        idx = _mm512_sub_epi8(_mm512_or_si512(v, case_bit), first);
+        alpha = _mm512_cmplt_epu8_mask(idx, span);
+        wrap = _mm512_cmpgt_epu8_mask(_mm512_add_epi8(idx, amt), last);
+        delta = _mm512_mask_blend_epi8(wrap, amt, back);
+        v = _mm512_mask_add_epi8(v, alpha, v, delta);
+        _mm512_mask_storeu_epi8(buf + i, lanes, v);
+    }
+}
+#endif
+
+/**
+* rotx_init() - build the lookup tables and pick a kernel
+*
+* Runs exactly once (through pthread_once) before the first rotation.  The
+* widest kernel the CPU supports according to CPUID is selected.
+*
+*/
+static void
+rotx_init(void)
+{
+    unsigned int s, c;
+
+    for (s = 0; s < 26; s++) {
+        for (c = 0; c < 256; c++)
+            rot_table[s][c] = (unsigned char) c;
+        for (c = 0; c < 26; c++) {
+            rot_table[s]['A' + c] = (unsigned char) ('A' + (c + s) % 26);
+            rot_table[s]['a' + c] = (unsigned char) ('a' + (c + s) % 26);
+        }
+    }
+
+    rotx_impl = rotx_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        rotx_impl = rotx_avx512bw;
+        rotx_impl_name = "avx512bw";
+    } else if (__builtin_cpu_supports("avx2")) {
+        rotx_impl = rotx_avx2;
+        rotx_impl_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        rotx_impl = rotx_sse2;
+        rotx_impl_name = "sse2";
+    }
+#endif
+}
+
+/**
+* rotx_kernel_name() - name of the rotx kernel selected for this CPU
+*
+* Return: "scalar", "sse2", "avx2" or "avx512bw"
+*
+*/
+const char *rotx_kernel_name(void)
+{
+    pthread_once(&rotx_once, rotx_init);
+    return rotx_impl_name;
+}
+
+/**
+* rotx_buf() - rotate the first len bytes of a buffer
+* @buf: the buffer to encode/decode in place (need not be NUL terminated)
+* @len: number of bytes to rotate
+* @shift: the number of rotations to shift (positive or negative value)
+*
+* Same transformation as rotx(), for callers that already know the length.
+*
+*/
+void rotx_buf(char buf[], size_t len, int shift)
+{
+    int s = shift % 26;
+
+    if (s < 0)
+        s += 26;
+    if (s == 0 || len == 0)
+        return;
+
+    pthread_once(&rotx_once, rotx_init);
+    rotx_impl((unsigned char *) buf, len, (unsigned int) s);
+}
+
 /**
 * rotx() - rotate a given message (caesar encode or decode)
 * @message: a pointer to a character array with our message
@@ -81,30 +263,5 @@ int getindex(char c, char *alphabet)
 */
 void rotx(char message[], int shift)
 {
-    char uppercase[27] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    char lowercase[27] = "abcdefghijklmnopqrstuvwxyz";
-    char u_tmp[27];
-    char l_tmp[27];
-    unsigned int j = 0;
-    int index = 0;
-    char msg_tmp[257];
-    snprintf( msg_tmp, strlen(message)+1, "%s", message );
-
-    strcpy(u_tmp,uppercase);
-    strcpy(l_tmp,lowercase);
-    rotate(u_tmp, strlen(u_tmp), shift);
-    rotate(l_tmp, strlen(l_tmp), shift);
-    for (j = 0; j < strlen(msg_tmp); j++) {
-        index = getindex(msg_tmp[j],u_tmp);
-        if (index >= 0) {
-            message[j] = uppercase[index];
-        } else {
-            index = getindex(msg_tmp[j],l_tmp);
-            if (index >= 0) {
-                message[j] = lowercase[index];
-            } else { // character at this index remains the same
-                message[j] = message[j];
-            }
-        }
-    }
+    rotx_buf(message, strlen(message), shift);
 }
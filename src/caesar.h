@@ -23,4 +23,8 @@ int getindex(char c, char *alphabet);
 
 void rotx(char message[], int shift);
 
+void rotx_buf(char buf[], size_t len, int shift);
+
+const char *rotx_kernel_name(void);
+
 #endif
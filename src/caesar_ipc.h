@@ -0,0 +1,192 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef CAESAR_IPC_H
+#define CAESAR_IPC_H
+
+#include <stddef.h> /* Needed for offsetof and size_t */
+#include <stdatomic.h> /* Slot state words are shared between processes */
+#include <semaphore.h> /* Free slot count, shared between processes */
+#include <sys/types.h> /* pid_t */
+
+#include "ring.h" /* Lock-free submission and completion rings */
+#include "arena.h" /* Variable-size payload buffers */
+#include "placement.h" /* PLACE_* flags, HUGE_PAGE_SIZE */
+
+/* Names of Shared Memory and Message Queues */
+#define SHM_NAME "/shm_caesar"
+#define REG_MQ_NAME "/mq_registration"
+#define BUFSIZE 256
+
+/* mq_msgsize of the registration and client queues; receive buffers are pooled at this size */
+#define MQ_MSGSIZE 2048
+
+/* Default number of request slots in the shared memory segment */
+#define DEFAULT_NSLOTS 64
+
+/*
+* Life cycle of a request slot:
+*
+*   FREE -> CLAIMED    service hands the slot out on registration
+*   CLAIMED -> READY   client has written message and shift
+*   READY -> DONE      service has rotated the message in place
+*   DONE -> CLAIMED    client has read the result back
+*   CLAIMED -> FREE    client deregisters, or the service reaps it
+*
+* Only the owner of the transition writes the state word, so no lock is
+* needed; the segment's free_slots semaphore counts the FREE slots.  The
+* service tags each slot it hands out with a new 'owner', so it only reaps
+* a slot that the dead client had not given back already.  Requests
+* move from CLAIMED to DONE either through the 'caesar'/'fin' handshake
+* on the client's message queues or through the submission ring (sq) and
+* the slot's own completion ring (cq).
+*/
+enum slot_state {
+  SLOT_FREE,
+  SLOT_CLAIMED,
+  SLOT_READY,
+  SLOT_DONE
+};
+
+/*
+* Messages of up to BUFSIZE bytes are staged inline in the slot.  Larger
+* ones live in a buffer from the payload arena: 'payload' is its offset
+* (ARENA_NONE for inline messages) and the buffer's length prefix says how
+* many bytes to rotate.  Either way the service rotates in place.
+* A ring client counts its submissions before pushing them and the
+* service counts their completions, so a slot whose client has died is
+* only reused once nothing of the client's is left on the rings.  Its
+* claim word tells the service which submission ring cell a client that
+* died while pushing had taken, so the cell can be skipped.
+*/
+struct request_slot {
+  atomic_int state;
+  uint64_t owner;            /* registration holding the slot, set by the service */
+  int shift;
+  unsigned int kind;         /* REQ_MESSAGE or REQ_BATCH */
+  char message[BUFSIZE+1];
+  uint64_t payload;
+  atomic_uint submitted;     /* ring requests pushed by the client */
+  atomic_uint completed;     /* ring requests the service has completed */
+  atomic_uint sq_claim;      /* submission ring claim word, see sq_push() */
+  struct complete_ring cq;   /* completions for the ring transport */
+};
+
+/*
+* A REQ_BATCH request always lives in the payload arena.  Its buffer starts
+* with a batch_header followed by 'count' entries; each entry names a
+* message by offset and length from the start of the buffer's data.  The
+* service rotates every message in place and completes the slot once.
+*/
+#define REQ_MESSAGE 0
+#define REQ_BATCH 1
+
+struct batch_entry {
+  int32_t shift;
+  uint32_t len;
+  uint64_t offset;
+};
+
+struct batch_header {
+  uint32_t count;
+  uint32_t pad;
+  struct batch_entry entries[];
+};
+
+/*
+* A service that takes over from a running one (caesar_service -R) puts a
+* new segment in place under the same name, while the old service keeps
+* serving its clients in the old one until they leave.  The semaphore
+* lives in the segment so each client hands its slot back to the right
+* one, and 'generation' tells the two apart.  The service's event loop
+* bumps 'heartbeat' at least once a second, so a client waiting on the
+* segment can tell when the service has died.
+*/
+struct shared_memory {
+  unsigned int nslots;
+  unsigned int placement;    /* PLACE_* flags, for clients to map the segment to match */
+  uint64_t generation;       /* unique to the service that created the segment */
+  atomic_uint heartbeat;
+  sem_t free_slots;          /* process-shared */
+  uint64_t arena_offset;     /* from the start of the segment */
+  struct arena arena;
+  struct submit_ring sq;     /* requests for the ring transport */
+  struct request_slot slots[];
+};
+
+/*
+* Registration message sent on REG_MQ_NAME.  With REG_RING set the client
+* submits its requests on the shared memory rings instead of sending
+* 'caesar' on its send queue, so the service does not wait on that queue.
+* A ring client sends the message again with REG_DEREGISTER before it
+* unlinks its queues, so the service can close them; message queue clients
+* send 'bye' on their send queue instead.
+*
+* The service replies on the client's receive queue with 'ack <slot>', or
+* with 'busy' when admission control turns the registration away; the
+* client then backs off and sends it again.  A client maps the segment
+* before it registers and sends its generation along.  A registration for
+* another segment than the reader's is answered 'stale', and is otherwise
+* ignored if it is a deregistration: the segment was replaced by a
+* takeover, and the client maps the new one and tries again.  The pid
+* lets the service notice a client that exits without deregistering.
+*/
+#define REG_RING 0x1
+#define REG_DEREGISTER 0x2
+
+struct registration {
+  unsigned int flags;
+  char name[BUFSIZE];
+  uint64_t generation;       /* of the segment the client has mapped */
+  pid_t pid;                 /* of the client process */
+};
+
+/*
+* Unix socket transport.  A client connects a SOCK_SEQPACKET socket to
+* SOCK_NAME in the abstract namespace and needs no registration, slot or
+* global shared memory.  Payloads live in memfds the client shares with
+* SCM_RIGHTS: a request carrying a descriptor installs it as 'region' for
+* the rest of the connection, replacing any earlier one.  The memfd must
+* be sealed with F_SEAL_SHRINK so it cannot be cut short under the
+* service.  At 'offset' in the region is a struct arena_buf header and its
+* data, which the service rotates in place.  Replies come back in request
+* order.
+*/
+#define SOCK_NAME "caesar_service"
+#define SOCK_REGIONS 4
+
+struct sock_request {
+  uint64_t tag;              /* echoed in the reply */
+  uint64_t offset;           /* of the arena_buf header in the region */
+  uint32_t region;
+  uint32_t kind;             /* REQ_MESSAGE or REQ_BATCH */
+  int32_t shift;
+  uint32_t pad;
+};
+
+struct sock_reply {
+  uint64_t tag;
+  int32_t status;            /* 0 on success, -1 if the request was invalid */
+  uint32_t pad;
+};
+
+/* Slot area of the segment, padded so the arena starts aligned */
+#define SHM_SLOTS_SIZE(nslots) \
+  ((offsetof(struct shared_memory, slots) + (size_t) (nslots) * sizeof(struct request_slot) \
+    + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+#define SHM_SIZE(nslots, arena_size) (SHM_SLOTS_SIZE(nslots) + (size_t) (arena_size))
+
+/* The same, with the arena starting on a huge page boundary */
+#define SHM_HUGE_SLOTS_SIZE(nslots) \
+  ((SHM_SLOTS_SIZE(nslots) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1))
+
+#define SHM_ARENA(shm) ((char *) (shm) + (shm)->arena_offset)
+
+#endif
@@ -0,0 +1,230 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+\*************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h> /* Needed for offsetof */
+#include <unistd.h> /* Needed for getopt cli parsing and isatty */
+#include <string.h> /* Needed for strcmp */
+#include <time.h> /* nanosleep */
+#include "stats.h"
+#include "errors.h"
+#include "ipcns.h" /* The instance's segment name */
+
+#define VERSION "0.1"
+
+/* Indexed by the state gauge */
+static const char *const states[] = { "serving", "draining", "handed over" };
+
+/* Homes the cursor and clears a terminal screen between refreshes */
+#define CLEAR "\033[H\033[2J"
+
+/* Counters shown with their rate, in display order */
+static const struct counter {
+  const char *name;
+  size_t offset;
+} counters[] = {
+  { "requests",        offsetof(struct service_stats, requests) },
+  { "  ring",          offsetof(struct service_stats, ring_requests) },
+  { "  mq",            offsetof(struct service_stats, mq_requests) },
+  { "  unix",          offsetof(struct service_stats, sock_requests) },
+  { "batches",         offsetof(struct service_stats, batches) },
+  { "failures",        offsetof(struct service_stats, failures) },
+  { "bytes rotated",   offsetof(struct service_stats, bytes_rotated) },
+  { "registrations",   offsetof(struct service_stats, registrations) },
+  { "deregistrations", offsetof(struct service_stats, deregistrations) },
+  { "dropped clients", offsetof(struct service_stats, dropped_clients) },
+  { "reaped clients",  offsetof(struct service_stats, reaped_clients) },
+  { "busy replies",    offsetof(struct service_stats, busy_replies) },
+  { "deadline urgent", offsetof(struct service_stats, sched_urgent) },
+  { "deadline late",   offsetof(struct service_stats, sched_late) },
+  { "cache hits",      offsetof(struct service_stats, cache_hits) },
+  { "cache misses",    offsetof(struct service_stats, cache_misses) },
+  { "cache collapsed", offsetof(struct service_stats, cache_collapsed) },
+};
+
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+/* Everything a display needs from one read of the segment */
+struct snapshot {
+  uint64_t when;
+  unsigned long long counter[NCOUNTERS];
+  unsigned long long prio_registrations[STATS_PRIOS];
+  unsigned long long prio_requests[STATS_PRIOS];
+  unsigned long long prio_wait_ns[STATS_PRIOS];
+  struct stats_hist_snap rotx;
+  struct stats_hist_snap sem_wait;
+};
+
+/**
+* take_snapshot() - read the counters and histograms of a running service
+* @stats: the mapped segment
+* @snap: receives the values
+*
+*/
+static void take_snapshot(const struct service_stats *stats, struct snapshot *snap)
+{
+    const atomic_ullong *c;
+    unsigned int i;
+
+    snap->when = stats_now_ns();
+    for (i = 0; i < NCOUNTERS; i++) {
+        c = (const atomic_ullong *) (const void *) ((const char *) stats + counters[i].offset);
+        snap->counter[i] = atomic_load_explicit(c, memory_order_relaxed);
+    }
+    for (i = 0; i < STATS_PRIOS; i++) {
+        snap->prio_registrations[i] = atomic_load_explicit(&stats->prio_registrations[i], memory_order_relaxed);
+        snap->prio_requests[i] = atomic_load_explicit(&stats->prio_requests[i], memory_order_relaxed);
+        snap->prio_wait_ns[i] = atomic_load_explicit(&stats->prio_wait_ns[i], memory_order_relaxed);
+    }
+    stats_hist_read(&stats->rotx, &snap->rotx);
+    stats_hist_read(&stats->sem_wait, &snap->sem_wait);
+}
+
+/**
+* hist_delta() - the samples a histogram gained between two snapshots
+* @now: the later copy
+* @then: the earlier copy
+* @delta: receives the difference
+*
+*/
+static void hist_delta(const struct stats_hist_snap *now, const struct stats_hist_snap *then,
+                       struct stats_hist_snap *delta)
+{
+    unsigned int b;
+
+    delta->count = now->count - then->count;
+    delta->sum_ns = now->sum_ns - then->sum_ns;
+    for (b = 0; b < STATS_BUCKETS; b++)
+        delta->buckets[b] = now->buckets[b] - then->buckets[b];
+}
+
+static void print_hist(const char *name, const struct stats_hist_snap *h)
+{
+    printf("%-16s %12llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, h->count,
+           h->count ? h->sum_ns / 1e3 / h->count : 0.0,
+           stats_hist_percentile(h, 50) / 1e3, stats_hist_percentile(h, 90) / 1e3,
+           stats_hist_percentile(h, 99) / 1e3, stats_hist_percentile(h, 99.9) / 1e3);
+}
+
+/**
+* display() - print one screen of statistics
+* @stats: the mapped segment, for the gauges
+* @now: the latest snapshot
+* @then: the previous one; rates and latencies cover the time in between
+*
+*/
+static void display(const struct service_stats *stats, const struct snapshot *now,
+                    const struct snapshot *then)
+{
+    struct stats_hist_snap rotx, sem_wait;
+    double secs = (now->when - then->when) / 1e9;
+    long up = (long) (time(NULL) - stats->start_time);
+    unsigned long long served;
+    unsigned int i, state;
+
+    state = atomic_load_explicit(&stats->state, memory_order_relaxed);
+    printf("caesar service pid %ld, %s, up %ld:%02ld:%02ld, rotx kernel '%s'\n",
+           (long) stats->pid, state <= STATS_HANDED_OVER ? states[state] : "?",
+           up / 3600, up / 60 % 60, up % 60, stats->rotx_kernel);
+    printf("slots %u/%u in use (%u waiting)   registration queue %u (max %u)   ring depth %u (max %u)\n\n",
+           atomic_load_explicit(&stats->slots_in_use, memory_order_relaxed), stats->nslots,
+           atomic_load_explicit(&stats->pending_registrations, memory_order_relaxed),
+           atomic_load_explicit(&stats->reg_queue_depth, memory_order_relaxed),
+           atomic_load_explicit(&stats->reg_queue_max, memory_order_relaxed),
+           atomic_load_explicit(&stats->ring_depth, memory_order_relaxed),
+           atomic_load_explicit(&stats->ring_depth_max, memory_order_relaxed));
+
+    printf("%-16s %12s %12s\n", "", "total", "per second");
+    for (i = 0; i < NCOUNTERS; i++)
+        printf("%-16s %12llu %12.1f\n", counters[i].name, now->counter[i],
+               secs > 0 ? (now->counter[i] - then->counter[i]) / secs : 0.0);
+
+    hist_delta(&now->rotx, &then->rotx, &rotx);
+    hist_delta(&now->sem_wait, &then->sem_wait, &sem_wait);
+    printf("\n%-16s %12s %10s %10s %10s %10s %10s\n",
+           "latency (us)", "count", "mean", "p50", "p90", "p99", "p99.9");
+    print_hist("rotx", &rotx);
+    print_hist("slot wait", &sem_wait);
+
+    printf("\n%-16s %12s %12s %12s %12s\n", "priority", "registered", "requests", "per second", "wait (us)");
+    for (i = 0; i < STATS_PRIOS; i++) {
+        if (now->prio_registrations[i] == 0 && now->prio_requests[i] == 0)
+            continue;
+        served = now->prio_requests[i] - then->prio_requests[i];
+        printf("%-16u %12llu %12llu %12.1f %12.2f\n", i, now->prio_registrations[i], now->prio_requests[i],
+               secs > 0 ? served / secs : 0.0,
+               served ? (now->prio_wait_ns[i] - then->prio_wait_ns[i]) / 1e3 / served : 0.0);
+    }
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+    const struct service_stats *stats;
+    struct snapshot snaps[2];
+    struct timespec period;
+    double interval = 1.0;
+    long iterations = 0, i;
+    int clear, opt;
+    const char *ns = ipc_ns_default();
+    struct ipc_names ipc;
+
+    if (argc > 1 && !strcmp(argv[1],"--help")) {
+      usage_error(argv[0], STATS);
+    } else if (argc > 1 && !strcmp(argv[1],"--version")) {
+      printf("Caesar Stats v%s\n",VERSION);
+      exit(EXIT_SUCCESS);
+    }
+
+    while ((opt = getopt(argc, argv, "hi:n:x:")) != -1) {
+        switch (opt) {
+            case 'i': /* seconds between screens */
+                interval = atof(optarg);
+                if (interval <= 0)
+                    usage_error(argv[0], STATS);
+                break;
+            case 'n': /* number of screens, 0 for no limit */
+                iterations = atol(optarg);
+                if (iterations < 0)
+                    usage_error(argv[0], STATS);
+                break;
+            case 'x': /* namespace of the service instance */
+                ns = optarg;
+                break;
+            case 'h':
+            default:
+                usage_error(argv[0], STATS);
+        }
+    }
+
+    if (ipc_names_init(&ipc, ns) == -1)
+        usage_error(argv[0], STATS);
+    stats = stats_attach(ipc.stats);
+    if (stats == NULL) {
+        fprintf(stderr, "No statistics at %s; is caesar_service running?\n", ipc.stats);
+        return EXIT_FAILURE;
+    }
+
+    clear = isatty(STDOUT_FILENO);
+    period.tv_sec = (time_t) interval;
+    period.tv_nsec = (long) ((interval - period.tv_sec) * 1e9);
+
+    take_snapshot(stats, &snaps[0]);
+    for (i = 1; iterations == 0 || i <= iterations; i++) {
+        nanosleep(&period, NULL);
+        take_snapshot(stats, &snaps[i % 2]);
+        if (clear)
+            printf(CLEAR);
+        else if (i > 1)
+            printf("\n");
+        display(stats, &snaps[i % 2], &snaps[(i + 1) % 2]);
+    }
+    return EXIT_SUCCESS;
+}
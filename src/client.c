@@ -9,25 +9,258 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h> /* Needed for getopt cli parsing */
+#include <getopt.h> /* Needed for getopt_long (--batch) */
 #include <string.h> /* Needed for strcmp */
+#include <errno.h> /* EINTR from read and write, and the library's failures */
+#include <sys/mman.h> /* Input files are mapped */
+#include <sys/stat.h> /* fstat */
+#include <fcntl.h> /* Defines file descriptor constants: O_ */
 #include "service_api.h"
 #include "errors.h"
 
 #define VERSION "0.1"
 #define BUFSIZE 256
 
+/* Lines of a --batch file sent to the service per request */
+#define BATCH_LINES 1024
+
+/* A -f stream goes through the service in chunks of this many bytes, STREAM_DEPTH at a time */
+#define STREAM_CHUNK (1 << 20)
+#define STREAM_DEPTH 4
+
+static const struct option long_options[] = {
+    { "batch", required_argument, NULL, 'b' },
+    { "transport", required_argument, NULL, 't' },
+    { "shards", required_argument, NULL, 'x' },
+    { NULL, 0, NULL, 0 }
+};
+
+/* Sends a file of '<shift> <message>' lines in batches of BATCH_LINES */
+static int run_batch(caesar_session_t *session, FILE *in);
+
+/* Streams a file or stdin through the service in STREAM_CHUNK pieces */
+static int run_stream(caesar_session_t *session, int in_fd, int out_fd, int shift);
+
+/* Opens a session, saying why on stderr if it cannot */
+static caesar_session_t *open_session(const char *name, int priority, enum service_transport transport);
+
+/**
+* open_session() - open a session, or report why there is none
+* @name: the client queue name
+* @priority: registration priority
+* @transport: how requests reach the service
+*
+* Return: the session, or NULL once the reason is on stderr
+*/
+static caesar_session_t *open_session(const char *name, int priority, enum service_transport transport)
+{
+    caesar_session_t *session = caesar_session_open(name, priority, transport);
+
+    if (session == NULL) {
+        if (errno == EBUSY)
+            fprintf(stderr, "Service is busy, try again later\n");
+        else
+            fprintf(stderr, "Cannot reach the service: %s\n", strerror(errno));
+    }
+    return session;
+}
+
+/**
+* run_batch() - rotate every line of a batch file
+* @session: an open session
+* @in: lines of the form '<shift> <message>'
+*
+* Each line's result is written to stdout in input order.  Lines are sent
+* to the service BATCH_LINES at a time, one request per batch.
+*
+* Return: EXIT_SUCCESS, or EXIT_FAILURE if the service rejected a batch
+*/
+static int run_batch(caesar_session_t *session, FILE *in)
+{
+    char *lines[BATCH_LINES];
+    char *messages[BATCH_LINES];
+    int shifts[BATCH_LINES];
+    size_t caps[BATCH_LINES];
+    size_t count, i;
+    ssize_t len;
+    char *end;
+    int status = EXIT_SUCCESS;
+
+    memset(lines, 0, sizeof(lines));
+    memset(caps, 0, sizeof(caps));
+
+    do {
+        for (count = 0; count < BATCH_LINES; count++) {
+            len = getline(&lines[count], &caps[count], in);
+            if (len == -1)
+                break;
+            if (len > 0 && lines[count][len-1] == '\n')
+                lines[count][len-1] = '\0';
+
+            shifts[count] = strtol(lines[count], &end, 10);
+            messages[count] = (*end == ' ' || *end == '\t') ? end + 1 : end;
+        }
+
+        if (count > 0 && caesar_rotate_batch(session, messages, shifts, count) != 0) {
+            fprintf(stderr, "Service did not process the batch: %s\n", strerror(errno));
+            status = EXIT_FAILURE;
+            break;
+        }
+        for (i = 0; i < count; i++)
+            printf("%s\n", messages[i]);
+    } while (count == BATCH_LINES);
+
+    for (i = 0; i < BATCH_LINES; i++)
+        free(lines[i]);
+    return status;
+}
+
+/**
+* write_all() - write a whole buffer, retrying short writes
+* @fd: the descriptor
+* @data: the bytes
+* @len: how many
+*
+* Return: 0 on success, -1 on a write error
+*/
+static int write_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+* read_full() - read until a buffer is full or the input ends
+* @fd: the descriptor
+* @buf: the buffer
+* @len: its size
+*
+* Return: bytes read, 0 at end of input, or -1 on a read error
+*/
+static ssize_t read_full(int fd, char *buf, size_t len)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < len) {
+        n = read(fd, buf + got, len - got);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        got += n;
+    }
+    return got;
+}
+
+/**
+* run_stream() - rotate a file or stdin as a stream of chunks
+* @session: an open session
+* @in_fd: the input, a file or a pipe
+* @out_fd: the output
+* @shift: the shift to apply
+*
+* Chunks are filled straight into the service's payload arena, from the
+* mapped input file or by reading stdin, and written out from there.
+* STREAM_DEPTH chunks rotate through the service, so the next chunk is
+* filled and the last one written while the service rotates the ones in
+* between.
+*
+* Return: EXIT_SUCCESS, or EXIT_FAILURE on an I/O error or a failed chunk
+*/
+static int run_stream(caesar_session_t *session, int in_fd, int out_fd, int shift)
+{
+    caesar_stream_t *stream;
+    const char *data;
+    char *map = NULL;
+    struct stat sb;
+    size_t size = 0, off = 0, len;
+    ssize_t n;
+    char *chunk;
+    int eof = 0, ret, status = EXIT_SUCCESS;
+
+    /* Regular files are mapped and copied into the chunks; pipes are read into them */
+    if (fstat(in_fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        size = sb.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (map == MAP_FAILED)
+            error_exit("mmap (stream input)");
+        madvise(map, size, MADV_SEQUENTIAL);
+    }
+
+    stream = caesar_stream_open(session, STREAM_CHUNK, STREAM_DEPTH, shift);
+    if (stream == NULL) {
+        fprintf(stderr, "Cannot open a stream: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (;;) {
+        /* Fill and submit every free chunk */
+        while (!eof && (chunk = caesar_stream_buffer(stream)) != NULL) {
+            if (map != NULL) {
+                n = size - off < STREAM_CHUNK ? size - off : STREAM_CHUNK;
+                memcpy(chunk, map + off, n);
+                off += n;
+            } else if ((n = read_full(in_fd, chunk, STREAM_CHUNK)) == -1) {
+                error_exit("read (stream input)");
+            }
+            if (n == 0 || (map != NULL && off == size))
+                eof = 1;
+            if (n > 0)
+                caesar_stream_submit(stream, n);
+        }
+
+        /* Then write out the oldest one */
+        ret = caesar_stream_result(stream, &data, &len);
+        if (ret == 0)
+            break;
+        if (ret == -1) {
+            fprintf(stderr, "Service did not process a chunk\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (write_all(out_fd, data, len) == -1)
+            error_exit("write (stream output)");
+    }
+
+    caesar_stream_close(stream);
+    if (map != NULL)
+        munmap(map, size);
+    return status;
+}
+
 int
 main(int argc, char **argv)
 {
     int opt;
-    char message[BUFSIZE];
+    char *message = NULL;
     int shift = 0;
     int priority = -1;
+    enum service_transport transport = CAESAR_TRANSPORT_RING;
+    caesar_session_t *session;
+    const char *batch_file = NULL;
+    const char *stream_in = NULL, *stream_out = NULL;
+    int in_fd, out_fd;
+    FILE *batch_in;
+    int status = EXIT_SUCCESS;
 
     /* Names of Shared Memory, Message Queues, and Semaphores */
     char client_q_name[BUFSIZE];
     client_q_name[0] = '\0';
-    memset(message, 0, sizeof message);
 
     if (argc < 2)
         usage_error(argv[0], CLIENT);
@@ -39,13 +272,13 @@ main(int argc, char **argv)
       exit(EXIT_SUCCESS);
     }
 
-    while ((opt = getopt(argc, argv, "hm:s:q:p:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "hm:s:q:p:t:f:o:x:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 usage_error(argv[0], CLIENT);
                 break;
-            case 'm': /* provide the message to encode/decode */
-                snprintf( message, BUFSIZE, "%s", optarg );
+            case 'm': /* provide the message to encode/decode; any length */
+                message = optarg;
                 break;
             case 's':
                 shift = atoi(optarg);
@@ -62,20 +295,81 @@ main(int argc, char **argv)
                     usage_error(argv[0], CLIENT);
                 }
                 break;
+            case 't': /* transport: ring (default), mq or unix */
+                if (caesar_transport_lookup(optarg, &transport) == -1)
+                    usage_error(argv[0], CLIENT);
+                break;
+            case 'x': /* service instances to hash the client name over */
+                if (caesar_set_shards(optarg) == -1)
+                    usage_error(argv[0], CLIENT);
+                break;
+            case 'f': /* stream a file, or '-' for stdin */
+                stream_in = optarg;
+                break;
+            case 'o': /* write a stream's output here instead of stdout */
+                stream_out = optarg;
+                break;
+            case 'b': /* --batch FILE: one '<shift> <message>' per line */
+                batch_file = optarg;
+                break;
             default:
                 usage_error(argv[0], CLIENT);
         }
     }
 
-    if (message[0] == 0 || shift == 0 || client_q_name[0] == '\0')
+    if (client_q_name[0] == '\0')
+        usage_error(argv[0], CLIENT);
+    if (stream_in != NULL ? shift == 0 :
+        batch_file == NULL && (message == NULL || message[0] == 0 || shift == 0))
         usage_error(argv[0], CLIENT);
 
     if (priority == -1) // no priority argument given to program
         priority = 0; // default priority of 0
 
-    service_register(client_q_name, priority);
-    service_rotate(client_q_name, message, shift);
-    service_deregister(client_q_name);
+    if (stream_in != NULL) {
+        /* Open both ends first, so a bad path does not leave a session behind */
+        in_fd = strcmp(stream_in, "-") ? open(stream_in, O_RDONLY) : STDIN_FILENO;
+        if (in_fd == -1)
+            error_exit("open (%s)", stream_in);
+        out_fd = stream_out ? open(stream_out, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+        if (out_fd == -1)
+            error_exit("open (%s)", stream_out);
+
+        session = open_session(client_q_name, priority, transport);
+        if (session == NULL)
+            return EXIT_FAILURE;
+        status = run_stream(session, in_fd, out_fd, shift);
+        caesar_session_close(session);
+        if (out_fd != STDOUT_FILENO && close(out_fd) == -1)
+            error_exit("close (%s)", stream_out);
+        return status;
+    }
+
+    if (batch_file != NULL) {
+        batch_in = strcmp(batch_file, "-") ? fopen(batch_file, "r") : stdin;
+        if (batch_in == NULL)
+            error_exit("fopen (%s)", batch_file);
+
+        session = open_session(client_q_name, priority, transport);
+        if (session == NULL)
+            return EXIT_FAILURE;
+        status = run_batch(session, batch_in);
+        caesar_session_close(session);
+        if (batch_in != stdin)
+            fclose(batch_in);
+        return status;
+    }
+
+    session = open_session(client_q_name, priority, transport);
+    if (session == NULL)
+        return EXIT_FAILURE;
+    if (caesar_rotate(session, message, shift) == 0) {
+        printf("%s\n", message);
+    } else {
+        fprintf(stderr, "Service did not process the request: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+    caesar_session_close(session);
 
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -0,0 +1,364 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdio.h> /* Needed for snprintf */
+#include <stdlib.h> /* Needed for calloc */
+#include <string.h> /* Needed for strcmp */
+#include <stdint.h> /* Fixed-width hash */
+#include <fcntl.h>  /* Defines file descriptor constants: O_ */
+#include <errno.h>
+#include <poll.h> /* An exited client's pidfd is readable */
+#include <signal.h> /* kill(pid, 0) without pidfds */
+#include <unistd.h> /* close */
+#include <sys/syscall.h> /* SYS_pidfd_open */
+
+#include "errors.h"
+#include "clients.h"
+
+/**
+* hash_name() - FNV-1a hash of a queue base name
+* @name: NUL-terminated name
+*
+*/
+static uint32_t hash_name(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    while (*name != '\0') {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+* find_locked() - look a client up by name; the table lock must be held
+* @table: the client table
+* @name: queue base name
+*
+* Return: pointer to the chain link pointing at the client, or at the NULL
+*         ending the chain if there is none
+*/
+static struct client **find_locked(struct client_table *table, const char *name)
+{
+    struct client **link = &table->buckets[hash_name(name) & (table->nbuckets - 1)];
+
+    while (*link != NULL && strcmp((*link)->name, name) != 0)
+        link = &(*link)->next;
+    return link;
+}
+
+/**
+* evict_locked() - unlink a client, close its queues and return it to the pools
+* @table: the client table, locked
+* @link: the chain link pointing at the client
+*
+*/
+static void evict_locked(struct client_table *table, struct client **link)
+{
+    struct client *c = *link;
+
+    *link = c->next;
+    if (c->slot >= 0 && table->by_slot[c->slot] == c)
+        table->by_slot[c->slot] = NULL;
+
+    mq_close(c->mqd_receive);
+    if (c->mqd_send != (mqd_t) -1)
+        mq_close(c->mqd_send);
+    if (c->pidfd != -1)
+        close(c->pidfd);
+
+    obj_pool_put(table->buffers, c->buffer);
+    obj_pool_put(table->entries, c);
+}
+
+/**
+* client_table_create() - create an empty client table
+* @nslots: number of request slots in the shared memory segment
+* @msgsize: receive buffer size, the mq_msgsize clients create their queues with
+*
+* Return: the new table; failures are fatal
+*/
+struct client_table *client_table_create(unsigned int nslots, long msgsize)
+{
+    struct client_table *table;
+
+    table = calloc(1, sizeof(*table));
+    if (table == NULL)
+        error_exit("calloc (client_table)");
+
+    /* Every client holds a slot for most of its life, so aim for a load of 1/2 */
+    for (table->nbuckets = 16; table->nbuckets < 2 * nslots; table->nbuckets *= 2)
+        ;
+    table->buckets = calloc(table->nbuckets, sizeof(*table->buckets));
+    table->by_slot = calloc(nslots, sizeof(*table->by_slot));
+    if (table->buckets == NULL || table->by_slot == NULL)
+        error_exit("calloc (client_table buckets)");
+    table->nslots = nslots;
+    table->msgsize = msgsize;
+    table->entries = obj_pool_create(sizeof(struct client), nslots);
+    table->buffers = obj_pool_create(msgsize, nslots);
+    if (table->entries == NULL || table->buffers == NULL)
+        error_exit("obj_pool_create (client_table)");
+    pthread_mutex_init(&table->lock, NULL);
+    return table;
+}
+
+/**
+* client_register() - open a newly registered client's queues
+* @table: the client table
+* @name: queue base name from the registration
+* @ring: nonzero for a ring transport client
+* @pid: the client process, from the registration
+*
+* Opens /mq_received_by_<name>, and for message queue clients also
+* /mq_sent_from_<name> with a pooled buffer, then adds the client to the
+* table.  A send queue with a larger mq_msgsize than the table's buffers
+* is refused.  Both queues are non-blocking, so a slow or dead client
+* cannot stall the event loop or the ring thread.  A stale ring client of the same name, which never
+* deregistered, is evicted first.  A pidfd for the client is kept, so
+* client_reap() can tell it has exited even once its pid is reused.
+*
+* Return: the client, or NULL if a queue cannot be opened or a message
+*         queue client of that name is still being served
+*/
+struct client *client_register(struct client_table *table, const char *name, int ring, pid_t pid)
+{
+    char qname[BUFSIZE + 32];
+    struct mq_attr attr;
+    struct client *c, **link;
+
+    c = obj_pool_get(table->entries);
+    if (c == NULL)
+        return NULL;
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->slot = -1;
+    c->owner = 0;
+    c->ring = ring;
+    c->mqd_send = (mqd_t) -1;
+    c->pid = pid;
+    c->pidfd = -1;
+    atomic_init(&c->busy, 0);
+#ifdef SYS_pidfd_open
+    if (pid > 0)
+        c->pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+#endif
+
+    snprintf(qname, sizeof(qname), "/mq_received_by_%s", name);
+    c->mqd_receive = mq_open(qname, O_RDWR | O_NONBLOCK);
+    if (c->mqd_receive == (mqd_t) -1)
+        goto fail;
+
+    if (!ring) {
+        snprintf(qname, sizeof(qname), "/mq_sent_from_%s", name);
+        c->mqd_send = mq_open(qname, O_RDWR | O_NONBLOCK);
+        if (c->mqd_send == (mqd_t) -1 || mq_getattr(c->mqd_send, &attr) == -1 ||
+            attr.mq_msgsize > table->msgsize)
+            goto fail_close;
+        c->buffer = obj_pool_get(table->buffers);
+        if (c->buffer == NULL)
+            goto fail_close;
+        c->msgsize = attr.mq_msgsize;
+    }
+
+    pthread_mutex_lock(&table->lock);
+    link = find_locked(table, name);
+    if (*link != NULL) {
+        if (!(*link)->ring) {
+            pthread_mutex_unlock(&table->lock);
+            goto fail_close;
+        }
+        evict_locked(table, link);
+        link = find_locked(table, name);
+    }
+    c->next = NULL;
+    *link = c;
+    pthread_mutex_unlock(&table->lock);
+    return c;
+
+fail_close:
+    if (c->mqd_send != (mqd_t) -1)
+        mq_close(c->mqd_send);
+    mq_close(c->mqd_receive);
+fail:
+    if (c->pidfd != -1)
+        close(c->pidfd);
+    obj_pool_put(table->buffers, c->buffer);
+    obj_pool_put(table->entries, c);
+    return NULL;
+}
+
+/**
+* client_set_slot() - record the request slot a client was given
+* @table: the client table
+* @c: the client, from client_register()
+* @slot: its request slot
+* @owner: the owner tag the slot was handed out with
+*
+* Ring clients are indexed by slot for client_notify().  A stale ring
+* client still indexed under the slot is evicted.
+*
+*/
+void client_set_slot(struct client_table *table, struct client *c, int slot, uint64_t owner)
+{
+    struct client *old;
+
+    c->slot = slot;
+    c->owner = owner;
+    if (!c->ring)
+        return;
+
+    pthread_mutex_lock(&table->lock);
+    old = table->by_slot[slot];
+    if (old != NULL && old != c)
+        evict_locked(table, find_locked(table, old->name));
+    table->by_slot[slot] = c;
+    pthread_mutex_unlock(&table->lock);
+}
+
+/**
+* client_notify() - signal a completion on a ring client's receive queue
+* @table: the client table
+* @slot: the slot the completion was posted for
+*
+* A full queue already makes the client's descriptor readable, so a
+* failed send is ignored.
+*
+*/
+void client_notify(struct client_table *table, unsigned int slot)
+{
+    struct client *c;
+
+    if (slot >= table->nslots)
+        return;
+    pthread_mutex_lock(&table->lock);
+    c = table->by_slot[slot];
+    if (c != NULL)
+        mq_send(c->mqd_receive, "cq", strlen("cq"), 0);
+    pthread_mutex_unlock(&table->lock);
+}
+
+/**
+* client_release() - evict a message queue client at the end of its session
+* @table: the client table
+* @c: the client, from client_register()
+*
+*/
+void client_release(struct client_table *table, struct client *c)
+{
+    struct client **link;
+
+    pthread_mutex_lock(&table->lock);
+    link = find_locked(table, c->name);
+    if (*link == c)
+        evict_locked(table, link);
+    pthread_mutex_unlock(&table->lock);
+}
+
+/**
+* client_evict() - evict a ring client that deregistered
+* @table: the client table
+* @name: queue base name from the deregistration
+*
+* Message queue clients deregister with 'bye' on their send queue, and
+* the event loop releases them itself, so they are left alone here.
+*
+* Return: 0 if a client was evicted, -1 if there was none
+*/
+int client_evict(struct client_table *table, const char *name)
+{
+    struct client **link;
+    int ret = -1;
+
+    pthread_mutex_lock(&table->lock);
+    link = find_locked(table, name);
+    if (*link != NULL && (*link)->ring) {
+        evict_locked(table, link);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return ret;
+}
+
+/**
+* client_alive() - whether a client process is still running
+* @pid: its pid, 0 if unknown
+* @pidfd: its pidfd, or -1
+*
+* A pidfd is readable once the process has exited.  Without one the pid
+* is probed with kill(), which a reused pid can fool.
+*
+* Return: 0 if the process has exited, 1 if it is running or unknown
+*/
+int client_alive(pid_t pid, int pidfd)
+{
+    struct pollfd pfd;
+
+    if (pidfd != -1) {
+        pfd.fd = pidfd;
+        pfd.events = POLLIN;
+        return poll(&pfd, 1, 0) != 1;
+    }
+    return pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/**
+* client_unlink() - remove the queues of a client that cannot
+* @name: queue base name from the registration
+*
+*/
+void client_unlink(const char *name)
+{
+    char qname[BUFSIZE + 32];
+
+    snprintf(qname, sizeof(qname), "/mq_received_by_%s", name);
+    mq_unlink(qname);
+    snprintf(qname, sizeof(qname), "/mq_sent_from_%s", name);
+    mq_unlink(qname);
+}
+
+/**
+* client_reap() - evict clients whose process has exited
+* @table: the client table
+* @reaped: receives the slot of each client evicted
+* @max: size of reaped
+*
+* A client that died between registering and deregistering leaves its
+* queues behind, so they are unlinked here as the client would have.
+* Message queue clients with a request being served are left for the
+* next call, since the serving thread still uses their queues.
+*
+* Return: number of clients evicted
+*/
+unsigned int client_reap(struct client_table *table, struct reaped_client reaped[], unsigned int max)
+{
+    struct client **link;
+    unsigned int b, n = 0;
+
+    pthread_mutex_lock(&table->lock);
+    for (b = 0; b < table->nbuckets && n < max; b++) {
+        link = &table->buckets[b];
+        while (*link != NULL && n < max) {
+            if (atomic_load_explicit(&(*link)->busy, memory_order_acquire) ||
+                client_alive((*link)->pid, (*link)->pidfd)) {
+                link = &(*link)->next;
+                continue;
+            }
+            client_unlink((*link)->name);
+            reaped[n].slot = (*link)->slot;
+            reaped[n].owner = (*link)->owner;
+            reaped[n].ring = (*link)->ring;
+            reaped[n].pid = (*link)->pid;
+            n++;
+            evict_locked(table, link);
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+    return n;
+}
@@ -0,0 +1,87 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef CLIENTS_H
+#define CLIENTS_H
+
+#include <mqueue.h>   /* Cached client queue descriptors */
+#include <pthread.h> /* Table lock */
+#include <stdatomic.h> /* A client's busy flag is read by the reaper */
+#include <sys/types.h> /* pid_t */
+
+#include "caesar_ipc.h" /* BUFSIZE */
+#include "objpool.h" /* Client entries and receive buffers */
+
+/*
+* A registered client, from registration to deregistration.  Its queues
+* are opened once; the entry and its receive buffer come from the table's
+* pools and go back to them when the client is evicted.  'pidfd' turns
+* readable when the client process exits.
+*/
+struct client {
+  char name[BUFSIZE];        /* queue base name, the table key */
+  mqd_t mqd_receive;         /* /mq_received_by_<name> */
+  mqd_t mqd_send;            /* /mq_sent_from_<name>, (mqd_t) -1 for ring clients */
+  char *buffer;              /* the table's msgsize bytes, for the send queue */
+  long msgsize;
+  unsigned int prio;         /* priority of the instruction being answered */
+  int slot;                  /* request slot, -1 until one is claimed */
+  uint64_t owner;            /* the slot's owner tag while we hold it */
+  int ring;                  /* submits on the shared memory rings */
+  pid_t pid;                 /* client process, from the registration */
+  int pidfd;                 /* -1 where pidfd_open() is unavailable */
+  atomic_int busy;           /* a message queue request is being served */
+  struct client *next;       /* hash chain */
+};
+
+/* A client client_reap() found dead, after its queues were unlinked */
+struct reaped_client {
+  int slot;
+  uint64_t owner;
+  int ring;
+  pid_t pid;
+};
+
+/*
+* Hash table of registered clients keyed by queue base name, plus an index
+* by request slot for the ring thread's completion notifications.  One
+* mutex guards the table; a client's queues and buffer are only used by
+* the thread serving its current instruction, outside the lock.  The pools
+* start with one entry per slot, so registering needs no allocation.
+*/
+struct client_table {
+  pthread_mutex_t lock;
+  unsigned int nbuckets;     /* power of two */
+  struct client **buckets;
+  struct client **by_slot;
+  unsigned int nslots;
+  long msgsize;              /* largest mq_msgsize a client's send queue may have */
+  struct obj_pool *entries;
+  struct obj_pool *buffers;
+};
+
+struct client_table *client_table_create(unsigned int nslots, long msgsize);
+
+struct client *client_register(struct client_table *table, const char *name, int ring, pid_t pid);
+
+void client_set_slot(struct client_table *table, struct client *c, int slot, uint64_t owner);
+
+void client_notify(struct client_table *table, unsigned int slot);
+
+void client_release(struct client_table *table, struct client *c);
+
+int client_evict(struct client_table *table, const char *name);
+
+int client_alive(pid_t pid, int pidfd);
+
+void client_unlink(const char *name);
+
+unsigned int client_reap(struct client_table *table, struct reaped_client reaped[], unsigned int max);
+
+#endif
@@ -0,0 +1,298 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#define _GNU_SOURCE /* F_GET_SEALS and accept4 */
+#include <string.h> /* Needed for strerror */
+#include <unistd.h> /* Needed for close */
+#include <errno.h>
+#include <stdatomic.h> /* Open connection count */
+#include <fcntl.h> /* F_GET_SEALS */
+#include <pthread.h> /* Connection thread */
+#include <sys/socket.h>
+#include <sys/stat.h> /* fstat */
+#include <sys/mman.h> /* mmap */
+#include <sys/epoll.h> /* Connection event loop */
+#include <sys/eventfd.h> /* Waking the connection thread to stop listening */
+
+#include "errors.h"
+#include "log.h"
+#include "objpool.h" /* Connection entries */
+#include "usock.h"
+#include "conns.h"
+
+/* Events handled per epoll_wait() */
+#define CONN_EVENTS 64
+
+/* Connection entries allocated up front, and per slab after that */
+#define CONN_POOL_SIZE 64
+
+static int listen_fd = -1;
+static int conn_epoll_fd = -1;
+static conn_serve_fn serve_fn;
+static struct obj_pool *conn_pool;
+static atomic_uint nconns;
+
+/* conns_stop() asks the connection thread to close the listening socket */
+static int stop_fd = -1;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stopped = PTHREAD_COND_INITIALIZER;
+
+/**
+* conn_close() - drop a connection and everything it shared
+* @c: the connection
+*
+*/
+static void conn_close(struct conn *c)
+{
+    unsigned int i;
+
+    for (i = 0; i < SOCK_REGIONS; i++) {
+        if (c->regions[i].base != NULL)
+            munmap(c->regions[i].base, c->regions[i].size);
+    }
+    close(c->fd);  /* also removes it from the epoll set */
+    obj_pool_put(conn_pool, c);
+    atomic_fetch_sub_explicit(&nconns, 1, memory_order_relaxed);
+}
+
+/**
+* stop_listening() - close the listening socket, on the connection thread
+*
+* Connections already accepted are served until their clients hang up.
+*
+*/
+static void stop_listening(void)
+{
+    pthread_mutex_lock(&stop_lock);
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    pthread_cond_broadcast(&stopped);
+    pthread_mutex_unlock(&stop_lock);
+}
+
+/**
+* install_region() - map a memfd a client passed with a request
+* @c: the connection
+* @region: the region index the request names
+* @fd: the descriptor; closed here, the mapping keeps the memory
+*
+* Return: 0 on success, -1 if the memfd is not sealed against shrinking
+*         or cannot be mapped
+*/
+static int install_region(struct conn *c, unsigned int region, int fd)
+{
+    struct conn_region *r = &c->regions[region];
+    struct stat sb;
+    char *base;
+    int seals;
+
+    seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1 || !(seals & F_SEAL_SHRINK) || fstat(fd, &sb) == -1 || sb.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    base = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    if (r->base != NULL)
+        munmap(r->base, r->size);
+    r->base = base;
+    r->size = sb.st_size;
+    return 0;
+}
+
+/**
+* conn_request() - serve one request from a readable connection
+* @c: the connection
+*
+* The buffer header is read once and checked against the mapping, so the
+* rotation stays inside the region whatever the client writes meanwhile.
+*
+* Return: 0 to keep the connection, -1 to close it
+*/
+static int conn_request(struct conn *c)
+{
+    struct sock_request req;
+    struct sock_reply reply;
+    struct conn_region *r;
+    struct arena_buf *buf;
+    uint64_t len;
+    ssize_t n;
+    int fd;
+
+    n = usock_recv(c->fd, &req, sizeof(req), &fd, MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+    if (n <= 0)
+        return -1;
+
+    reply.tag = req.tag;
+    reply.status = -1;
+    reply.pad = 0;
+    if (n != (ssize_t) sizeof(req) || req.region >= SOCK_REGIONS) {
+        if (fd != -1)
+            close(fd);
+    } else if (fd != -1 && install_region(c, req.region, fd) == -1) {
+        log_warn("conns: refusing an unsealed or unmappable memfd");
+    } else {
+        r = &c->regions[req.region];
+        if (r->base != NULL && req.offset % ARENA_ALIGN == 0 &&
+            req.offset <= r->size && r->size - req.offset >= sizeof(*buf)) {
+            buf = (struct arena_buf *) (void *) (r->base + req.offset);
+            len = buf->len;
+            if (len <= r->size - req.offset - sizeof(*buf))
+                reply.status = serve_fn(buf->data, len, req.kind, req.shift);
+        }
+    }
+
+    /* A client that stops reading its replies is dropped */
+    if (send(c->fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) sizeof(reply))
+        return -1;
+    return 0;
+}
+
+/**
+* conns_main() - body of the connection thread
+* @arg: unused
+*
+* Accepts clients and serves one request per readable connection in turn,
+* so a client streaming many requests does not starve the others.
+*
+*/
+static void *conns_main(void *arg)
+{
+    struct epoll_event ev, events[CONN_EVENTS];
+    struct conn *c;
+    int nready, e, fd;
+
+    (void) arg;
+    for (;;) {
+        nready = epoll_wait(conn_epoll_fd, events, CONN_EVENTS, -1);
+        if (nready == -1) {
+            if (errno == EINTR)
+                continue;
+            error_exit("epoll_wait (connections)");
+        }
+        for (e = 0; e < nready; e++) {
+            if (events[e].data.ptr == &stop_fd) {
+                epoll_ctl(conn_epoll_fd, EPOLL_CTL_DEL, stop_fd, NULL);
+                stop_listening();
+                continue;
+            }
+            c = events[e].data.ptr;
+            if (c != NULL) {
+                if ((events[e].events & (EPOLLERR | EPOLLHUP)) && !(events[e].events & EPOLLIN))
+                    conn_close(c);
+                else if (conn_request(c) == -1)
+                    conn_close(c);
+                continue;
+            }
+
+            /* The listening socket */
+            while (listen_fd != -1 && (fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                atomic_fetch_add_explicit(&nconns, 1, memory_order_relaxed);
+                c = obj_pool_get(conn_pool);
+                if (c == NULL) {
+                    log_warn("conns: no memory for a connection");
+                    close(fd);
+                    atomic_fetch_sub_explicit(&nconns, 1, memory_order_relaxed);
+                    continue;
+                }
+                c->fd = fd;
+                ev.events = EPOLLIN;
+                ev.data.ptr = c;
+                if (epoll_ctl(conn_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+                    log_warn("conns: epoll_ctl: %s", strerror(errno));
+                    conn_close(c);
+                }
+            }
+            if (listen_fd != -1 && errno != EAGAIN && errno != EINTR)
+                log_warn("conns: accept4: %s", strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+/**
+* conns_start() - listen on the Unix socket transport
+* @serve: rotates each request's payload
+* @name: the socket's name, from struct ipc_names
+*
+* Starts a thread with its own event loop, which serves requests in place
+* in the clients' memfds, as the ring thread serves the payload arena.
+*
+* Return: 0 on success, -1 if the socket name is already taken
+*/
+int conns_start(conn_serve_fn serve, const char *name)
+{
+    struct epoll_event ev;
+    pthread_t thread;
+
+    serve_fn = serve;
+    conn_pool = obj_pool_create(sizeof(struct conn), CONN_POOL_SIZE);
+    if (conn_pool == NULL)
+        error_exit("obj_pool_create (connections)");
+
+    if ((listen_fd = usock_listen(name)) == -1) {
+        if (errno == EADDRINUSE)
+            return -1;
+        error_exit("listen (@%s)", name);
+    }
+
+    if ((conn_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+        error_exit("epoll_create1 (connections)");
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(conn_epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1)
+        error_exit("epoll_ctl (listening socket)");
+    if ((stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        error_exit("eventfd (connections)");
+    ev.data.ptr = &stop_fd;
+    if (epoll_ctl(conn_epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev) == -1)
+        error_exit("epoll_ctl (stop eventfd)");
+
+    if (pthread_create(&thread, NULL, conns_main, NULL) != 0)
+        error_exit("pthread_create (conns_main)");
+    pthread_detach(thread);
+    return 0;
+}
+
+/**
+* conns_stop() - stop accepting connections
+*
+* Waits until the socket is closed, so its name is free for another
+* service once this returns.  Does nothing if conns_start() failed.
+*
+*/
+void conns_stop(void)
+{
+    uint64_t one = 1;
+
+    if (stop_fd == -1)
+        return;
+    if (write(stop_fd, &one, sizeof(one)) != (ssize_t) sizeof(one))
+        error_exit("write (stop eventfd)");
+    pthread_mutex_lock(&stop_lock);
+    while (listen_fd != -1)
+        pthread_cond_wait(&stopped, &stop_lock);
+    pthread_mutex_unlock(&stop_lock);
+}
+
+/**
+* conns_active() - connections still open
+*
+*/
+unsigned int conns_active(void)
+{
+    return atomic_load_explicit(&nconns, memory_order_relaxed);
+}
@@ -0,0 +1,41 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef CONNS_H
+#define CONNS_H
+
+#include <stddef.h> /* Needed for size_t */
+
+#include "caesar_ipc.h" /* SOCK_REGIONS */
+
+/* Rotates len bytes at data as a REQ_MESSAGE or REQ_BATCH request; 0 on success */
+typedef int (*conn_serve_fn)(char *data, size_t len, unsigned int kind, int shift);
+
+/* A memfd a connection has shared, mapped into the service */
+struct conn_region {
+  char *base;
+  size_t size;
+};
+
+/*
+* A client connected on the Unix socket transport.  Everything it can
+* reach lives here, so connections are isolated from each other.
+*/
+struct conn {
+  int fd;
+  struct conn_region regions[SOCK_REGIONS];
+};
+
+int conns_start(conn_serve_fn serve, const char *name);
+
+void conns_stop(void);
+
+unsigned int conns_active(void);
+
+#endif
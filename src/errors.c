@@ -81,7 +81,7 @@ error_exit(const char *format, ...)
   terminate(TRUE);
 }
 
-/* program_type is SERVICE or CLIENT */
+/* program_type is SERVICE, CLIENT, BENCH or STATS */
 void
 usage_error(const char *program_name, const int program_type)
 {
@@ -91,24 +91,77 @@ usage_error(const char *program_name, const int program_type)
     switch (program_type) {
         case SERVICE:
             fprintf(stderr, "Caesar Service v0.1\n");
-            fprintf(stderr, "Usage: ./%s [-h] [-d] \n", program_name);
+            fprintf(stderr, "Usage: ./%s [-h] [-d] [-l stderr|syslog|file] [-n slots] [-w workers] [-a arena_mb] [-W weights] [-Q waiting] [-I inflight] [-p] [-H] [-N node] [-C entries] [-x namespace] [-T seconds] [-R] [-k seconds]\n", program_name);
             fprintf(stderr, "     -h    Prints this usage information\n");
             fprintf(stderr, "     -d    Start service in daemon mode\n");
+            fprintf(stderr, "     -l    Log to 'stderr', 'syslog' or append to a file (default: stderr, syslog with -d)\n");
+            fprintf(stderr, "     -n    Number of request slots in shared memory (default 64)\n");
+            fprintf(stderr, "     -w    Number of worker threads rotating large messages (default: core count)\n");
+            fprintf(stderr, "     -a    Size of the shared payload arena for large messages in MiB (default 64)\n");
+            fprintf(stderr, "     -W    Scheduler weights of priorities 0,1,...,10; the last one given repeats (default 1,2,...,11)\n");
+            fprintf(stderr, "     -Q    Registrations allowed to wait for a slot before new ones are told busy (default: slots)\n");
+            fprintf(stderr, "     -I    Ring requests in flight before new registrations are told busy (default 1024)\n");
+            fprintf(stderr, "     -p    Fault in and lock the shared memory segment at startup\n");
+            fprintf(stderr, "     -H    Back the payload arena with transparent huge pages\n");
+            fprintf(stderr, "     -N    Allocate the segment on a NUMA node and run on its CPUs (default workers: its core count)\n");
+            fprintf(stderr, "     -C    Cache the results of this many short messages (default 0, no cache)\n");
+            fprintf(stderr, "     -x    Namespace of this instance's IPC objects, so several can run (default: $CAESAR_NAMESPACE or none)\n");
+            fprintf(stderr, "     -T    Seconds to wait for clients to leave after SIGTERM before exiting anyway (default 30)\n");
+            fprintf(stderr, "     -R    Take over from the service running in the namespace, which drains its clients and exits\n");
+            fprintf(stderr, "     -k    Seconds a dead ring client's slot waits for its queued requests before it is reused (default 10)\n");
             fprintf(stderr, "     --version Prints the program version.\n");
             fprintf(stderr, "     --help Prints this usage information (same as -h).\n");
             break;
         case CLIENT:
             fprintf(stderr, "Caesar Client v0.1\n");
-            fprintf(stderr, "Usage: ./%s [-h] [-m message] [-s shift] [-q name]\n", program_name);
+            fprintf(stderr, "Usage: ./%s [-h] [-m message] [-s shift] [-q name] [-p priority] [-t ring|mq|unix] [-x ns,...] [--batch file] [-f file [-o file]]\n", program_name);
             fprintf(stderr, "     -h    Prints this usage information\n");
             fprintf(stderr, "     -m    the message (plaintext or encoded)\n");
             fprintf(stderr, "     -s    Amount to shift (positive or negative)\n");
             fprintf(stderr, "     -q    the base name of the client queue\n");
+            fprintf(stderr, "     -p    registration priority (0-10)\n");
+            fprintf(stderr, "     -t    transport: 'ring' shared memory rings (default), 'mq' message queues or 'unix' socket (also --transport)\n");
+            fprintf(stderr, "     -x    service instances to pick from by hashing the client name, as namespaces (also --shards; default: $CAESAR_SHARDS)\n");
+            fprintf(stderr, "     --batch file  rotate every '<shift> <message>' line of file ('-' for stdin) in batched requests\n");
+            fprintf(stderr, "     -f    stream a file ('-' for stdin) through the service in 1 MiB chunks, with -s and -q\n");
+            fprintf(stderr, "     -o    write the -f stream's output to a file instead of stdout\n");
             fprintf(stderr, "     --version Prints the program version.\n");
             fprintf(stderr, "     --help Prints this usage information (same as -h).\n");
-            fprintf(stderr, "NOTE: message, shift, and queue arguments must be used together!\n");
+            fprintf(stderr, "NOTE: message, shift, and queue arguments must be used together (or --batch and queue, or -f, shift and queue)!\n");
             fprintf(stderr, "NOTE: -q arguments cannot be longer than 239 characters!!  This is because the max size of a message queue name is 255 and we will append a send/receive identifer to it.\n");
             break;
+        case BENCH:
+            fprintf(stderr, "Caesar Bench v0.1\n");
+            fprintf(stderr, "Usage: ./%s [-h] [-c clients] [-n requests] [-S size] [-s shift|uniform] [-p prio,...] [-r rate] [-d depth] [-D usec] [-P sessions] [-t ring|mq|unix|all] [-q prefix] [-x ns,...] [-j]\n", program_name);
+            fprintf(stderr, "     -h    Prints this usage information\n");
+            fprintf(stderr, "     -c    Number of concurrent clients, one thread each (default 4)\n");
+            fprintf(stderr, "     -n    Requests per client (default 10000)\n");
+            fprintf(stderr, "     -S    Message size in bytes (default 64)\n");
+            fprintf(stderr, "     -s    Shift for every request, or 'uniform' for random shifts in -25..25 (default 3)\n");
+            fprintf(stderr, "     -p    Comma-separated registration priorities, assigned to clients round robin (default 0)\n");
+            fprintf(stderr, "     -r    Requests per second per client; 0 sends as fast as possible (default 0)\n");
+            fprintf(stderr, "     -d    Requests in flight per client, using the asynchronous API when above 1 (default 1)\n");
+            fprintf(stderr, "     -D    Deadline of each ring request in microseconds; 0 for none (default 0)\n");
+            fprintf(stderr, "     -P    Client threads share this many sessions, 1 to 16, instead of one each (also --pool; needs -d 1)\n");
+            fprintf(stderr, "     -t    transport: 'ring' shared memory rings (default), 'mq' message queues or 'unix' socket,\n");
+            fprintf(stderr, "           or 'all' to run the workload over each in turn and compare them (also --transport)\n");
+            fprintf(stderr, "     -q    Prefix of the client queue names (default 'bench')\n");
+            fprintf(stderr, "     -x    service instances to spread the clients over by name, as namespaces (also --shards; default: $CAESAR_SHARDS)\n");
+            fprintf(stderr, "     -j    Print the results as JSON\n");
+            fprintf(stderr, "     --version Prints the program version.\n");
+            fprintf(stderr, "NOTE: the service must be running; the client library logs to stderr.\n");
+            break;
+        case STATS:
+            fprintf(stderr, "Caesar Stats v0.1\n");
+            fprintf(stderr, "Usage: ./%s [-h] [-i seconds] [-n count] [-x namespace]\n", program_name);
+            fprintf(stderr, "     -h    Prints this usage information\n");
+            fprintf(stderr, "     -i    Seconds between refreshes (default 1)\n");
+            fprintf(stderr, "     -n    Number of refreshes before exiting (default 0, no limit)\n");
+            fprintf(stderr, "     -x    Namespace of the service instance to watch (default: $CAESAR_NAMESPACE or none)\n");
+            fprintf(stderr, "     --version Prints the program version.\n");
+            fprintf(stderr, "     --help Prints this usage information (same as -h).\n");
+            fprintf(stderr, "NOTE: rates and latencies cover the last interval; totals cover the life of the service.\n");
+            break;
         default:
             fprintf(stderr, "CLI usage error.  Try ./%s --help\n", program_name);
     }
@@ -15,6 +15,8 @@
 
 #define SERVICE 1
 #define CLIENT 0
+#define BENCH 2
+#define STATS 3
 
 #ifdef __GNUC__
 
@@ -27,8 +29,8 @@
 #define NORETURN
 #endif
 
-void error_exit(const char *format, ...);
-/* program_type is SERVICE or CLIENT */
+void error_exit(const char *format, ...) NORETURN;
+/* program_type is SERVICE, CLIENT, BENCH or STATS */
 void usage_error(const char *program_name, const int program_type);
 
 #endif
@@ -0,0 +1,87 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdio.h> /* Needed for snprintf */
+#include <stdlib.h> /* Needed for getenv */
+#include <string.h> /* Needed for strlen */
+#include <ctype.h> /* Needed for isalnum */
+
+#include "caesar_ipc.h" /* SHM_NAME, REG_MQ_NAME, SOCK_NAME */
+#include "stats.h" /* STATS_SHM_NAME */
+#include "ipcns.h"
+
+/**
+* ipc_ns_valid() - check a namespace
+* @ns: the namespace
+*
+* Namespaces become part of POSIX IPC names, so only letters, digits, '_'
+* and '-' are allowed.  The empty namespace is the default instance.
+*
+* Return: 1 if ns can be used, 0 if not
+*/
+int ipc_ns_valid(const char *ns)
+{
+    size_t i, len = strlen(ns);
+
+    if (len >= IPC_NS_MAX)
+        return 0;
+    for (i = 0; i < len; i++) {
+        if (!isalnum((unsigned char) ns[i]) && ns[i] != '_' && ns[i] != '-')
+            return 0;
+    }
+    return 1;
+}
+
+/**
+* ipc_ns_default() - the namespace to use when none is given
+*
+* Return: $CAESAR_NAMESPACE, or "" for the default instance
+*/
+const char *ipc_ns_default(void)
+{
+    const char *ns = getenv(IPC_NS_ENV);
+
+    return ns != NULL ? ns : "";
+}
+
+/**
+* ipc_name() - one object's name in a namespace
+* @name: receives it, IPC_NAME_MAX bytes
+* @ns: a valid namespace
+* @base: the object's default name, with or without a leading '/'
+*
+*/
+static void ipc_name(char *name, const char *ns, const char *base)
+{
+    int slash = base[0] == '/';
+
+    if (ns[0] == '\0')
+        snprintf(name, IPC_NAME_MAX, "%s", base);
+    else
+        snprintf(name, IPC_NAME_MAX, "%s%s.%s", slash ? "/" : "", ns, base + slash);
+}
+
+/**
+* ipc_names_init() - name a service instance's IPC objects
+* @names: filled in
+* @ns: the instance's namespace, "" for the default one
+*
+* Return: 0 on success, -1 if ns is not a valid namespace
+*/
+int ipc_names_init(struct ipc_names *names, const char *ns)
+{
+    if (!ipc_ns_valid(ns))
+        return -1;
+    snprintf(names->ns, sizeof(names->ns), "%s", ns);
+    ipc_name(names->shm, ns, SHM_NAME);
+    ipc_name(names->reg_mq, ns, REG_MQ_NAME);
+    ipc_name(names->stats, ns, STATS_SHM_NAME);
+    ipc_name(names->sock, ns, SOCK_NAME);
+    return 0;
+}
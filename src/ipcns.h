@@ -0,0 +1,45 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef IPCNS_H
+#define IPCNS_H
+
+/* Environment variable naming the instance when no -x is given */
+#define IPC_NS_ENV "CAESAR_NAMESPACE"
+
+/* Longest namespace, its NUL included */
+#define IPC_NS_MAX 32
+
+/* Room for any IPC object name in a namespace */
+#define IPC_NAME_MAX (IPC_NS_MAX + 32)
+
+/*
+* Names of one service instance's IPC objects.  In the default namespace
+* ("") they are the plain names from caesar_ipc.h and stats.h; in
+* namespace "s1" they become "/s1.shm_caesar", "/s1.mq_registration" and
+* so on, and the socket "@s1.caesar_service".  Instances in different
+* namespaces share nothing, so any number can run on one host.  Client
+* queues are named after the client alone, which a client's name must
+* keep unique across the host.
+*/
+struct ipc_names {
+  char ns[IPC_NS_MAX];
+  char shm[IPC_NAME_MAX];
+  char reg_mq[IPC_NAME_MAX];
+  char stats[IPC_NAME_MAX];
+  char sock[IPC_NAME_MAX];   /* in the abstract namespace, without the leading NUL */
+};
+
+int ipc_ns_valid(const char *ns);
+
+const char *ipc_ns_default(void);
+
+int ipc_names_init(struct ipc_names *names, const char *ns);
+
+#endif
@@ -0,0 +1,331 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdio.h> /* Needed for vsnprintf */
+#include <stdlib.h> /* Needed for atexit */
+#include <stdarg.h> /* Variadic log_write */
+#include <string.h> /* Needed for memcpy */
+#include <stdint.h> /* Fixed-width timestamps */
+#include <stdatomic.h> /* Lock-free record ring */
+#include <time.h> /* clock_gettime, localtime_r */
+#include <unistd.h> /* Needed for write */
+#include <fcntl.h>  /* Defines file descriptor constants: O_ */
+#include <syslog.h> /* Use of logging facilities */
+#include <pthread.h> /* Drain thread */
+
+#include "log.h"
+
+/* Bytes of formatted output collected before each write(2) */
+#define LOG_OUT_SIZE 65536
+
+/*
+* A fixed-size record.  'seq' sequences the cell as in the submission ring
+* (Vyukov's bounded queue): producers claim a cell with one compare-and-swap
+* on the tail and never wait, so logging from the ring thread or a worker
+* costs a vsnprintf() into the cell, and a wakeup only when the drain
+* thread had run out of records and gone to sleep.
+*/
+struct log_record {
+  atomic_uint seq;
+  uint16_t level;
+  uint16_t len;
+  int64_t sec;
+  long nsec;
+  char text[LOG_TEXT_MAX];
+};
+
+static struct log_record ring[LOG_RING_SIZE];
+static _Alignas(64) atomic_uint ring_tail;
+static _Alignas(64) unsigned int ring_head;
+static atomic_ulong dropped;
+
+/* Serializes consumers: the drain thread, log_flush() and inline drains */
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+
+/*
+* The drain thread exists once log_open() has started it.  It sleeps on
+* 'wake' while the ring is empty, with 'idle' set so that producers know
+* to signal it; the fences around 'idle' pair like those of the shared
+* memory rings, so a record is never left behind a sleeping drainer.
+*/
+static atomic_int threaded;
+static atomic_int idle;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+static enum log_sink sink = SINK_STDERR;
+static int sink_fd = STDERR_FILENO;
+
+static const char *level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+static const int syslog_levels[] = { LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG };
+
+static size_t drain(void);
+
+/**
+* ring_empty() - tell whether there is nothing to write
+*
+*/
+static int ring_empty(void)
+{
+    int empty;
+
+    pthread_mutex_lock(&drain_lock);
+    empty = atomic_load_explicit(&ring[ring_head & (LOG_RING_SIZE - 1)].seq, memory_order_acquire) !=
+            ring_head + 1;
+    pthread_mutex_unlock(&drain_lock);
+    return empty;
+}
+
+/**
+* drain_main() - body of the drain thread
+* @arg: unused
+*
+* Writes records out as they come and sleeps while there are none, until
+* log_write() signals the next one.
+*
+*/
+static void *drain_main(void *arg)
+{
+    (void) arg;
+    for (;;) {
+        if (drain() > 0)
+            continue;
+        pthread_mutex_lock(&wake_lock);
+        atomic_store(&idle, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        while (ring_empty() && atomic_load_explicit(&dropped, memory_order_relaxed) == 0)
+            pthread_cond_wait(&wake, &wake_lock);
+        atomic_store_explicit(&idle, 0, memory_order_relaxed);
+        pthread_mutex_unlock(&wake_lock);
+    }
+    return NULL;
+}
+
+/**
+* wake_drainer() - signal the drain thread if it sleeps
+*
+* Called by a producer after publishing a record.
+*
+*/
+static void wake_drainer(void)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&idle, memory_order_relaxed) == 0)
+        return;
+    pthread_mutex_lock(&wake_lock);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+/**
+* ring_init() - set up the ring, once
+*
+* Pending records are flushed at exit, so messages logged just before
+* error_exit() or the end of main() are not lost.
+*
+*/
+static void ring_init(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < LOG_RING_SIZE; i++)
+        atomic_init(&ring[i].seq, i);
+    atomic_init(&ring_tail, 0);
+    ring_head = 0;
+    atexit(log_flush);
+}
+
+/**
+* thread_start() - start the drain thread, once
+*
+*/
+static void thread_start(void)
+{
+    pthread_t thread;
+
+    pthread_once(&ring_once, ring_init);
+    if (pthread_create(&thread, NULL, drain_main, NULL) == 0) {
+        pthread_detach(thread);
+        atomic_store(&threaded, 1);
+    }
+}
+
+/**
+* log_open() - choose where log records go
+* @s: SINK_STDERR (default), SINK_SYSLOG or SINK_FILE
+* @path: the file to append to, for SINK_FILE
+*
+* Call before the first message is logged.  This also starts the drain
+* thread; until then, as in a program using the client library that
+* never calls this, records go to stderr from the thread that logs them.
+*
+* Return: 0 on success, -1 if the file cannot be opened
+*/
+int log_open(enum log_sink s, const char *path)
+{
+    int fd = STDERR_FILENO;
+
+    if (s == SINK_FILE) {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+        if (fd == -1)
+            return -1;
+    }
+    sink = s;
+    sink_fd = fd;
+    pthread_once(&thread_once, thread_start);
+    return 0;
+}
+
+/**
+* log_write() - format a message into the next free ring record
+* @level: LVL_ERROR to LVL_DEBUG
+* @format: printf-style format, without a trailing newline
+*
+* Never blocks once log_open() has started the drain thread: when it has
+* fallen LOG_RING_SIZE records behind, the message is dropped and counted
+* instead.  Without the thread the record is written out at once.  Use the log_*()
+* macros, which compile away above LOG_LEVEL.
+*
+*/
+void log_write(int level, const char *format, ...)
+{
+    struct log_record *rec;
+    struct timespec now;
+    unsigned int pos, seq;
+    va_list ap;
+    int dif, len;
+
+    pthread_once(&ring_once, ring_init);
+
+    pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    for (;;) {
+        rec = &ring[pos & (LOG_RING_SIZE - 1)];
+        seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        dif = (int) (seq - pos);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring_tail, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            if (atomic_load_explicit(&threaded, memory_order_relaxed))
+                wake_drainer();
+            return;
+        } else {
+            pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->sec = now.tv_sec;
+    rec->nsec = now.tv_nsec;
+    rec->level = level < LVL_ERROR ? LVL_ERROR : level > LVL_DEBUG ? LVL_DEBUG : level;
+    va_start(ap, format);
+    len = vsnprintf(rec->text, sizeof(rec->text), format, ap);
+    va_end(ap);
+    rec->len = len < 0 ? 0 : len >= LOG_TEXT_MAX ? LOG_TEXT_MAX - 1 : len;
+
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+
+    if (atomic_load_explicit(&threaded, memory_order_relaxed))
+        wake_drainer();
+    else
+        drain();
+}
+
+/**
+* emit() - append one record to the output buffer, or send it to syslog
+* @out: output buffer of LOG_OUT_SIZE bytes
+* @used: bytes already in out
+* @rec: the record
+*
+* Return: the new number of bytes in out
+*/
+static size_t emit(char *out, size_t used, const struct log_record *rec)
+{
+    struct tm tm;
+    time_t sec = rec->sec;
+    ssize_t bytes;
+    int n;
+
+    if (sink == SINK_SYSLOG) {
+        syslog(syslog_levels[rec->level], "%.*s", (int) rec->len, rec->text);
+        return used;
+    }
+
+    /* A failed write has nowhere left to be reported */
+    if (used + LOG_TEXT_MAX + 64 > LOG_OUT_SIZE) {
+        bytes = write(sink_fd, out, used);
+        used = 0;
+    }
+
+    /* A file gets timestamps and levels; stderr keeps the terminal format */
+    if (sink == SINK_FILE) {
+        localtime_r(&sec, &tm);
+        n = strftime(out + used, 32, "%Y-%m-%d %H:%M:%S", &tm);
+        used += n;
+        used += snprintf(out + used, 32, ".%06ld %-5s ", rec->nsec / 1000, level_names[rec->level]);
+    }
+    memcpy(out + used, rec->text, rec->len);
+    used += rec->len;
+    out[used++] = '\n';
+    return used;
+}
+
+/**
+* drain() - write out every record published so far
+*
+* Return: number of records written
+*/
+static size_t drain(void)
+{
+    static char out[LOG_OUT_SIZE];
+    struct log_record *rec, note;
+    unsigned long lost;
+    size_t used = 0, n = 0;
+    ssize_t bytes;
+
+    pthread_mutex_lock(&drain_lock);
+    for (;;) {
+        rec = &ring[ring_head & (LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) != ring_head + 1)
+            break;
+        used = emit(out, used, rec);
+        atomic_store_explicit(&rec->seq, ring_head + LOG_RING_SIZE, memory_order_release);
+        ring_head++;
+        n++;
+    }
+
+    lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0) {
+        memset(&note, 0, sizeof(note));
+        note.sec = time(NULL);
+        note.level = LVL_WARN;
+        note.len = snprintf(note.text, sizeof(note.text), "log: %lu messages dropped", lost);
+        used = emit(out, used, &note);
+    }
+
+    if (used > 0)
+        bytes = write(sink_fd, out, used);
+    pthread_mutex_unlock(&drain_lock);
+    return n;
+}
+
+/**
+* log_flush() - write out every record logged so far, from the caller
+*
+* Registered with atexit(); call it before _exit() or abort() paths too.
+*
+*/
+void log_flush(void)
+{
+    drain();
+}
@@ -0,0 +1,60 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef LOG_H
+#define LOG_H
+
+/*
+* Levels, most severe first.  Calls above LOG_LEVEL compile to nothing,
+* arguments included; per-request messages are LVL_DEBUG so release builds
+* (the default LOG_LEVEL of LVL_INFO) carry no logging on the hot path.
+* Build with 'make LOG_LEVEL=3' to trace every request.
+*/
+#define LVL_ERROR 0
+#define LVL_WARN 1
+#define LVL_INFO 2
+#define LVL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LVL_INFO
+#endif
+
+/* Records that fit in the ring before log_write() starts dropping them */
+#define LOG_RING_SIZE 4096
+
+/* Longest message kept; longer ones are truncated */
+#define LOG_TEXT_MAX 232
+
+enum log_sink {
+  SINK_STDERR,
+  SINK_SYSLOG,   /* through the process's openlog() settings */
+  SINK_FILE
+};
+
+#ifdef __GNUC__
+#define LOG_PRINTF __attribute__ ((__format__ (__printf__, 2, 3)))
+#else
+#define LOG_PRINTF
+#endif
+
+#define log_at(level, ...) \
+  do { if ((level) <= LOG_LEVEL) log_write((level), __VA_ARGS__); } while (0)
+
+#define log_error(...) log_at(LVL_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LVL_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LVL_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LVL_DEBUG, __VA_ARGS__)
+
+int log_open(enum log_sink sink, const char *path);
+
+void log_write(int level, const char *format, ...) LOG_PRINTF;
+
+void log_flush(void);
+
+#endif
@@ -0,0 +1,105 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdlib.h> /* Needed for aligned_alloc */
+#include <string.h> /* Needed for memset */
+
+#include "objpool.h"
+
+/**
+* add_slab() - carve another slab into objects on the free list
+* @pool: the pool, locked or not yet shared
+*
+* The pool is shared with the client library, so failures are left to
+* the caller.
+*
+* Return: 0 on success, -1 with errno set to ENOMEM
+*/
+static int add_slab(struct obj_pool *pool)
+{
+    char *slab;
+    unsigned int i;
+
+    slab = aligned_alloc(OBJ_POOL_ALIGN, pool->size * pool->per_slab);
+    if (slab == NULL)
+        return -1;
+    for (i = 0; i < pool->per_slab; i++) {
+        *(void **) (void *) (slab + i * pool->size) = pool->free_list;
+        pool->free_list = slab + i * pool->size;
+    }
+    return 0;
+}
+
+/**
+* obj_pool_create() - create a pool of fixed-size objects
+* @size: bytes in each object
+* @count: objects allocated up front, and per slab if the pool grows
+*
+* Return: the new pool, or NULL with errno set to ENOMEM
+*/
+struct obj_pool *obj_pool_create(size_t size, unsigned int count)
+{
+    struct obj_pool *pool;
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+    pool->size = (size + OBJ_POOL_ALIGN - 1) & ~(size_t) (OBJ_POOL_ALIGN - 1);
+    pool->per_slab = count > 0 ? count : 1;
+    if (add_slab(pool) == -1) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+/**
+* obj_pool_get() - take an object from the pool
+* @pool: the pool
+*
+* The object is zeroed, as calloc() would return it.
+*
+* Return: the object, or NULL with errno set to ENOMEM if the pool could
+*         not grow
+*/
+void *obj_pool_get(struct obj_pool *pool)
+{
+    void *obj;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_list == NULL && add_slab(pool) == -1) {
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+    obj = pool->free_list;
+    pool->free_list = *(void **) obj;
+    pthread_mutex_unlock(&pool->lock);
+
+    memset(obj, 0, pool->size);
+    return obj;
+}
+
+/**
+* obj_pool_put() - return an object to the pool
+* @pool: the pool it came from
+* @obj: the object, or NULL
+*
+*/
+void obj_pool_put(struct obj_pool *pool, void *obj)
+{
+    if (obj == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    *(void **) obj = pool->free_list;
+    pool->free_list = obj;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,39 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef OBJPOOL_H
+#define OBJPOOL_H
+
+#include <stddef.h> /* size_t */
+#include <pthread.h> /* Pool lock */
+
+/* Objects are aligned for any type, and padded so neighbours never share a cache line */
+#define OBJ_POOL_ALIGN 64
+
+/*
+* A free list of fixed-size objects carved out of slabs.  The first slab
+* is allocated up front; if the pool ever runs dry another slab of the
+* same size is added, and objects are never handed back to the heap, so
+* once the pool has grown to the peak load getting and putting objects
+* costs no allocation.
+*/
+struct obj_pool {
+  pthread_mutex_t lock;
+  size_t size;               /* object size, rounded up to OBJ_POOL_ALIGN */
+  unsigned int per_slab;
+  void *free_list;
+};
+
+struct obj_pool *obj_pool_create(size_t size, unsigned int count);
+
+void *obj_pool_get(struct obj_pool *pool);
+
+void obj_pool_put(struct obj_pool *pool, void *obj);
+
+#endif
@@ -0,0 +1,152 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#define _GNU_SOURCE /* CPU_SET and sched_setaffinity */
+#include <stdio.h> /* Needed for fopen */
+#include <string.h> /* Needed for strerror */
+#include <errno.h>
+#include <limits.h> /* CHAR_BIT */
+#include <sched.h> /* sched_setaffinity */
+#include <unistd.h> /* Needed for sysconf and syscall */
+#include <sys/mman.h> /* madvise and mlock */
+#include <sys/syscall.h> /* SYS_mbind; libnuma is not required */
+#include <linux/mempolicy.h> /* MPOL_BIND */
+
+#include "log.h"
+#include "placement.h"
+
+/* Highest NUMA node placement_apply() can bind to, plus one */
+#define MAX_NODES 1024
+
+/**
+* placement_bind_cpus() - run the calling process on one NUMA node's CPUs
+* @node: the node
+*
+* Threads started afterwards inherit the mask, so calling this before the
+* ring thread and the workers start keeps them next to memory bound with
+* placement_apply().
+*
+* Return: number of CPUs on the node, or -1 if it has none or does not exist
+*/
+int placement_bind_cpus(int node)
+{
+    char path[64];
+    cpu_set_t cpus;
+    FILE *f;
+    int lo, hi, cpu, n = 0;
+    char sep;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+
+    /* A list of ranges, e.g. "0-3,8-11" */
+    CPU_ZERO(&cpus);
+    while (fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+        sep = (char) fgetc(f);
+        if (sep == '-') {
+            if (fscanf(f, "%d", &hi) != 1)
+                break;
+            sep = (char) fgetc(f);
+        }
+        for (cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++, n++)
+            CPU_SET(cpu, &cpus);
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+
+    if (n == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+        return -1;
+    return n;
+}
+
+/**
+* prefault() - fault every page of a shared mapping into the page tables
+* @addr: start of the mapping, page aligned
+* @size: its length
+*
+* One madvise() where the kernel has MADV_POPULATE_READ, otherwise a read
+* of each page.  The pages themselves already exist once the service has
+* written them, so this only saves the caller its own faults.
+*
+*/
+static void prefault(void *addr, size_t size)
+{
+    const volatile char *p = addr;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE), off;
+
+#ifdef MADV_POPULATE_READ
+    if (madvise(addr, size, MADV_POPULATE_READ) == 0)
+        return;
+#endif
+    for (off = 0; off < size; off += page)
+        (void) p[off];
+}
+
+/**
+* placement_apply() - place the service's mapping of the request segment
+* @addr: the new, untouched mapping
+* @size: its length
+* @arena_offset: where the payload arena starts; HUGE_PAGE_SIZE aligned with PLACE_HUGE
+* @flags: PLACE_* flags
+* @node: NUMA node to allocate the pages on, or -1 for the default policy
+*
+* Must run before the segment is first written, since page placement is
+* decided when a page is allocated.  Each step that the system refuses,
+* for example mlock() over RLIMIT_MEMLOCK, is logged and skipped.
+*
+*/
+void placement_apply(void *addr, size_t size, size_t arena_offset, unsigned int flags, int node)
+{
+    unsigned long nodes[MAX_NODES / (sizeof(unsigned long) * CHAR_BIT)];
+    volatile char *p = addr;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE), off;
+
+    if (node >= 0 && node < MAX_NODES) {
+        memset(nodes, 0, sizeof(nodes));
+        nodes[node / (sizeof(unsigned long) * CHAR_BIT)] = 1UL << (node % (sizeof(unsigned long) * CHAR_BIT));
+        if (syscall(SYS_mbind, addr, size, MPOL_BIND, nodes, (unsigned long) MAX_NODES + 1, 0) == -1)
+            log_warn("placement: mbind to node %d failed: %s", node, strerror(errno));
+    }
+
+    if ((flags & PLACE_HUGE) && size > arena_offset &&
+        madvise((char *) addr + arena_offset, size - arena_offset, MADV_HUGEPAGE) == -1)
+        log_warn("placement: madvise (MADV_HUGEPAGE) failed: %s", strerror(errno));
+
+    if (!(flags & PLACE_PREFAULT))
+        return;
+    /* mlock() faults every page in; without it, write each page to allocate it */
+    if (mlock(addr, size) == 0)
+        return;
+    log_warn("placement: mlock of %zu bytes failed (%s), prefaulting without locking", size, strerror(errno));
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(addr, size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    for (off = 0; off < size; off += page)
+        p[off] = p[off];
+}
+
+/**
+* placement_attach() - map a client's view of the request segment to match
+* @addr: the client's mapping
+* @size: its length
+* @arena_offset: where the payload arena starts
+* @flags: the PLACE_* flags the service published
+*
+*/
+void placement_attach(void *addr, size_t size, size_t arena_offset, unsigned int flags)
+{
+    if ((flags & PLACE_HUGE) && size > arena_offset)
+        madvise((char *) addr + arena_offset, size - arena_offset, MADV_HUGEPAGE);
+    if (flags & PLACE_PREFAULT)
+        prefault(addr, size);
+}
@@ -0,0 +1,31 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h> /* Needed for size_t */
+
+/* Size of a transparent huge page on x86-64 and arm64 with 4K pages */
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+/*
+* How the service lays out the request segment in memory, published in
+* the segment so clients can map it to match.
+*/
+#define PLACE_PREFAULT 0x1   /* every page faulted in and locked before clients attach */
+#define PLACE_HUGE 0x2       /* payload arena backed by transparent huge pages */
+
+int placement_bind_cpus(int node);
+
+void placement_apply(void *addr, size_t size, size_t arena_offset, unsigned int flags, int node);
+
+void placement_attach(void *addr, size_t size, size_t arena_offset, unsigned int flags);
+
+#endif
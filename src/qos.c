@@ -0,0 +1,228 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdlib.h> /* Needed for calloc and strtoul */
+
+#include "errors.h"
+#include "qos.h"
+
+/**
+* qos_create() - create an empty scheduler
+* @weights: weight of each class, at least 1
+*
+* Return: the new scheduler; failures are fatal
+*/
+struct qos *qos_create(const unsigned int weights[QOS_CLASSES])
+{
+    struct qos *s;
+    unsigned int i;
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        error_exit("calloc (qos)");
+    for (i = 0; i < QOS_CLASSES; i++)
+        s->classes[i].weight = weights[i];
+    for (i = 0; i < QOS_DEPTH; i++) {
+        s->reqs[i].next = s->free_list;
+        s->free_list = &s->reqs[i];
+    }
+    return s;
+}
+
+/**
+* qos_default_weights() - weight every class by its priority plus one
+* @weights: receives QOS_CLASSES weights
+*
+*/
+void qos_default_weights(unsigned int weights[QOS_CLASSES])
+{
+    unsigned int i;
+
+    for (i = 0; i < QOS_CLASSES; i++)
+        weights[i] = i + 1;
+}
+
+/**
+* qos_parse_weights() - parse a comma-separated list of class weights
+* @arg: weights for classes 0, 1, ...; classes past the end of the list
+*       take its last weight
+* @weights: receives QOS_CLASSES weights
+*
+* Return: 0 on success, -1 if a weight is not a positive number or there
+*         are more than QOS_CLASSES of them
+*/
+int qos_parse_weights(const char *arg, unsigned int weights[QOS_CLASSES])
+{
+    unsigned long w = 0;
+    unsigned int i = 0;
+    char *end;
+
+    for (;;) {
+        if (i == QOS_CLASSES)
+            return -1;
+        w = strtoul(arg, &end, 10);
+        if (end == arg || w < 1 || w > 1000)
+            return -1;
+        weights[i++] = w;
+        if (*end == '\0')
+            break;
+        if (*end != ',')
+            return -1;
+        arg = end + 1;
+    }
+    for (; i < QOS_CLASSES; i++)
+        weights[i] = w;
+    return 0;
+}
+
+/**
+* qos_class() - class of a registration priority
+* @prio: message queue priority of the registration
+*/
+unsigned int qos_class(unsigned int prio)
+{
+    return prio < QOS_CLASSES ? prio : QOS_CLASSES - 1;
+}
+
+/**
+* qos_full() - whether the scheduler can take no more requests
+* @s: the scheduler
+*/
+int qos_full(const struct qos *s)
+{
+    return s->free_list == NULL;
+}
+
+/**
+* qos_add() - queue a request popped off the submission ring
+* @s: the scheduler, not full
+* @sqe: the request
+* @prio: registration priority of the submitting client
+* @cost: bytes the request will rotate
+* @now: current time in nanoseconds, CLOCK_MONOTONIC
+*
+*/
+void qos_add(struct qos *s, const struct sq_entry *sqe, unsigned int prio, uint32_t cost,
+               uint64_t now)
+{
+    struct qos_req *r = s->free_list, *after;
+    struct qos_class *c;
+
+    s->free_list = r->next;
+    r->sqe = *sqe;
+    r->cls = qos_class(prio);
+    r->cost = cost < QOS_MAX_COST ? cost : QOS_MAX_COST;
+    r->queued = now;
+
+    c = &s->classes[r->cls];
+    r->prev = c->tail;
+    r->next = NULL;
+    if (c->tail != NULL)
+        c->tail->next = r;
+    else
+        c->head = r;
+    c->tail = r;
+
+    /* Deadlines mostly arrive in order, so search from the latest */
+    r->dprev = r->dnext = NULL;
+    if (sqe->deadline != 0) {
+        for (after = s->dtail; after != NULL && after->sqe.deadline > sqe->deadline; after = after->dprev)
+            ;
+        r->dprev = after;
+        r->dnext = after != NULL ? after->dnext : s->dhead;
+        if (r->dnext != NULL)
+            r->dnext->dprev = r;
+        else
+            s->dtail = r;
+        if (after != NULL)
+            after->dnext = r;
+        else
+            s->dhead = r;
+    }
+    s->count++;
+}
+
+/**
+* take() - unlink a request from its class and the deadline order
+* @s: the scheduler
+* @r: the request
+* @out: receives a copy of it
+*
+*/
+static void take(struct qos *s, struct qos_req *r, struct qos_req *out)
+{
+    struct qos_class *c = &s->classes[r->cls];
+
+    if (r->prev != NULL)
+        r->prev->next = r->next;
+    else
+        c->head = r->next;
+    if (r->next != NULL)
+        r->next->prev = r->prev;
+    else
+        c->tail = r->prev;
+
+    if (r->sqe.deadline != 0) {
+        if (r->dprev != NULL)
+            r->dprev->dnext = r->dnext;
+        else
+            s->dhead = r->dnext;
+        if (r->dnext != NULL)
+            r->dnext->dprev = r->dprev;
+        else
+            s->dtail = r->dprev;
+    }
+
+    c->deficit -= r->cost;
+    if (c->deficit < -QOS_MAX_COST)
+        c->deficit = -QOS_MAX_COST;
+    /* An idle class does not save up credit for later */
+    if (c->head == NULL && c->deficit > 0)
+        c->deficit = 0;
+
+    *out = *r;
+    r->next = s->free_list;
+    s->free_list = r;
+    s->count--;
+}
+
+/**
+* qos_next() - choose the next request to serve
+* @s: the scheduler
+* @now: current time in nanoseconds, CLOCK_MONOTONIC
+* @out: receives the request
+*
+* Return: QOS_URGENT if it was taken for its deadline, QOS_FAIR if
+*         it was its class's turn, or -1 if nothing is queued
+*/
+int qos_next(struct qos *s, uint64_t now, struct qos_req *out)
+{
+    struct qos_class *c;
+
+    if (s->count == 0)
+        return -1;
+
+    if (s->dhead != NULL && s->dhead->sqe.deadline <= now + QOS_SLACK_NS) {
+        take(s, s->dhead, out);
+        return QOS_URGENT;
+    }
+
+    /* Debt is capped, so a backlogged class gets its turn within a few rounds */
+    for (;;) {
+        c = &s->classes[s->cur];
+        if (c->head != NULL && c->deficit >= (long) c->head->cost)
+            break;
+        s->cur = (s->cur + 1) % QOS_CLASSES;
+        c = &s->classes[s->cur];
+        if (c->head != NULL)
+            c->deficit += (long) QOS_QUANTUM * c->weight;
+    }
+    take(s, c->head, out);
+    return QOS_FAIR;
+}
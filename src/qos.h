@@ -0,0 +1,83 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef QOS_H
+#define QOS_H
+
+#include <stdint.h> /* Costs and deadlines */
+
+#include "ring.h" /* struct sq_entry, SQ_SIZE */
+
+/* Registration priorities up to 9 get their own class; higher ones share the last */
+#define QOS_CLASSES 11
+
+/* Requests the scheduler holds before the ring thread stops popping the ring */
+#define QOS_DEPTH SQ_SIZE
+
+/* Bytes a class may rotate per round for each unit of weight */
+#define QOS_QUANTUM 16384
+
+/* Largest cost charged for one request, and the deepest debt a class can run up */
+#define QOS_MAX_COST (1 << 20)
+
+/* A request this close to its deadline is dispatched ahead of its turn */
+#define QOS_SLACK_NS 100000
+
+/* What qos_next() based its choice on */
+#define QOS_FAIR 0
+#define QOS_URGENT 1
+
+struct qos_req {
+  struct sq_entry sqe;
+  unsigned int cls;
+  uint32_t cost;                     /* bytes to rotate, capped at QOS_MAX_COST */
+  uint64_t queued;                   /* when it entered the scheduler */
+  struct qos_req *prev, *next;     /* class FIFO, or the free list */
+  struct qos_req *dprev, *dnext;   /* deadline order, if it has one */
+};
+
+struct qos_class {
+  struct qos_req *head, *tail;
+  long deficit;                      /* bytes it may still rotate this round */
+  unsigned int weight;
+};
+
+/*
+* Deficit round robin over one FIFO per priority class: each round a
+* class may rotate QOS_QUANTUM * weight bytes, so bulk requests of a
+* low class cannot crowd out small ones of a higher class.  Requests with
+* a deadline are also kept in deadline order, and one about to miss it is
+* taken first; its class pays for it out of later rounds.  Only the ring
+* thread uses a scheduler, so it has no lock.
+*/
+struct qos {
+  struct qos_class classes[QOS_CLASSES];
+  struct qos_req *dhead, *dtail;   /* requests with a deadline, earliest first */
+  struct qos_req *free_list;
+  unsigned int cur;                  /* class whose round it is */
+  unsigned int count;
+  struct qos_req reqs[QOS_DEPTH];
+};
+
+struct qos *qos_create(const unsigned int weights[QOS_CLASSES]);
+
+int qos_parse_weights(const char *arg, unsigned int weights[QOS_CLASSES]);
+
+void qos_default_weights(unsigned int weights[QOS_CLASSES]);
+
+unsigned int qos_class(unsigned int prio);
+
+int qos_full(const struct qos *s);
+
+void qos_add(struct qos *s, const struct sq_entry *sqe, unsigned int prio, uint32_t cost,
+               uint64_t now);
+
+int qos_next(struct qos *s, uint64_t now, struct qos_req *out);
+
+#endif
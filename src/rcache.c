@@ -0,0 +1,227 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdlib.h> /* Needed for calloc */
+#include <string.h> /* Needed for memcpy and memcmp */
+
+#include "caesar.h" /* rotx_buf */
+#include "errors.h"
+#include "rcache.h"
+
+/**
+* hash_message() - hash a message and its shift
+* @msg: the message
+* @len: its length, at most RCACHE_MAX_LEN
+* @shift: normalized to 0..25
+*
+* Eight bytes at a time, each word multiplied in and folded down.
+*
+*/
+static uint64_t hash_message(const char *msg, size_t len, unsigned int shift)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ ((uint64_t) len << 8) ^ shift;
+    uint64_t w;
+    size_t i;
+
+    for (i = 0; i + sizeof(w) <= len; i += sizeof(w)) {
+        memcpy(&w, msg + i, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+    }
+    w = 0;
+    memcpy(&w, msg + i, len - i);
+    h = (h ^ w) * 0xff51afd7ed558ccdull;
+    return h ^ (h >> 33);
+}
+
+static char *entry_input(struct result_cache *cache, uint32_t idx)
+{
+    return cache->data + (size_t) idx * 2 * RCACHE_MAX_LEN;
+}
+
+static char *entry_output(struct result_cache *cache, uint32_t idx)
+{
+    return entry_input(cache, idx) + RCACHE_MAX_LEN;
+}
+
+/**
+* find_locked() - look a message up; the cache lock must be held
+* @cache: the cache
+* @hash: hash_message() of it
+* @msg: the message
+* @len: its length
+* @shift: normalized to 0..25
+*
+* Return: the entry, ready or being filled, or RCACHE_NIL
+*/
+static uint32_t find_locked(struct result_cache *cache, uint64_t hash, const char *msg,
+                            size_t len, unsigned int shift)
+{
+    uint32_t idx = cache->buckets[hash & (cache->nbuckets - 1)];
+    const struct rcache_entry *e;
+
+    for (; idx != RCACHE_NIL; idx = e->next) {
+        e = &cache->entries[idx];
+        if (e->hash == hash && e->len == len && e->shift == shift &&
+            memcmp(entry_input(cache, idx), msg, len) == 0)
+            return idx;
+    }
+    return RCACHE_NIL;
+}
+
+/**
+* unlink_locked() - take a ready entry off its hash chain
+* @cache: the cache, locked
+* @idx: the entry
+*
+*/
+static void unlink_locked(struct result_cache *cache, uint32_t idx)
+{
+    uint32_t *link = &cache->buckets[cache->entries[idx].hash & (cache->nbuckets - 1)];
+
+    while (*link != idx)
+        link = &cache->entries[*link].next;
+    *link = cache->entries[idx].next;
+}
+
+/**
+* claim_locked() - find an entry for a new result, evicting one if need be
+* @cache: the cache, locked
+*
+* The CLOCK hand gives every referenced entry a second chance and takes
+* the first empty or unreferenced one.  Two turns clear every reference
+* bit, so only entries all being filled at once leave nothing to claim.
+*
+* Return: an empty entry, off every chain, or RCACHE_NIL
+*/
+static uint32_t claim_locked(struct result_cache *cache)
+{
+    struct rcache_entry *e;
+    unsigned int steps;
+    uint32_t idx;
+
+    for (steps = 0; steps < 2 * cache->nentries; steps++) {
+        idx = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->nentries;
+        e = &cache->entries[idx];
+        if (e->state == RCACHE_EMPTY)
+            return idx;
+        if (e->state == RCACHE_FILLING)
+            continue;
+        if (e->referenced) {
+            e->referenced = 0;
+            continue;
+        }
+        unlink_locked(cache, idx);
+        e->state = RCACHE_EMPTY;
+        return idx;
+    }
+    return RCACHE_NIL;
+}
+
+/**
+* rcache_create() - create an empty result cache
+* @nentries: results it holds, at least 1
+*
+* Return: the new cache; failures are fatal
+*/
+struct result_cache *rcache_create(unsigned int nentries)
+{
+    struct result_cache *cache;
+    unsigned int i;
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL)
+        error_exit("calloc (result_cache)");
+
+    for (cache->nbuckets = 16; cache->nbuckets < 2 * nentries; cache->nbuckets *= 2)
+        ;
+    cache->nentries = nentries;
+    cache->buckets = malloc(cache->nbuckets * sizeof(*cache->buckets));
+    cache->entries = calloc(nentries, sizeof(*cache->entries));
+    cache->data = malloc((size_t) nentries * 2 * RCACHE_MAX_LEN);
+    if (cache->buckets == NULL || cache->entries == NULL || cache->data == NULL)
+        error_exit("calloc (result_cache entries)");
+    for (i = 0; i < cache->nbuckets; i++)
+        cache->buckets[i] = RCACHE_NIL;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->filled, NULL);
+    return cache;
+}
+
+/**
+* rcache_rotx() - rotate a message in place, through the cache
+* @cache: the cache
+* @data: the message, rewritten with the result
+* @len: its length
+* @shift: the shift, any value
+*
+* The message is copied out once before anything else, and the result is
+* computed from that copy, so a client rewriting shared memory meanwhile
+* only garbles its own reply and never what the cache hands to others.
+* A hit copies the stored result over the message without rotating.
+*
+* Return: how the result was obtained
+*/
+enum rcache_outcome rcache_rotx(struct result_cache *cache, char *data, size_t len, int shift)
+{
+    char msg[RCACHE_MAX_LEN];
+    unsigned int norm = (unsigned int) (shift % 26 + 26) % 26;
+    enum rcache_outcome outcome = RCACHE_HIT;
+    uint64_t hash;
+    uint32_t idx, *bucket;
+    struct rcache_entry *e;
+
+    if (len > RCACHE_MAX_LEN) {
+        rotx_buf(data, len, shift);
+        return RCACHE_BYPASS;
+    }
+    memcpy(msg, data, len);
+    hash = hash_message(msg, len, norm);
+
+    pthread_mutex_lock(&cache->lock);
+    while ((idx = find_locked(cache, hash, msg, len, norm)) != RCACHE_NIL &&
+           cache->entries[idx].state == RCACHE_FILLING) {
+        pthread_cond_wait(&cache->filled, &cache->lock);
+        outcome = RCACHE_COLLAPSED;
+    }
+    if (idx != RCACHE_NIL) {
+        cache->entries[idx].referenced = 1;
+        memcpy(data, entry_output(cache, idx), len);
+        pthread_mutex_unlock(&cache->lock);
+        return outcome;
+    }
+
+    idx = claim_locked(cache);
+    if (idx != RCACHE_NIL) {
+        e = &cache->entries[idx];
+        e->hash = hash;
+        e->len = (uint32_t) len;
+        e->shift = norm;
+        e->state = RCACHE_FILLING;
+        e->referenced = 0;
+        memcpy(entry_input(cache, idx), msg, len);
+        bucket = &cache->buckets[hash & (cache->nbuckets - 1)];
+        e->next = *bucket;
+        *bucket = idx;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    rotx_buf(msg, len, (int) norm);
+    memcpy(data, msg, len);
+    if (idx == RCACHE_NIL)
+        return RCACHE_BYPASS;
+
+    pthread_mutex_lock(&cache->lock);
+    memcpy(entry_output(cache, idx), msg, len);
+    cache->entries[idx].state = RCACHE_READY;
+    pthread_cond_broadcast(&cache->filled);
+    pthread_mutex_unlock(&cache->lock);
+    return RCACHE_MISS;
+}
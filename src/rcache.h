@@ -0,0 +1,73 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef RCACHE_H
+#define RCACHE_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* Hashes and chain links */
+#include <pthread.h> /* Cache lock */
+
+/* Longest message the cache keeps; longer ones are always rotated */
+#define RCACHE_MAX_LEN 256
+
+/* Ends a hash chain */
+#define RCACHE_NIL UINT32_MAX
+
+/* How rcache_rotx() got its result */
+enum rcache_outcome {
+    RCACHE_BYPASS,     /* too long to cache, or every entry was being filled */
+    RCACHE_HIT,
+    RCACHE_MISS,       /* rotated and added */
+    RCACHE_COLLAPSED   /* waited for another thread rotating the same input */
+};
+
+enum rcache_state {
+    RCACHE_EMPTY,
+    RCACHE_FILLING,    /* claimed by a miss, result not in yet */
+    RCACHE_READY
+};
+
+/*
+* A cached (message, shift) pair.  The input and its rotation live at
+* index * 2 * RCACHE_MAX_LEN in the cache's data block.
+*/
+struct rcache_entry {
+  uint64_t hash;
+  uint32_t len;
+  uint32_t next;             /* hash chain */
+  unsigned int shift;        /* normalized to 0..25 */
+  enum rcache_state state;
+  int referenced;            /* hit since the clock hand last passed */
+};
+
+/*
+* Bounded map from (message bytes, shift mod 26) to the rotated message,
+* shared by every thread serving requests.  One mutex guards it; a miss
+* claims an entry in RCACHE_FILLING and rotates outside the lock, and
+* identical requests arriving meanwhile wait for it on 'filled' instead of
+* rotating too.  Entries are evicted in CLOCK order, skipping those being
+* filled.
+*/
+struct result_cache {
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  unsigned int nentries;
+  unsigned int nbuckets;     /* power of two */
+  uint32_t *buckets;
+  struct rcache_entry *entries;
+  char *data;
+  unsigned int hand;         /* the CLOCK hand */
+};
+
+struct result_cache *rcache_create(unsigned int nentries);
+
+enum rcache_outcome rcache_rotx(struct result_cache *cache, char *data, size_t len, int shift);
+
+#endif
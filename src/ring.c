@@ -0,0 +1,497 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <sched.h> /* Needed for sched_yield */
+#include <unistd.h> /* Needed for syscall */
+#include <pthread.h> /* The spin budget is set once */
+#include <limits.h> /* INT_MAX, to wake every sleeper */
+#include <time.h> /* Waits with a timeout */
+#ifdef __linux__
+#include <linux/futex.h> /* FUTEX_WAIT and FUTEX_WAKE */
+#include <sys/syscall.h> /* SYS_futex */
+#endif
+
+#include "ring.h"
+
+/* Spin budget before sleeping, set on first use by any thread; see RING_SPIN */
+static int ring_spin;
+static pthread_once_t spin_once = PTHREAD_ONCE_INIT;
+
+static void set_spin(void)
+{
+    ring_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN : 0;
+}
+
+/**
+* cpu_relax() - hint to the CPU that we are in a spin loop
+*/
+static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+* futex_wait() - sleep while *word still holds val
+* @word: the futex word, which lives in shared memory
+* @val: the value that means "still asleep"
+* @timeout: longest sleep, or NULL to sleep until woken
+*
+* The futexes are not FUTEX_PRIVATE because the rings are shared between
+* processes.  Spurious wakeups are fine, callers always re-check the ring.
+* Without futexes we fall back to yielding the CPU.
+*
+*/
+static void futex_wait(atomic_uint *word, unsigned int val, const struct timespec *timeout)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT, val, timeout, NULL, 0);
+#else
+    (void) timeout;
+    if (atomic_load(word) == val)
+        sched_yield();
+#endif
+}
+
+/**
+* futex_wake() - wake sleepers on a futex word
+* @word: the futex word, which lives in shared memory
+* @n: how many to wake at most
+*
+*/
+static void futex_wake(atomic_uint *word, int n)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, n, NULL, NULL, 0);
+#else
+    (void) word;
+    (void) n;
+#endif
+}
+
+/**
+* deadline_after() - the CLOCK_MONOTONIC time some milliseconds from now
+* @deadline: set to the deadline
+* @ms: milliseconds from now
+*
+*/
+static void deadline_after(struct timespec *deadline, int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long) (ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+* time_left() - the time until a deadline from deadline_after()
+* @deadline: the deadline
+* @left: set to the time left
+*
+* Return: 1 with left set, or 0 if the deadline has passed
+*/
+static int time_left(const struct timespec *deadline, struct timespec *left)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left->tv_sec = deadline->tv_sec - now.tv_sec;
+    left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left->tv_nsec < 0) {
+        left->tv_sec--;
+        left->tv_nsec += 1000000000L;
+    }
+    return left->tv_sec >= 0;
+}
+
+/**
+* wake_if_sleeping() - wake the consumer of a ring only if it is asleep
+* @waiters: the futex word of the ring
+*
+* Called by a producer after publishing an entry.  The full fence pairs
+* with the one in ring_sleep() and cq_arm(): either the consumer sees our
+* entry before it sleeps, or we see its waiters word and wake it.
+*
+* Return: what the consumer was waiting on, RING_AWAKE if it was not
+*/
+static unsigned int wake_if_sleeping(atomic_uint *waiters)
+{
+    unsigned int w;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) == RING_AWAKE)
+        return RING_AWAKE;
+
+    w = atomic_exchange(waiters, RING_AWAKE);
+    if (w == RING_WAIT_FUTEX)
+        futex_wake(waiters, 1);
+    return w;
+}
+
+/**
+* sq_init() - initialize an empty submission ring
+* @sq: the ring, usually inside the service's shared memory segment
+*
+*/
+void sq_init(struct submit_ring *sq)
+{
+    unsigned int i;
+
+    atomic_init(&sq->tail, 0);
+    sq->head = 0;
+    atomic_init(&sq->waiters, 0);
+    atomic_init(&sq->kicked, 0);
+    atomic_init(&sq->room, 0);
+    for (i = 0; i < SQ_SIZE; i++)
+        atomic_init(&sq->cells[i].seq, i);
+}
+
+/**
+* sq_push() - submit a request (any number of producers)
+* @sq: the submission ring
+* @entry: the request; its tag identifies it in the completion ring
+* @claim: the producer's own claim word, see sq_stalled()
+*
+* Before taking a cell the producer writes its position + 1 to @claim,
+* and clears it once the cell is filled.  A producer that dies in between
+* leaves the cell claimed but empty, and @claim says whose it was.
+*
+* Return: 0 on success or -1 if the ring is full
+*/
+int sq_push(struct submit_ring *sq, const struct sq_entry *entry, atomic_uint *claim)
+{
+    struct sq_cell *cell;
+    unsigned int pos, seq;
+    int dif;
+
+    pos = atomic_load_explicit(&sq->tail, memory_order_relaxed);
+    for (;;) {
+        cell = &sq->cells[pos & (SQ_SIZE - 1)];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        dif = (int) (seq - pos);
+        if (dif == 0) {
+            atomic_store_explicit(claim, pos + 1, memory_order_relaxed);
+            if (atomic_compare_exchange_weak_explicit(&sq->tail, &pos, pos + 1,
+                        memory_order_release, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            atomic_store_explicit(claim, 0, memory_order_relaxed);
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&sq->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->entry = *entry;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    atomic_store_explicit(claim, 0, memory_order_release);
+
+    wake_if_sleeping(&sq->waiters);
+    return 0;
+}
+
+/**
+* sq_full() - tell whether a producer would find the ring full
+* @sq: the submission ring
+*
+*/
+static int sq_full(struct submit_ring *sq)
+{
+    unsigned int pos = atomic_load_explicit(&sq->tail, memory_order_relaxed);
+    struct sq_cell *cell = &sq->cells[pos & (SQ_SIZE - 1)];
+
+    return (int) (atomic_load_explicit(&cell->seq, memory_order_acquire) - pos) < 0;
+}
+
+/**
+* sq_wait_room() - sleep while the ring is full (any producer)
+* @sq: the submission ring
+* @timeout_ms: longest wait in milliseconds
+*
+* The consumer wakes every producer sleeping here once it has freed a
+* cell; the full fence pairs with the one in wake_producers().
+*
+* Return: 0 once there may be room, or -1 if the ring stayed full for
+*         timeout_ms
+*/
+int sq_wait_room(struct submit_ring *sq, int timeout_ms)
+{
+    struct timespec deadline, left;
+
+    deadline_after(&deadline, timeout_ms);
+    while (sq_full(sq)) {
+        if (!time_left(&deadline, &left))
+            return -1;
+        atomic_store(&sq->room, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!sq_full(sq))
+            break;
+        futex_wait(&sq->room, 1, &left);
+    }
+    return 0;
+}
+
+/**
+* wake_producers() - wake producers waiting for room, if any
+* @sq: the submission ring
+*
+* Called by the consumer after it has freed a cell.
+*
+*/
+static void wake_producers(struct submit_ring *sq)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sq->room, memory_order_relaxed) != 0 && atomic_exchange(&sq->room, 0) != 0)
+        futex_wake(&sq->room, INT_MAX);
+}
+
+/**
+* sq_pop() - take the oldest request (single consumer)
+* @sq: the submission ring
+* @entry: set to the request
+*
+* Return: 0 on success or -1 if the ring is empty
+*/
+int sq_pop(struct submit_ring *sq, struct sq_entry *entry)
+{
+    struct sq_cell *cell = &sq->cells[sq->head & (SQ_SIZE - 1)];
+
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != sq->head + 1)
+        return -1;
+
+    *entry = cell->entry;
+    atomic_store_explicit(&cell->seq, sq->head + SQ_SIZE, memory_order_release);
+    sq->head++;
+    wake_producers(sq);
+    return 0;
+}
+
+/**
+* sq_stalled() - tell whether the oldest cell was claimed but never filled
+* @sq: the submission ring
+* @pos: set to the cell's position
+*
+* Nothing behind such a cell can be popped.  A producer normally fills it
+* at once; if the producer died instead, the claim word it passed to
+* sq_push() still holds @pos + 1, and the consumer may drop the cell with
+* sq_skip().
+*
+* Return: 1 if the cell at head is claimed and empty, 0 otherwise
+*/
+int sq_stalled(struct submit_ring *sq, unsigned int *pos)
+{
+    struct sq_cell *cell = &sq->cells[sq->head & (SQ_SIZE - 1)];
+
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != sq->head ||
+        atomic_load_explicit(&sq->tail, memory_order_acquire) == sq->head)
+        return 0;
+    *pos = sq->head;
+    return 1;
+}
+
+/**
+* sq_skip() - drop the cell sq_stalled() found (single consumer)
+* @sq: the submission ring
+*
+* Return: 0 if the cell was dropped, or -1 if it was filled meanwhile
+*/
+int sq_skip(struct submit_ring *sq)
+{
+    struct sq_cell *cell = &sq->cells[sq->head & (SQ_SIZE - 1)];
+    unsigned int expected = sq->head;
+
+    if (!atomic_compare_exchange_strong(&cell->seq, &expected, sq->head + SQ_SIZE))
+        return -1;
+    sq->head++;
+    wake_producers(sq);
+    return 0;
+}
+
+static int sq_empty(struct submit_ring *sq)
+{
+    struct sq_cell *cell = &sq->cells[sq->head & (SQ_SIZE - 1)];
+
+    return atomic_load_explicit(&cell->seq, memory_order_acquire) != sq->head + 1;
+}
+
+static int cq_empty(struct complete_ring *cq)
+{
+    return atomic_load_explicit(&cq->head, memory_order_relaxed) ==
+           atomic_load_explicit(&cq->tail, memory_order_acquire);
+}
+
+/**
+* ring_sleep() - spin, then sleep on a ring's futex until it has entries
+* @waiters: the futex word of the ring
+* @empty: returns nonzero while the ring has nothing to consume
+* @ring: the ring passed to @empty
+* @timeout_ms: longest wait in milliseconds, or -1 for none
+*
+* Return: 0 once the ring has entries, or -1 if it stayed empty for
+*         timeout_ms
+*/
+static int ring_sleep(atomic_uint *waiters, int (*empty)(void *), void *ring, int timeout_ms)
+{
+    struct timespec deadline, left;
+    int spin, ret = 0;
+
+    pthread_once(&spin_once, set_spin);
+
+    for (spin = 0; spin < ring_spin; spin++) {
+        if (!empty(ring))
+            return 0;
+        cpu_relax();
+    }
+
+    if (timeout_ms >= 0)
+        deadline_after(&deadline, timeout_ms);
+    while (empty(ring)) {
+        if (timeout_ms >= 0 && !time_left(&deadline, &left)) {
+            ret = -1;
+            break;
+        }
+        atomic_store(waiters, RING_WAIT_FUTEX);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!empty(ring))
+            break;
+        futex_wait(waiters, RING_WAIT_FUTEX, timeout_ms >= 0 ? &left : NULL);
+    }
+    atomic_store_explicit(waiters, RING_AWAKE, memory_order_relaxed);
+    return ret;
+}
+
+static int sq_idle_cb(void *ring)
+{
+    struct submit_ring *sq = ring;
+
+    return sq_empty(sq) && !atomic_load(&sq->kicked);
+}
+
+static int cq_empty_cb(void *ring)
+{
+    return cq_empty(ring);
+}
+
+/**
+* sq_wait() - block the consumer until a request has been submitted
+* @sq: the submission ring
+*
+* Also returns once sq_kick() has been called since the last return.
+*
+*/
+void sq_wait(struct submit_ring *sq)
+{
+    ring_sleep(&sq->waiters, sq_idle_cb, sq, -1);
+    atomic_exchange(&sq->kicked, 0);
+}
+
+/**
+* sq_kick() - wake the consumer without submitting a request
+* @sq: the submission ring
+*
+* Whatever the caller published before the kick is visible to the
+* consumer once its sq_wait() returns.
+*
+*/
+void sq_kick(struct submit_ring *sq)
+{
+    atomic_store(&sq->kicked, 1);
+    wake_if_sleeping(&sq->waiters);
+}
+
+/**
+* cq_init() - initialize an empty completion ring
+* @cq: the ring, usually inside a request slot
+*
+*/
+void cq_init(struct complete_ring *cq)
+{
+    atomic_init(&cq->head, 0);
+    atomic_init(&cq->tail, 0);
+    atomic_init(&cq->waiters, 0);
+}
+
+/**
+* cq_push() - post a completion (single producer)
+* @cq: the completion ring
+* @tag: tag of the completed request
+* @status: 0 on success
+*
+* Return: 0 on success, 1 on success when the consumer armed the ring with
+*         cq_arm() and must be notified through its file descriptor, or -1
+*         if the ring is full
+*/
+int cq_push(struct complete_ring *cq, unsigned int tag, int status)
+{
+    unsigned int tail = atomic_load_explicit(&cq->tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(&cq->head, memory_order_acquire) == CQ_SIZE)
+        return -1;
+
+    cq->cells[tail & (CQ_SIZE - 1)].tag = tag;
+    cq->cells[tail & (CQ_SIZE - 1)].status = status;
+    atomic_store_explicit(&cq->tail, tail + 1, memory_order_release);
+
+    return wake_if_sleeping(&cq->waiters) == RING_WAIT_NOTIFY ? 1 : 0;
+}
+
+/**
+* cq_pop() - collect a completion (single consumer)
+* @cq: the completion ring
+* @entry: set to the completion
+*
+* Return: 0 on success or -1 if the ring is empty
+*/
+int cq_pop(struct complete_ring *cq, struct cq_entry *entry)
+{
+    unsigned int head = atomic_load_explicit(&cq->head, memory_order_relaxed);
+
+    if (head == atomic_load_explicit(&cq->tail, memory_order_acquire))
+        return -1;
+
+    *entry = cq->cells[head & (CQ_SIZE - 1)];
+    atomic_store_explicit(&cq->head, head + 1, memory_order_release);
+    return 0;
+}
+
+/**
+* cq_arm() - ask to be notified of the next completion instead of sleeping
+* @cq: the completion ring
+*
+* After a successful arm the next cq_push() returns 1 and the producer
+* signals the client's file descriptor.
+*
+* Return: 0 if armed, 1 if completions are already waiting (not armed)
+*/
+int cq_arm(struct complete_ring *cq)
+{
+    atomic_store(&cq->waiters, RING_WAIT_NOTIFY);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!cq_empty(cq)) {
+        atomic_store(&cq->waiters, RING_AWAKE);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+* cq_wait() - block the client until a completion has been posted
+* @cq: the completion ring
+* @timeout_ms: longest wait in milliseconds, or -1 for none
+*
+* Return: 0 once a completion is waiting, or -1 if none came in timeout_ms
+*/
+int cq_wait(struct complete_ring *cq, int timeout_ms)
+{
+    return ring_sleep(&cq->waiters, cq_empty_cb, cq, timeout_ms);
+}
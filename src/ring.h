@@ -0,0 +1,110 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h> /* Ring indexes are shared between processes */
+#include <stdint.h> /* Fixed-width payload offsets */
+
+/* Both sizes must be powers of two */
+#define SQ_SIZE 1024
+#define CQ_SIZE 64
+
+/* Values of a ring's 'waiters' word */
+#define RING_AWAKE 0
+#define RING_WAIT_FUTEX 1   /* consumer sleeps on the futex */
+#define RING_WAIT_NOTIFY 2  /* consumer polls an fd; producer must notify */
+
+/*
+* Polls of an empty ring before a consumer goes to sleep on its futex.
+* Only used with more than one online CPU: on a single CPU the producer
+* cannot run while we spin.
+*/
+#define RING_SPIN 200
+
+/*
+* Submission ring: many clients push, the service pops.
+*
+* Each cell carries a sequence number (Vyukov's bounded queue), so
+* producers only contend on the tail with a compare-and-swap and the
+* consumer never writes a shared index.  'waiters' is the futex word the
+* consumer sleeps on; producers only make the wake syscall when it is set.
+* sq_kick() wakes the consumer without a request, through 'kicked'.
+* Producers sleep on 'room' while the ring is full.
+*/
+struct sq_entry {
+  unsigned int slot;   /* submitting client's request slot */
+  unsigned int tag;    /* echoed in the completion */
+  int shift;
+  unsigned int kind;   /* request kind, see caesar_ipc.h */
+  uint64_t payload;    /* arena buffer, or ARENA_NONE: staged in the slot */
+  uint64_t deadline;   /* CLOCK_MONOTONIC nanoseconds to finish by, 0 for none */
+};
+
+struct sq_cell {
+  atomic_uint seq;
+  struct sq_entry entry;
+};
+
+struct submit_ring {
+  _Alignas(64) atomic_uint tail;
+  _Alignas(64) unsigned int head;
+  atomic_uint waiters;
+  atomic_uint kicked;
+  atomic_uint room;
+  struct sq_cell cells[SQ_SIZE];
+};
+
+/*
+* Completion ring: one per client slot, the service pushes and the client
+* pops.  Single producer and single consumer, so plain acquire/release
+* indexes are enough.  Besides sleeping on the futex, a client can arm the
+* ring with cq_arm() and wait on a file descriptor instead; cq_push() then
+* tells the producer to send a notification.
+*/
+struct cq_entry {
+  unsigned int tag;
+  int status;
+};
+
+struct complete_ring {
+  atomic_uint head;
+  atomic_uint tail;
+  atomic_uint waiters;
+  struct cq_entry cells[CQ_SIZE];
+};
+
+void sq_init(struct submit_ring *sq);
+
+int sq_push(struct submit_ring *sq, const struct sq_entry *entry, atomic_uint *claim);
+
+int sq_wait_room(struct submit_ring *sq, int timeout_ms);
+
+int sq_pop(struct submit_ring *sq, struct sq_entry *entry);
+
+int sq_stalled(struct submit_ring *sq, unsigned int *pos);
+
+int sq_skip(struct submit_ring *sq);
+
+void sq_wait(struct submit_ring *sq);
+
+void sq_kick(struct submit_ring *sq);
+
+void cq_init(struct complete_ring *cq);
+
+int cq_push(struct complete_ring *cq, unsigned int tag, int status);
+
+int cq_pop(struct complete_ring *cq, struct cq_entry *entry);
+
+int cq_arm(struct complete_ring *cq);
+
+int cq_wait(struct complete_ring *cq, int timeout_ms);
+
+#endif
@@ -15,73 +15,358 @@
 #include <fcntl.h>  /* Defines file descriptor constants: O_ */
 #include <mqueue.h>   /* Required to implement POSIX message queues */
 #include <semaphore.h> /* Needed for semaphore */
+#include <pthread.h> /* Ring transport consumer thread */
+#include <errno.h> /* EAGAIN from non-blocking queues */
+#include <sys/epoll.h> /* Main event loop */
+#include <sys/signalfd.h> /* Shutdown signals are read in the event loop */
 
 #include "caesar.h" /* Defines Caesar Cipher functions */
+#include "caesar_ipc.h" /* Shared memory layout and IPC object names */
 #include "errors.h" /* Custom Error functions */
+#include "workers.h" /* Session worker pool */
+#include "clients.h" /* Registered clients and their open queues */
+#include "stats.h" /* Live statistics segment */
+#include "log.h" /* Asynchronous logging */
+#include "qos.h" /* Weighted fair dispatch of ring requests */
+#include "objpool.h" /* Waiting registrations */
+#include "placement.h" /* Prefaulting, huge pages and NUMA binding of the segment */
+#include "conns.h" /* Unix socket transport */
+#include "rcache.h" /* Results of repeated messages */
+#include "ipcns.h" /* Names of this instance's IPC objects */
 
 /* Used for color in Linux terminal output */
 #define RESET "\033[0m"
 #define RED "\033[31m"
 #define GREEN "\033[32m"
 
-/* For Shared Memory and Message Queues */
-#define SHM_NAME "/shm_caesar"
-#define REG_MQ_NAME "/mq_registration"
-#define SEM_MUTEX_NAME "/sem_mutex"
-#define BUFSIZE 256
+/* Events handled per epoll_wait() */
+#define MAX_EVENTS 64
+
+/* How often registrations waiting for a free slot are retried, in milliseconds */
+#define SLOT_RETRY_MS 10
+
+/* How often a draining service checks whether its clients have left, in milliseconds */
+#define DRAIN_POLL_MS 50
+
+/* Seconds a draining service waits for its clients before exiting anyway */
+#define DEFAULT_DRAIN_SECS 30
+
+/* How long -R waits for the running service to stop taking registrations */
+#define HANDOVER_WAIT_MS 5000
+
+/* How often clients are checked for having exited without deregistering, in milliseconds */
+#define REAP_INTERVAL_MS 1000
+
+/* Seconds a dead ring client's slot waits for its requests before it is reused anyway */
+#define DEFAULT_STUCK_SECS 10
+
+/* Dead clients taken back per scan; the rest are found by the next one */
+#define REAP_BATCH 64
+
+/* Values of slot_reap[] */
+#define REAP_NONE 0
+#define REAP_DEAD 1       /* client died; its completions are discarded */
+#define REAP_RELEASE 2    /* the ring thread is to free the slot */
+
+/* How often parked completions are retried while the ring is idle, in microseconds */
+#define PARKED_RETRY_US 1000
+
 mqd_t registration_mqd;
 
-struct shared_memory {
-  char message[BUFSIZE+1];
-  int shift;
+/* This instance's IPC object names, in the namespace given with -x */
+struct ipc_names ipc;
+
+/*
+* SIGTERM and SIGINT are blocked in every thread and read from signal_fd
+* in the event loop.  Either one starts a drain: registrations are told
+* 'busy', the Unix socket stops accepting, and the service exits once
+* every client has left its slot or hung up, or after drain_secs.  A
+* second one exits at once.  SIGUSR1, sent by a service started with -R,
+* hands over instead: the registration queue is left to the new service,
+* which also replaces every IPC name, so this one unlinks nothing.
+*/
+int signal_fd;
+unsigned int drain_secs;
+
+/*
+* Admission control: past either high-water mark new registrations are
+* answered 'busy' instead of joining the backlog.  Deregistrations always
+* get through, since they are what frees slots.
+*/
+unsigned int max_pending;    /* registrations waiting for a free slot */
+unsigned int max_inflight;   /* requests on the submission ring not yet served */
+
+/* Watches the registration queue and every message queue client's send queue */
+int epoll_fd;
+
+/* Serves requests staged in the payload arena off the event loop */
+struct work_pool *pool;
+
+/* Orders ring requests between the submission ring and rotx */
+struct qos *qos;
+
+/* Request segment and free slot counter, shared by all worker threads */
+struct shared_memory *shared_mem_ptr;
+sem_t *slots_sem;
+
+/* Registered clients, keyed by queue base name */
+struct client_table *clients;
+
+/* Results of recent short messages, NULL unless enabled with -C */
+struct result_cache *cache;
+
+/* Published statistics, and the registration priority of each slot's client */
+struct service_stats *stats;
+unsigned int *slot_prio;
+
+/* Owner tags handed out with slots so far, see struct request_slot */
+uint64_t slot_owners;
+
+/*
+* A dead ring client may still have requests on the rings, which would
+* complete on its slot after a new client got it.  Its slot is held back
+* from when it was found dead until they have all completed, or for
+* stuck_secs if some never do.  0 if the slot is not held back.
+* Meanwhile slot_reap tells the ring thread to throw its completions away
+* instead of waiting for room on a ring nobody reads.  The ring thread
+* owns each slot's completion ring and parked completions, so the event
+* loop gives a slot back by marking it REAP_RELEASE and kicking the ring
+* thread, which resets and frees it; releases_pending counts those.
+*/
+uint64_t *slot_reclaim;
+atomic_int *slot_reap;
+atomic_uint releases_pending;
+unsigned int stuck_secs;
+
+/*
+* Completions the ring thread could not post because the client's
+* completion ring was full, oldest first.  Nothing newer is posted to the
+* slot before them, so the client still sees its completions in order.
+* Only the ring thread touches these.
+*/
+struct parked_cq {
+  struct cq_entry cells[CQ_SIZE];
+  unsigned int head;
+  unsigned int count;
+};
+struct parked_cq *parked;
+unsigned int parked_total;
+
+/* A registration, kept on a FIFO while no request slot is free */
+struct session {
+  char name[BUFSIZE];
+  unsigned int flags;
+  unsigned int prio;
+  pid_t pid;
+  uint64_t received;         /* stats_now_ns() when it was read */
+  struct session *next;
 };
 
 /* API Declarations */
 int daemonize(void);
 
-/* Handle CTRL+C SIGINT signal */
-void interrupt_handler(int signo);
+/* Reserves a free request slot for a newly registered client */
+int claim_slot(struct shared_memory *shm, sem_t *free_slots);
+
+/* Rotates one message, through the result cache if there is one */
+void serve_rotx(char *data, size_t len, int shift);
+
+/* Runs rotx on a staged request slot */
+int serve_slot(struct request_slot *req);
+
+/* Runs rotx on a request staged in a payload arena buffer */
+int serve_payload(uint64_t payload, unsigned int kind, int shift);
+
+/* Runs rotx on every message of a batch request */
+int serve_batch(char *data, size_t len);
+
+/* Runs rotx on a request in a Unix socket client's memfd */
+int serve_conn(char *data, size_t len, unsigned int kind, int shift);
+
+/* Thread serving requests submitted on the shared memory ring */
+void *ring_consumer(void *arg);
+
+/* Posts a ring request's completion, or parks it while the client's ring is full */
+void post_completion(struct shared_memory *shm, unsigned int slot, unsigned int tag, int status);
+
+/* Retries completions parked on full completion rings */
+void flush_parked(struct shared_memory *shm);
+
+/* Resets and frees the slots release_slot() handed to the ring thread */
+void free_released(struct shared_memory *shm);
+
+/* Drops a submission ring cell a dead client claimed but never filled */
+void skip_dead_claim(struct shared_memory *shm, unsigned int pos);
+
+/* Bytes a ring request will rotate, as charged by the scheduler */
+uint32_t request_cost(const struct sq_entry *sqe);
+
+/* Thread refreshing the queue depth gauges of the statistics */
+void *stats_sampler(void *arg);
+
+/* Ring requests submitted but not yet served */
+unsigned int ring_backlog(struct shared_memory *shm);
+
+/* Turns a registration away while the service is overloaded */
+void send_busy(const char *name, unsigned int prio);
+
+/* Tells a client it registered for a segment that has been replaced */
+void send_stale(const char *name, unsigned int prio);
+
+/* Sends a one-word reply to a client that has no session */
+void send_reply(const char *name, const char *reply, unsigned int prio);
+
+/* Asks the running service to hand over, and waits until it has */
+pid_t take_over(void);
+
+/* Starts or escalates a shutdown on a signal; returns the new state */
+unsigned int shutdown_signal(unsigned int state, uint64_t *deadline);
+
+/* Slots still held and connections still open */
+unsigned int clients_left(struct shared_memory *shm);
+
+/* Counts an admitted registration in the statistics */
+void count_registration(unsigned int prio);
+
+/* Counts a served request in the statistics */
+void count_request(unsigned int slot, int status, uint64_t start);
+
+/* Opens a registered client's queues, hands it a slot and acks it */
+int start_session(struct session *sess);
+
+/* Serves a message queue client's 'caesar' instruction and replies 'fin' */
+void serve_request(void *arg);
+
+/* Handles one message on a message queue client's send queue */
+void client_event(struct client *cli);
+
+/* Re-arms a message queue client's send queue in the event loop */
+void watch_client(struct client *cli, int op);
+
+/* Ends a message queue client's session */
+void drop_client(struct client *cli, int dropped);
+
+/* Takes back the slots and queues of clients that exited without deregistering */
+void reap_clients(void);
+
+/* Returns a slot nobody will give back to the free pool */
+void release_slot(unsigned int slot);
+
+/* Nonzero if a slot is still held under an owner tag */
+int slot_held(unsigned int slot, uint64_t owner);
 
 /* Cleans up shared memory and message queues, and closes syslog */
 void clean_up(void);
 void clean_up(void)
 {
-    if (shm_unlink(SHM_NAME) == -1)
+    if (shm_unlink(ipc.shm) == -1)
       error_exit("shm_unlink in clean_up");
 
     mq_close(registration_mqd);
-    if (mq_unlink(REG_MQ_NAME) == -1)
+    if (mq_unlink(ipc.reg_mq) == -1)
       error_exit("mq_unlink in clean_up");
 
-    if (sem_unlink(SEM_MUTEX_NAME) == -1)
-      error_exit("sem_unlink in clean_up");
+    shm_unlink(ipc.stats);
 
     closelog();
 }
 
 /**
-* interrupt_handler() - registered as handler for SIGINT
+* shutdown_signal() - act on a signal read from signal_fd
+* @state: STATS_SERVING, STATS_DRAINING or STATS_HANDED_OVER
+* @deadline: when the drain gives up waiting, in stats_now_ns() time
 *
-* This function was written to ensure shared memory and message queues
-* are cleaned up when the service is interrupted with a CTRL+C from the
-* terminal.
+* The first SIGTERM or SIGINT starts a drain and a second one ends it at
+* once; SIGUSR1 starts a handover or turns a drain into one.  The state is
+* published only once registrations and connections have stopped, since
+* a service taking over waits for it.
 *
+* Return: the new state
 */
-void interrupt_handler(int signo)
+unsigned int
+shutdown_signal(unsigned int state, uint64_t *deadline)
 {
-    char c;
-    char message[35] = "Do you really want to quit? [y/n] ";
-    ssize_t bytes;
-    signal(signo, SIG_IGN);
-    bytes = write(STDOUT_FILENO, message, sizeof(message));
-    c = getchar();
-    if (( c == 'y' || c == 'Y')) {
-        clean_up();
-        exit(EXIT_SUCCESS);
-    } else {
-        signal(SIGINT, interrupt_handler);
+    struct signalfd_siginfo si;
+    unsigned int next = state;
+
+    if (read(signal_fd, &si, sizeof(si)) != (ssize_t) sizeof(si))
+        return state;
+
+    if (state == STATS_SERVING)
+        *deadline = stats_now_ns() + (uint64_t) drain_secs * 1000000000ull;
+    if (si.ssi_signo != SIGUSR1) {
+        if (state != STATS_SERVING) {
+            log_warn(RED"**Service:"RESET" Second shutdown signal, exiting with %u clients left", clients_left(shared_mem_ptr));
+            *deadline = 0;
+            return state;
+        }
+        log_info(RED"**Service:"RESET" Draining: refusing registrations, exiting once %u clients have left (at most %u s)",
+                 clients_left(shared_mem_ptr), drain_secs);
+        next = STATS_DRAINING;
+    } else if (state != STATS_HANDED_OVER) {
+        log_info(RED"**Service:"RESET" Handing over to pid %ld, exiting once %u clients have left (at most %u s)",
+                 (long) si.ssi_pid, clients_left(shared_mem_ptr), drain_secs);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, registration_mqd, NULL) == -1)
+            error_exit("epoll_ctl (registration queue)");
+        next = STATS_HANDED_OVER;
     }
-    getchar(); // Get new line character
+    if (state == STATS_SERVING)
+        conns_stop();
+    atomic_store_explicit(&stats->state, next, memory_order_release);
+    return next;
+}
+
+/**
+* clients_left() - clients a draining service is waiting for
+* @shm: the mapped request segment
+*
+* Clients hand their slots back themselves, so this also counts those
+* whose deregistration went to a service that took over.
+*
+*/
+unsigned int
+clients_left(struct shared_memory *shm)
+{
+    int free_slots = 0;
+
+    sem_getvalue(&shm->free_slots, &free_slots);
+    return shm->nslots - (unsigned int) free_slots + conns_active();
+}
+
+/**
+* take_over() - make the running service hand over to this one
+*
+* Signals the service whose statistics are published in this namespace
+* and waits until it has stopped reading the registration queue and
+* closed its socket.  From then on its clients keep their mapping of the
+* old segment, and this service may put new objects under the names.
+*
+* Return: pid of the old service, or 0 if none was running
+*/
+pid_t
+take_over(void)
+{
+    const struct service_stats *old = stats_attach(ipc.stats);
+    struct timespec tick = { 0, 1000000L };
+    unsigned int waited;
+    pid_t pid;
+
+    if (old == NULL)
+        return 0;
+    pid = old->pid;
+    if (kill(pid, SIGUSR1) == -1) {
+        if (errno == ESRCH)
+            return 0;
+        error_exit("kill (%ld)", (long) pid);
+    }
+    for (waited = 0; atomic_load_explicit(&old->state, memory_order_acquire) != STATS_HANDED_OVER; waited++) {
+        if (waited == HANDOVER_WAIT_MS || kill(pid, 0) == -1) {
+            errno = ETIMEDOUT;
+            error_exit("take_over: pid %ld did not hand over", (long) pid);
+        }
+        nanosleep(&tick, NULL);
+    }
+    return pid;
 }
 
 /**
@@ -145,41 +430,913 @@ daemonize(void)
     return 0;
 }
 
+/**
+* claim_slot() - reserve a free request slot
+* @shm: the mapped request segment
+* @free_slots: semaphore counting the free slots
+*
+* Flips the state word of a free slot from FREE to CLAIMED without
+* blocking the event loop.  Clients return slots when their sessions close.
+*
+* Return: index of the reserved slot, or -1 if every slot is in use
+*/
 int
-main(int argc, char **argv)
+claim_slot(struct shared_memory *shm, sem_t *free_slots)
 {
-    /* For shared memory */
-    struct shared_memory *shared_mem_ptr;
-    int fd_shm, fd_log;
-    char msg_buffer[256];
+    unsigned int i;
+    int expected;
+
+    if (sem_trywait (free_slots) == -1) {
+        if (errno == EAGAIN)
+            return -1;
+        error_exit ("sem_trywait: free_slots");
+    }
 
-    /* Semaphore */
-    sem_t *mutex_sem;
+    for (i = 0; i < shm->nslots; i++) {
+        expected = SLOT_FREE;
+        if (atomic_compare_exchange_strong(&shm->slots[i].state, &expected, SLOT_CLAIMED))
+            return i;
+    }
+    /* The semaphore guarantees a free slot exists */
+    error_exit("claim_slot: no free slot");
+    return -1;
+}
+
+/**
+* serve_rotx() - rotate one message in place
+* @data: the message
+* @len: its length
+* @shift: the shift, any value
+*
+* With a result cache, messages up to RCACHE_MAX_LEN bytes seen before are
+* answered from it, and identical ones served at once on other threads
+* are rotated only once.
+*
+*/
+void
+serve_rotx(char *data, size_t len, int shift)
+{
+    if (cache == NULL) {
+        rotx_buf(data, len, shift);
+        return;
+    }
+    switch (rcache_rotx(cache, data, len, shift)) {
+        case RCACHE_HIT:
+            atomic_fetch_add_explicit(&stats->cache_hits, 1, memory_order_relaxed);
+            break;
+        case RCACHE_COLLAPSED:
+            atomic_fetch_add_explicit(&stats->cache_collapsed, 1, memory_order_relaxed);
+            break;
+        case RCACHE_MISS:
+            atomic_fetch_add_explicit(&stats->cache_misses, 1, memory_order_relaxed);
+            break;
+        case RCACHE_BYPASS:
+            break;
+    }
+}
+
+/**
+* serve_batch() - rotate every message of a batch request
+* @data: the batch_header, entries and messages
+* @len: bytes at data, from the buffer's length prefix
+*
+* Each entry is read once and checked against len before its message is
+* touched, so a client rewriting the batch meanwhile (socket clients share
+* it in their own memfd) cannot move a rotation outside it.  A malformed
+* entry fails the batch; the messages before it are rotated already.
+*
+* Return: 0 on success, -1 if the batch is malformed
+*/
+int
+serve_batch(char *data, size_t len)
+{
+    struct batch_header *batch = (struct batch_header *) (void *) data;
+    struct batch_entry entry;
+    uint32_t i, count;
+
+    if (len < sizeof(*batch))
+        return -1;
+    count = batch->count;
+    if (count > (len - sizeof(*batch)) / sizeof(struct batch_entry))
+        return -1;
+    for (i = 0; i < count; i++) {
+        memcpy(&entry, &batch->entries[i], sizeof(entry));
+        if (entry.offset > len || entry.len > len - entry.offset)
+            return -1;
+        serve_rotx(data + entry.offset, entry.len, entry.shift);
+    }
+    atomic_fetch_add_explicit(&stats->batches, 1, memory_order_relaxed);
+    return 0;
+}
+
+/**
+* serve_payload() - rotate a request staged in a payload arena buffer
+* @payload: offset of the buffer in the arena
+* @kind: REQ_MESSAGE or REQ_BATCH
+* @shift: the shift for a REQ_MESSAGE
+*
+* Messages are rotated in place using the buffer's length prefix, read
+* once since the client shares the buffer.  Batches are handed to
+* serve_batch().
+*
+* Return: 0 if the request was processed, -1 if the buffer is not valid
+*/
+int
+serve_payload(uint64_t payload, unsigned int kind, int shift)
+{
+    struct arena_buf *buf;
+    uint64_t len;
+
+    buf = arena_get(&shared_mem_ptr->arena, SHM_ARENA(shared_mem_ptr), payload);
+    if (buf == NULL)
+        return -1;
+    /* The client can still write the prefix: check and use one copy */
+    len = buf->len;
+    if (len > shared_mem_ptr->arena.size - payload - sizeof(*buf))
+        return -1;
+    atomic_fetch_add_explicit(&stats->bytes_rotated, len, memory_order_relaxed);
+    if (kind == REQ_BATCH)
+        return serve_batch(buf->data, len);
+    serve_rotx(buf->data, len, shift);
+    return 0;
+}
+
+/**
+* serve_slot() - rotate the message staged in a request slot
+* @req: the client's request slot
+*
+* Messages larger than BUFSIZE, and batches, are staged in a payload arena
+* buffer and handed to serve_payload().
+*
+* Return: 0 if the request was processed, -1 if nothing valid was staged
+*/
+int
+serve_slot(struct request_slot *req)
+{
+    size_t len;
+
+    if (atomic_load_explicit(&req->state, memory_order_acquire) != SLOT_READY)
+        return -1;
+
+    /* The slot belongs to this client only, so no lock is needed */
+    if (req->payload == ARENA_NONE) {
+        if (req->kind != REQ_MESSAGE)
+            return -1;
+        req->message[BUFSIZE] = '\0';
+        len = strlen(req->message);
+        atomic_fetch_add_explicit(&stats->bytes_rotated, len, memory_order_relaxed);
+        serve_rotx(req->message, len, req->shift);
+    } else if (serve_payload(req->payload, req->kind, req->shift) == -1) {
+        return -1;
+    }
+    atomic_store_explicit(&req->state, SLOT_DONE, memory_order_release);
+    return 0;
+}
+
+/**
+* serve_conn() - rotate a request in a Unix socket client's memfd
+* @data: the payload, already checked against the mapping
+* @len: its length
+* @kind: REQ_MESSAGE or REQ_BATCH
+* @shift: the shift for a REQ_MESSAGE
+*
+* Runs on the connection thread.  Socket clients hold no slot and have no
+* registration priority, so they are counted in priority 0.
+*
+* Return: 0 on success, -1 if the request is malformed
+*/
+int
+serve_conn(char *data, size_t len, unsigned int kind, int shift)
+{
+    uint64_t start = stats_now_ns();
+    int status = -1;
+
+    atomic_fetch_add_explicit(&stats->bytes_rotated, len, memory_order_relaxed);
+    if (kind == REQ_BATCH) {
+        status = serve_batch(data, len);
+    } else if (kind == REQ_MESSAGE) {
+        serve_rotx(data, len, shift);
+        status = 0;
+    }
+    stats_hist_add(&stats->rotx, stats_now_ns() - start);
+    atomic_fetch_add_explicit(&stats->requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->sock_requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->prio_requests[0], 1, memory_order_relaxed);
+    if (status != 0)
+        atomic_fetch_add_explicit(&stats->failures, 1, memory_order_relaxed);
+    return status;
+}
+
+/**
+* count_request() - account for a served request in the statistics
+* @slot: the client's request slot
+* @status: 0 if the request was processed
+* @start: stats_now_ns() before serving it
+*
+*/
+void
+count_request(unsigned int slot, int status, uint64_t start)
+{
+    stats_hist_add(&stats->rotx, stats_now_ns() - start);
+    atomic_fetch_add_explicit(&stats->requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->prio_requests[stats_prio_class(slot_prio[slot])], 1,
+                              memory_order_relaxed);
+    if (status != 0)
+        atomic_fetch_add_explicit(&stats->failures, 1, memory_order_relaxed);
+}
+
+/**
+* ring_backlog() - ring requests submitted but not yet served
+* @shm: the mapped request segment
+*
+* What clients have pushed minus what the ring thread has served, so
+* requests held by the scheduler count too.
+*
+*/
+unsigned int
+ring_backlog(struct shared_memory *shm)
+{
+    return atomic_load_explicit(&shm->sq.tail, memory_order_relaxed) -
+           (unsigned int) atomic_load_explicit(&stats->ring_requests, memory_order_relaxed);
+}
+
+/**
+* stats_sampler() - refresh the gauges of the statistics segment
+* @arg: the mapped request segment
+*
+* Runs every STATS_SAMPLE_MS so the serving threads never make the
+* mq_getattr() and sem_getvalue() calls themselves.
+*
+*/
+void *
+stats_sampler(void *arg)
+{
+    struct shared_memory *shm = arg;
+    struct timespec period = { 0, STATS_SAMPLE_MS * 1000000L };
+    struct mq_attr attr;
+    int free_slots;
+
+    for (;;) {
+        if (mq_getattr(registration_mqd, &attr) == 0)
+            stats_gauge_max(&stats->reg_queue_depth, &stats->reg_queue_max, attr.mq_curmsgs);
+        stats_gauge_max(&stats->ring_depth, &stats->ring_depth_max, ring_backlog(shm));
+        if (sem_getvalue(slots_sem, &free_slots) == 0)
+            atomic_store_explicit(&stats->slots_in_use, shm->nslots - free_slots, memory_order_relaxed);
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+/**
+* request_cost() - bytes a ring request will rotate
+* @sqe: the request
+*
+* A request staged in its slot is charged the whole slot; one in the arena
+* is charged its buffer's length prefix.
+*
+*/
+uint32_t
+request_cost(const struct sq_entry *sqe)
+{
+    struct arena_buf *buf;
+    uint64_t len;
+
+    if (sqe->payload == ARENA_NONE)
+        return BUFSIZE;
+    buf = arena_get(&shared_mem_ptr->arena, SHM_ARENA(shared_mem_ptr), sqe->payload);
+    if (buf == NULL)
+        return BUFSIZE;
+    len = buf->len;
+    if (len < BUFSIZE)
+        return BUFSIZE;
+    return len > QOS_MAX_COST ? QOS_MAX_COST : (uint32_t) len;
+}
+
+/**
+* post_completion() - hand a ring request's completion to its client
+* @shm: the mapped request segment
+* @slot: the submitting client's slot
+* @tag: the request's tag
+* @status: 0 if it was processed
+*
+* A client that stops popping its completion ring must not stall the
+* ring thread, which serves every other client too.  A completion that
+* does not fit is parked and posted later by flush_parked().  A client
+* that lets CQ_SIZE more pile up behind a full ring is not draining at
+* all, and further completions for it are dropped, as are those of a
+* client that has died.
+*
+*/
+void
+post_completion(struct shared_memory *shm, unsigned int slot, unsigned int tag, int status)
+{
+    struct request_slot *req = &shm->slots[slot];
+    struct parked_cq *p = &parked[slot];
+    int notify = -1;
+
+    if (atomic_load_explicit(&slot_reap[slot], memory_order_acquire) != REAP_NONE) {
+        atomic_fetch_add_explicit(&req->completed, 1, memory_order_release);
+        return;
+    }
+    if (p->count == 0)
+        notify = cq_push(&req->cq, tag, status);
+    if (notify == -1) {
+        if (p->count == CQ_SIZE) {
+            log_warn(RED"**Service:"RESET" Slot %u is not reading its completions, dropping tag %u", slot, tag);
+            atomic_fetch_add_explicit(&stats->failures, 1, memory_order_relaxed);
+        } else {
+            p->cells[(p->head + p->count) % CQ_SIZE].tag = tag;
+            p->cells[(p->head + p->count) % CQ_SIZE].status = status;
+            p->count++;
+            parked_total++;
+            return;
+        }
+    }
+    atomic_fetch_add_explicit(&req->completed, 1, memory_order_release);
+
+    /* The client waits on its receive queue's fd */
+    if (notify == 1)
+        client_notify(clients, slot);
+}
+
+/**
+* flush_parked() - post parked completions that now fit
+* @shm: the mapped request segment
+*
+* Completions parked for a slot that has been handed back, or whose client
+* has died, are thrown away.
+*
+*/
+void
+flush_parked(struct shared_memory *shm)
+{
+    struct request_slot *req;
+    struct parked_cq *p;
+    unsigned int i;
+    int notify;
+
+    for (i = 0; i < shm->nslots && parked_total > 0; i++) {
+        p = &parked[i];
+        req = &shm->slots[i];
+        while (p->count > 0) {
+            if (atomic_load_explicit(&req->state, memory_order_acquire) == SLOT_FREE ||
+                atomic_load_explicit(&slot_reap[i], memory_order_acquire) != REAP_NONE)
+                notify = 0;
+            else if ((notify = cq_push(&req->cq, p->cells[p->head].tag, p->cells[p->head].status)) == -1)
+                break;
+            p->head = (p->head + 1) % CQ_SIZE;
+            p->count--;
+            parked_total--;
+            atomic_fetch_add_explicit(&req->completed, 1, memory_order_release);
+            if (notify == 1)
+                client_notify(clients, i);
+        }
+    }
+}
+
+/**
+* free_released() - reset and free the slots handed back by release_slot()
+* @shm: the mapped request segment
+*
+* Completions parked or left on a slot's ring are dropped, so the next
+* client does not see them.  The payload arena buffers the client still
+* held, staged in the slot or allocated for its asynchronous requests and
+* streams, are freed; nothing serves the slot any more.
+*
+*/
+void
+free_released(struct shared_memory *shm)
+{
+    struct request_slot *req;
+    struct parked_cq *p;
+    unsigned int i, n;
+
+    for (i = 0; i < shm->nslots; i++) {
+        if (atomic_load_explicit(&slot_reap[i], memory_order_acquire) != REAP_RELEASE)
+            continue;
+        req = &shm->slots[i];
+        p = &parked[i];
+        parked_total -= p->count;
+        p->head = 0;
+        p->count = 0;
+
+        n = 0;
+        if (req->payload != ARENA_NONE) {
+            arena_free(&shm->arena, SHM_ARENA(shm), req->payload);
+            req->payload = ARENA_NONE;
+            n++;
+        }
+        n += arena_free_owner(&shm->arena, SHM_ARENA(shm), i);
+        if (n > 0)
+            log_info(RED"**Service:"RESET" Freed %u payload arena buffers held by slot %u", n, i);
+
+        cq_init(&req->cq);
+        atomic_store_explicit(&req->sq_claim, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot_reap[i], REAP_NONE, memory_order_relaxed);
+        atomic_store_explicit(&req->state, SLOT_FREE, memory_order_release);
+        sem_post(slots_sem);
+        atomic_fetch_sub_explicit(&releases_pending, 1, memory_order_relaxed);
+    }
+}
+
+/**
+* skip_dead_claim() - drop a cell that blocks the submission ring for good
+* @shm: the mapped request segment
+* @pos: the stalled cell, from sq_stalled()
+*
+* Only a client the reaper has found dead is taken to have abandoned the
+* cell, and only if no live client's claim word names it: a live client
+* that claimed it fills it shortly.  The lost request counts as completed
+* for its slot, so the slot's quarantine can end.
+*
+*/
+void
+skip_dead_claim(struct shared_memory *shm, unsigned int pos)
+{
+    unsigned int i;
+    int dead = -1;
+
+    for (i = 0; i < shm->nslots; i++) {
+        if (atomic_load_explicit(&shm->slots[i].sq_claim, memory_order_acquire) != pos + 1)
+            continue;
+        if (atomic_load_explicit(&slot_reap[i], memory_order_acquire) == REAP_NONE)
+            return;
+        if (dead == -1)
+            dead = i;
+    }
+    if (dead == -1 || sq_skip(&shm->sq) == -1)
+        return;
+    log_warn(RED"**Service:"RESET" Skipping submission %u, claimed by slot %d before its client died", pos, dead);
+    atomic_fetch_add_explicit(&shm->slots[dead].completed, 1, memory_order_release);
+}
+
+/**
+* ring_consumer() - serve requests submitted on the shared memory ring
+* @arg: the mapped request segment
+*
+* Moves everything submitted so far off the submission ring into the
+* scheduler, then serves the one request the scheduler picks: rotates it
+* and posts its tag on the submitting slot's completion ring.  A request
+* either names its own arena buffer, so a client can have many in flight,
+* or is staged in the slot itself.  While requests keep arriving no system
+* call is made on either side; the thread sleeps on the ring's futex only
+* once the scheduler is empty and it has spun on an empty ring for a while.
+* While completions are parked it naps instead, to retry them.  The
+* event loop kicks it awake to free slots, see release_slot(), and when a
+* dead ring client may have left a cell claimed but empty, which would
+* stall the ring for everyone.
+*
+*/
+void *
+ring_consumer(void *arg)
+{
+    struct shared_memory *shm = arg;
+    struct request_slot *req;
+    struct qos_req next;
+    struct sq_entry sqe;
+    struct timespec nap = { 0, PARKED_RETRY_US * 1000L };
+    int status, pick;
+    unsigned int cls, pos;
+    uint64_t now, start;
+
+    for (;;) {
+        if (atomic_load_explicit(&releases_pending, memory_order_acquire) > 0)
+            free_released(shm);
+        if (parked_total > 0)
+            flush_parked(shm);
+        now = stats_now_ns();
+        while (!qos_full(qos) && sq_pop(&shm->sq, &sqe) == 0) {
+            if (sqe.slot < shm->nslots)
+                qos_add(qos, &sqe, slot_prio[sqe.slot], request_cost(&sqe), now);
+        }
+        if (!qos_full(qos) && sq_stalled(&shm->sq, &pos))
+            skip_dead_claim(shm, pos);
+        if ((pick = qos_next(qos, now, &next)) == -1) {
+            if (parked_total > 0)
+                nanosleep(&nap, NULL);
+            else
+                sq_wait(&shm->sq);
+            continue;
+        }
+        cls = stats_prio_class(slot_prio[next.sqe.slot]);
+        atomic_fetch_add_explicit(&stats->prio_wait_ns[cls], now - next.queued, memory_order_relaxed);
+        if (pick == QOS_URGENT)
+            atomic_fetch_add_explicit(&stats->sched_urgent, 1, memory_order_relaxed);
+
+        req = &shm->slots[next.sqe.slot];
+        start = stats_now_ns();
+        if (next.sqe.payload == ARENA_NONE)
+            status = serve_slot(req);
+        else
+            status = serve_payload(next.sqe.payload, next.sqe.kind, next.sqe.shift);
+        count_request(next.sqe.slot, status, start);
+        atomic_fetch_add_explicit(&stats->ring_requests, 1, memory_order_relaxed);
+        if (next.sqe.deadline != 0 && stats_now_ns() > next.sqe.deadline)
+            atomic_fetch_add_explicit(&stats->sched_late, 1, memory_order_relaxed);
+        post_completion(shm, next.sqe.slot, next.sqe.tag, status);
+    }
+    return NULL;
+}
+
+/**
+* send_busy() - turn a registration away
+* @name: base name of the client's queues
+* @prio: registration priority
+*
+* The client backs off and registers again.
+*
+*/
+void
+send_busy(const char *name, unsigned int prio)
+{
+    atomic_fetch_add_explicit(&stats->busy_replies, 1, memory_order_relaxed);
+    send_reply(name, "busy", prio);
+}
+
+/**
+* send_stale() - send a registration for a replaced segment back
+* @name: base name of the client's queues
+* @prio: registration priority
+*
+* The client mapped a segment that has since been replaced by a service
+* taking over; it maps the current one and registers again.
+*
+*/
+void
+send_stale(const char *name, unsigned int prio)
+{
+    send_reply(name, "stale", prio);
+}
+
+/**
+* send_reply() - answer a client that has no session
+* @name: base name of the client's queues
+* @reply: 'busy' or 'stale'
+* @prio: message priority
+*
+* The client's receive queue is opened non-blocking just for the reply, so
+* a client that has already gone cannot stall the event loop.
+*
+*/
+void
+send_reply(const char *name, const char *reply, unsigned int prio)
+{
+    char queue[BUFSIZE + 32];
+    mqd_t mqd;
+
+    snprintf(queue, sizeof(queue), "/mq_received_by_%s", name);
+    mqd = mq_open(queue, O_WRONLY | O_NONBLOCK);
+    if (mqd == (mqd_t) -1) {
+        log_warn(RED"**Service:"RESET" Cannot open '%s' to send %s", queue, reply);
+        return;
+    }
+    if (mq_send(mqd, reply, strlen(reply), prio) == -1)
+        log_warn(RED"**Service:"RESET" mq_send %s to '%s' failed", reply, name);
+    mq_close(mqd);
+}
+
+/**
+* count_registration() - count an admitted registration
+* @prio: registration priority
+*
+*/
+void
+count_registration(unsigned int prio)
+{
+    atomic_fetch_add_explicit(&stats->registrations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->prio_registrations[stats_prio_class(prio)], 1, memory_order_relaxed);
+}
+
+/**
+* start_session() - set up a newly registered client
+* @sess: the registration
+*
+* Reserves a request slot, opens the client's queues through the client
+* table and acks the client.  Message queue clients' send queues join the
+* event loop; ring clients submit through shared memory from then on.
+* Failures on a client's queues only drop that client.
+*
+* Return: 0 if the registration was handled, -1 if no slot is free yet
+*/
+int
+start_session(struct session *sess)
+{
+    struct client *cli;
+    char ack[32];
+    int slot;
+
+    /* 2) Reserve a request slot; the registration waits if none is free */
+    slot = claim_slot(shared_mem_ptr, slots_sem);
+    if (slot == -1)
+        return -1;
+    shared_mem_ptr->slots[slot].owner = ++slot_owners;
+    stats_hist_add(&stats->sem_wait, stats_now_ns() - sess->received);
+
+    /* 3) Open the client queues named by the registration */
+    log_info(RED"**Service:"RESET" Opening client queues for '%s'", sess->name);
+    cli = client_register(clients, sess->name, (sess->flags & REG_RING) != 0, sess->pid);
+    if (cli == NULL) {
+        log_warn(RED"**Service:"RESET" Cannot open the queues of '%s', dropping client", sess->name);
+        atomic_fetch_add_explicit(&stats->dropped_clients, 1, memory_order_relaxed);
+        goto free_slot;
+    }
+    slot_prio[slot] = sess->prio;
+    client_set_slot(clients, cli, slot, shared_mem_ptr->slots[slot].owner);
+
+    /* 4) Send 'ack <slot>' reply on client receive queue */
+    snprintf(ack, sizeof(ack), "ack %d", slot);
+    log_debug(GREEN"++/mq_received_by_%s Queue:"RESET" Sending %s", sess->name, ack);
+    if (mq_send(cli->mqd_receive, ack, strlen(ack), sess->prio) == -1) {
+        log_warn(RED"**Service:"RESET" mq_send ack to '%s' failed, dropping client", sess->name);
+        drop_client(cli, 1);
+        goto free_slot;
+    }
+
+    /* 5) Wait for 'caesar' instructions from message queue clients */
+    if (!cli->ring)
+        watch_client(cli, EPOLL_CTL_ADD);
+    return 0;
+
+free_slot:
+    /* The client never learned its slot, so it cannot give it back */
+    release_slot(slot);
+    return 0;
+}
+
+/**
+* release_slot() - put a slot back in the free pool for its client
+* @slot: a slot whose client will never free it
+*
+* The slot's completion ring and parked completions belong to the ring
+* thread, so the slot is handed to it and freed by free_released(); it
+* joins the free pool once the ring thread has woken up.
+*
+*/
+void
+release_slot(unsigned int slot)
+{
+    atomic_store_explicit(&slot_reap[slot], REAP_RELEASE, memory_order_relaxed);
+    atomic_fetch_add_explicit(&releases_pending, 1, memory_order_release);
+    sq_kick(&shared_mem_ptr->sq);
+}
+
+/**
+* slot_held() - tell whether a reaped client still held its slot
+* @slot: the client's request slot
+* @owner: the owner tag it was handed out with
+*
+* A client that closes its session frees the slot itself before it
+* deregisters, and may exit before the event loop has read the
+* deregistration.  Its slot is then free, or already handed out again
+* under a new tag, and must not be released a second time.
+*
+* Return: nonzero if the slot is not free and still has that owner tag
+*/
+int
+slot_held(unsigned int slot, uint64_t owner)
+{
+    struct request_slot *req = &shared_mem_ptr->slots[slot];
+
+    return atomic_load_explicit(&req->state, memory_order_acquire) != SLOT_FREE && req->owner == owner;
+}
+
+/**
+* reap_clients() - take back what clients that died in a session held
+*
+* Runs on the event loop every REAP_INTERVAL_MS, after the events it
+* fetched were handled.  Queues are unlinked by client_reap().  A message
+* queue client's slot is free again at once, since only the event loop
+* and a worker serve its requests.  A ring client's slot is held back
+* until the ring thread has completed everything it submitted; its
+* completions are discarded meanwhile.  Either way the ring thread frees
+* the payload arena buffers the client left, see release_slot().  A slot the client gave
+* back before it exited is left alone.
+*
+*/
+void
+reap_clients(void)
+{
+    struct reaped_client dead[REAP_BATCH];
+    struct request_slot *req;
+    uint64_t now = stats_now_ns();
+    unsigned int i, n;
+
+    n = client_reap(clients, dead, REAP_BATCH);
+    for (i = 0; i < n; i++) {
+        log_warn(RED"**Service:"RESET" Client pid %ld exited without deregistering, taking back slot %d",
+                 (long) dead[i].pid, dead[i].slot);
+        atomic_fetch_add_explicit(&stats->reaped_clients, 1, memory_order_relaxed);
+        if (dead[i].slot < 0)
+            continue;
+        if (!slot_held(dead[i].slot, dead[i].owner)) {
+            log_info(RED"**Service:"RESET" Slot %d was given back before the client exited", dead[i].slot);
+            continue;
+        }
+        if (dead[i].ring) {
+            slot_reclaim[dead[i].slot] = now;
+            atomic_store_explicit(&slot_reap[dead[i].slot], REAP_DEAD, memory_order_release);
+            sq_kick(&shared_mem_ptr->sq);
+        } else
+            release_slot(dead[i].slot);
+    }
+
+    for (i = 0; i < shared_mem_ptr->nslots; i++) {
+        if (slot_reclaim[i] == 0)
+            continue;
+        req = &shared_mem_ptr->slots[i];
+        if (atomic_load_explicit(&req->completed, memory_order_acquire) !=
+            atomic_load_explicit(&req->submitted, memory_order_relaxed)) {
+            if (now - slot_reclaim[i] < (uint64_t) stuck_secs * 1000000000ull)
+                continue;
+            log_warn(RED"**Service:"RESET" Slot %u still has requests of a dead client after %u s, reusing it", i, stuck_secs);
+            atomic_store_explicit(&req->completed, atomic_load_explicit(&req->submitted, memory_order_relaxed),
+                                  memory_order_relaxed);
+        }
+        slot_reclaim[i] = 0;
+        release_slot(i);
+    }
+}
+
+/**
+* watch_client() - arm a client's send queue for one event
+* @cli: a message queue client
+* @op: EPOLL_CTL_ADD for a new client, EPOLL_CTL_MOD afterwards
+*
+* Send queues are watched with EPOLLONESHOT: once a message is read the
+* queue stays quiet until the message has been answered, so a request
+* served on a worker never races with the next one from the same client.
+*
+*/
+void
+watch_client(struct client *cli, int op)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = cli;
+    if (epoll_ctl(epoll_fd, op, cli->mqd_send, &ev) == -1)
+      error_exit("epoll_ctl (/mq_sent_from_%s)", cli->name);
+}
+
+/**
+* drop_client() - end a message queue client's session
+* @cli: the client
+* @dropped: nonzero if the session ended on an error rather than 'bye'
+*
+* Closing the client's queues also takes its send queue out of the epoll
+* set.
+*
+*/
+void
+drop_client(struct client *cli, int dropped)
+{
+    if (dropped)
+        atomic_fetch_add_explicit(&stats->dropped_clients, 1, memory_order_relaxed);
+    log_info(RED"**Service:"RESET" Session for '%s' finished", cli->name);
+    client_release(clients, cli);
+}
+
+/**
+* serve_request() - rotate a message queue client's slot and reply 'fin'
+* @arg: the client
+*
+* Runs on the event loop for requests staged in the slot itself and on a
+* worker thread for requests staged in the payload arena, which may be
+* large.  Re-arms the client's send queue once 'fin' is sent, and only
+* then lets the reaper have the client.
+*
+*/
+void
+serve_request(void *arg)
+{
+    struct client *cli = arg;
+    struct request_slot *req = &shared_mem_ptr->slots[cli->slot];
+    uint64_t start;
+    int status;
+
+    /* 6) Process Data in the client's slot (cipher/plaintext and shift value) */
+    if (req->payload == ARENA_NONE)
+        log_debug(RED"**Service:"RESET" rotx entered with: %s", req->message);
+    else
+        log_debug(RED"**Service:"RESET" rotx entered with arena buffer at offset %lu",
+                  (unsigned long) req->payload);
+    start = stats_now_ns();
+    status = serve_slot(req);
+    count_request(cli->slot, status, start);
+    atomic_fetch_add_explicit(&stats->mq_requests, 1, memory_order_relaxed);
+    if (status == 0)
+        log_debug(RED"**Service:"RESET" rotx returned for slot %d", cli->slot);
+    else
+        log_warn(RED"**Service:"RESET" slot %d has no request staged", cli->slot);
+
+    /* 7) Send 'fin' message on received by client queue to let client know the data is ready */
+    log_debug(GREEN"++/mq_received_by_%s Queue:"RESET" Sending fin", cli->name);
+    if (mq_send(cli->mqd_receive, "fin", strlen("fin"), cli->prio) == -1) {
+        log_warn(RED"**Service:"RESET" mq_send fin to '%s' failed, dropping client", cli->name);
+        drop_client(cli, 1);
+        return;
+    }
+    watch_client(cli, EPOLL_CTL_MOD);
+    atomic_fetch_sub_explicit(&cli->busy, 1, memory_order_release);
+}
+
+/**
+* client_event() - handle a readable message queue client's send queue
+* @cli: the client
+*
+* Reads one instruction.  'caesar' is served on the spot when the request
+* is staged in the slot, or handed to a worker when it is in the payload
+* arena; 'bye' ends the session.  Anything else is ignored.
+*
+*/
+void
+client_event(struct client *cli)
+{
+    ssize_t numRead;
+
+    numRead = mq_receive(cli->mqd_send, cli->buffer, cli->msgsize, &cli->prio);
+    if (numRead == -1) {
+        if (errno == EAGAIN) {
+            watch_client(cli, EPOLL_CTL_MOD);
+            return;
+        }
+        log_warn(RED"**Service:"RESET" mq_receive on '/mq_sent_from_%s' failed, dropping client", cli->name);
+        drop_client(cli, 1);
+        return;
+    }
+    log_debug(GREEN"++/mq_sent_from_%s Queue:"RESET" Read %ld bytes; priority = %u: %.*s",
+              cli->name, (long) numRead, cli->prio, (int) numRead, cli->buffer);
+
+    if (numRead == (ssize_t) strlen("bye") && strncmp("bye", cli->buffer, strlen("bye")) == 0) {
+        atomic_fetch_add_explicit(&stats->deregistrations, 1, memory_order_relaxed);
+        drop_client(cli, 0);
+        return;
+    }
+    if (numRead != (ssize_t) strlen("caesar") || strncmp("caesar", cli->buffer, strlen("caesar")) != 0) {
+        watch_client(cli, EPOLL_CTL_MOD);
+        return;
+    }
+
+    /* A count, as the next request may be read before serve_request() is done with this one */
+    atomic_fetch_add_explicit(&cli->busy, 1, memory_order_relaxed);
+    if (shared_mem_ptr->slots[cli->slot].payload == ARENA_NONE)
+        serve_request(cli);
+    else
+        work_submit(pool, cli);
+}
+
+int
+main(int argc, char **argv)
+{
+    int fd_shm;
+    unsigned int nslots, nworkers, i;
+    unsigned int placement = 0;
+    int node = -1, node_cpus = 0;
+    size_t arena_size, slots_size, shm_size;
+    pthread_t ring_thread, stats_thread;
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct session *sess, *pending = NULL, **pending_tail = &pending, **link;
+    struct session next;
+    struct obj_pool *sessions;
+    unsigned int pending_count = 0;
+    struct registration *reg;
+    int nready, e;
+    unsigned int state = STATS_SERVING;
+    uint64_t drain_deadline = 0, next_reap = 0;
+    sigset_t shutdown_signals;
+    pid_t predecessor = 0;
 
     /* For registration queue */
     void *reg_buffer;
-    struct mq_attr reg_attr, *reg_attrp;
+    struct mq_attr reg_attr;
     int reg_flags;
     mode_t reg_perms;
     ssize_t numRead;
-    ssize_t bytes;
     unsigned int reg_prio;// on Linux the max priority is 32,768; see sysconf(_SC_MQ_PRIO_MAX);
 
-    /* For client queues */
-    mqd_t client_mqd;
-    struct mq_attr cli_attr, *cli_attrp;
-    int cli_flags;
-    void *cli_buffer;
-    mode_t cli_perms;
-    unsigned int cli_prio;
-    char *client_q_receive_name;
-    char *client_q_send_name;
-    char client_q_name[BUFSIZE];
-
     int opt;
+    int daemonized = 0;
+    const char *log_target = NULL;
+    unsigned int weights[QOS_CLASSES];
+    unsigned int cache_entries = 0;
+    const char *ns = ipc_ns_default();
+    int replace = 0;
+
+    nslots = DEFAULT_NSLOTS;
+    arena_size = (size_t) DEFAULT_ARENA_MB << 20;
+    nworkers = 0;
+    max_inflight = SQ_SIZE;
+    qos_default_weights(weights);
+    drain_secs = DEFAULT_DRAIN_SECS;
+    stuck_secs = DEFAULT_STUCK_SECS;
 
-    // Register interrupt_handler to catch SIGINT from CTRL+C interrupts
-    signal(SIGINT, interrupt_handler);
+    /* Blocked before any thread starts, so only signal_fd ever sees them */
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGTERM);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL) != 0)
+      error_exit("pthread_sigmask");
 
     /* Parse Command-Line Multiple-character Arguments */
     if (argc > 1 && !strcmp(argv[1],"--help")) {
@@ -191,7 +1348,8 @@ main(int argc, char **argv)
     }
 
     /* Parse Command-Line Flag Arguments */
-    while ((opt = getopt(argc, argv, "hd")) != -1) {
+    max_pending = nslots;
+    while ((opt = getopt(argc, argv, "hdn:w:a:l:W:Q:I:pHN:C:x:T:Rk:")) != -1) {
         switch (opt) {
             case 'h':
                 usage_error(argv[0], SERVICE);
@@ -199,45 +1357,202 @@ main(int argc, char **argv)
                 break;
             case 'd': /* daemonize */
                 daemonize();
+                daemonized = 1;
+                break;
+            case 'l': /* log to 'stderr', 'syslog' or a file */
+                log_target = optarg;
+                break;
+            case 'n': /* number of request slots */
+                if (atoi(optarg) < 1) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                nslots = atoi(optarg);
+                max_pending = nslots;
+                break;
+            case 'a': /* payload arena size in MiB */
+                if (atoi(optarg) < 0) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                arena_size = (size_t) atoi(optarg) << 20;
+                break;
+            case 'w': /* number of worker threads */
+                if (atoi(optarg) < 1) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                nworkers = atoi(optarg);
+                break;
+            case 'W': /* scheduler weights of priority classes 0, 1, ... */
+                if (qos_parse_weights(optarg, weights) == -1) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'Q': /* registrations allowed to wait for a slot */
+                if (atoi(optarg) < 0) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                max_pending = atoi(optarg);
+                break;
+            case 'I': /* ring requests in flight before registrations are refused */
+                if (atoi(optarg) < 1) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                max_inflight = atoi(optarg);
+                break;
+            case 'p': /* fault in and lock the request segment up front */
+                placement |= PLACE_PREFAULT;
+                break;
+            case 'H': /* transparent huge pages for the payload arena */
+                placement |= PLACE_HUGE;
+                break;
+            case 'N': /* NUMA node for the segment and every service thread */
+                if (atoi(optarg) < 0) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                node = atoi(optarg);
+                break;
+            case 'C': /* result cache entries, 0 for none */
+                if (atoi(optarg) < 0) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                cache_entries = atoi(optarg);
+                break;
+            case 'x': /* namespace of this instance's IPC objects */
+                ns = optarg;
+                break;
+            case 'T': /* seconds to wait for clients when shutting down */
+                if (atoi(optarg) < 0) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                drain_secs = atoi(optarg);
+                break;
+            case 'R': /* take over from the service running in this namespace */
+                replace = 1;
+                break;
+            case 'k': /* seconds a dead ring client's slot waits for its requests */
+                if (atoi(optarg) <= 0) {
+                    usage_error(argv[0], SERVICE);
+                    return EXIT_FAILURE;
+                }
+                stuck_secs = atoi(optarg);
                 break;
             default:
                 usage_error(argv[0], SERVICE);
                 return EXIT_FAILURE;
         }
     }
+    if (ipc_names_init(&ipc, ns) == -1) { /* -x, or $CAESAR_NAMESPACE */
+        usage_error(argv[0], SERVICE);
+        return EXIT_FAILURE;
+    }
+
+    /* Threads inherit the CPU mask, so bind before any of them start */
+    if (node >= 0 && (node_cpus = placement_bind_cpus(node)) == -1)
+        error_exit("NUMA node %d has no CPUs", node);
+    if (nworkers == 0)
+        nworkers = node_cpus > 0 ? (unsigned int) node_cpus : default_worker_count();
+
+    /* Log records are written by a background thread; with -d stderr is /dev/null */
+    if (log_target == NULL)
+        log_target = daemonized ? "syslog" : "stderr";
+    if (!strcmp(log_target, "syslog")) {
+        log_open(SINK_SYSLOG, NULL);
+    } else if (!strcmp(log_target, "stderr")) {
+        log_open(SINK_STDERR, NULL);
+    } else if (log_open(SINK_FILE, log_target) == -1) {
+        error_exit("open (%s)", log_target);
+    }
 
-    // Semaphore for mutual exclusion - initial value is 0
-    if ((mutex_sem = sem_open (SEM_MUTEX_NAME, O_CREAT, 0660, 0)) == SEM_FAILED)
-      error_exit("sem_open");
+    /* The running service stops registering before its names are replaced */
+    if (replace && (predecessor = take_over()) != 0)
+        log_info(RED"**Service:"RESET" Took over from pid %ld, which is draining", (long) predecessor);
 
-    /* Creates a shared memory object in /dev/shm on Linux and maps into shared memory */
-    fprintf(stderr, RED"**Service:"RESET" Creating POSIX Shared Memory named '%s' at /dev/shm (on Linux)\n", SHM_NAME);
-    if ((fd_shm = shm_open (SHM_NAME, O_CREAT | O_RDWR, 0660)) == -1)
+    /*
+    * Creates a shared memory object in /dev/shm on Linux and maps into shared memory.
+    * A segment left under the name, by a crash or a service handing over, is
+    * unlinked first; clients still mapping it keep it alive until they leave.
+    */
+    log_info(RED"**Service:"RESET" Creating POSIX Shared Memory named '%s' with %u slots and a %zu MiB arena at /dev/shm (on Linux)", ipc.shm, nslots, arena_size >> 20);
+    shm_unlink(ipc.shm);
+    if ((fd_shm = shm_open (ipc.shm, O_CREAT | O_EXCL | O_RDWR, 0660)) == -1)
       error_exit("shm_open");
 
-    if (ftruncate (fd_shm, sizeof (struct shared_memory)) == -1)
+    /* A huge page backed arena must start on a huge page boundary */
+    slots_size = (placement & PLACE_HUGE) ? SHM_HUGE_SLOTS_SIZE(nslots) : SHM_SLOTS_SIZE(nslots);
+    shm_size = slots_size + arena_size;
+    if (ftruncate (fd_shm, shm_size) == -1)
       error_exit("ftruncate");
 
-    if (( shared_mem_ptr = mmap(NULL, sizeof (struct shared_memory), PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0)) == MAP_FAILED)
+    if (( shared_mem_ptr = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0)) == MAP_FAILED)
       error_exit("mmap");
-    fprintf(stderr, "Shared memory address is %p\n", (void *)shared_mem_ptr);
+    log_info("Shared memory address is %p", (void *)shared_mem_ptr);
 
-    /* Initialize shift value to 0 (no shifting occurs) */
-    shared_mem_ptr -> shift = 0;
+    /* Pages are placed when first touched, so this comes before any initialization */
+    placement_apply(shared_mem_ptr, shm_size, slots_size, placement, node);
+    if (placement != 0 || node >= 0)
+        log_info(RED"**Service:"RESET" Segment placement:%s%s, NUMA node %d",
+                 (placement & PLACE_PREFAULT) ? " prefaulted" : "",
+                 (placement & PLACE_HUGE) ? " huge pages" : "", node);
 
-    /* Unlock mutex semaphore now that shared memory set up is complete and ready for use */
-    if (sem_post (mutex_sem) == -1)
-      error_exit ("sem_post: mutex_sem");
+    clients = client_table_create(nslots, MQ_MSGSIZE);
+    slot_prio = calloc(nslots, sizeof(*slot_prio));
+    slot_reclaim = calloc(nslots, sizeof(*slot_reclaim));
+    slot_reap = calloc(nslots, sizeof(*slot_reap));
+    parked = calloc(nslots, sizeof(*parked));
+    if (slot_prio == NULL || slot_reclaim == NULL || slot_reap == NULL || parked == NULL)
+      error_exit("calloc (slot_prio)");
+
+    /* All slots start out free with a shift of 0 (no shifting occurs) */
+    shared_mem_ptr->nslots = nslots;
+    shared_mem_ptr->placement = placement;
+    shared_mem_ptr->generation = ((uint64_t) getpid() << 32) ^ stats_now_ns();
+    atomic_init(&shared_mem_ptr->heartbeat, 0);
+    if (sem_init(&shared_mem_ptr->free_slots, 1, nslots) == -1)
+      error_exit("sem_init (free_slots)");
+    slots_sem = &shared_mem_ptr->free_slots;
+    for (i = 0; i < nslots; i++) {
+        atomic_init(&shared_mem_ptr->slots[i].state, SLOT_FREE);
+        atomic_init(&shared_mem_ptr->slots[i].submitted, 0);
+        atomic_init(&shared_mem_ptr->slots[i].completed, 0);
+        atomic_init(&shared_mem_ptr->slots[i].sq_claim, 0);
+        shared_mem_ptr->slots[i].shift = 0;
+        shared_mem_ptr->slots[i].kind = REQ_MESSAGE;
+        shared_mem_ptr->slots[i].payload = ARENA_NONE;
+        cq_init(&shared_mem_ptr->slots[i].cq);
+    }
+    sq_init(&shared_mem_ptr->sq);
+
+    /* Large messages are staged in the payload arena after the slots */
+    shared_mem_ptr->arena_offset = slots_size;
+    if (arena_init(&shared_mem_ptr->arena, SHM_ARENA(shared_mem_ptr), arena_size) == -1)
+        error_exit("pthread_mutex_init (arena)");
+    log_info(RED"**Service:"RESET" rotx kernel is '%s'", rotx_kernel_name());
+
+    /* Counters and histograms for caesar_stats, at /dev/shm on Linux */
+    stats = stats_create(ipc.stats, nslots, rotx_kernel_name());
+
+    /* Short repeated messages can be answered without rotating them again */
+    if (cache_entries > 0) {
+        log_info(RED"**Service:"RESET" Caching the results of up to %u messages of at most %d bytes",
+                 cache_entries, RCACHE_MAX_LEN);
+        cache = rcache_create(cache_entries);
+    }
 
-    /* Create a message queue for clients to register with the service */
-    fprintf(stderr, RED"**Service:"RESET" Creating POSIX Message Queue named '%s' at /dev/mqueue (on Linux)\n", REG_MQ_NAME);
-    reg_attrp = NULL;
+    /* Create a message queue for clients to register with the service; one handed over is adopted */
+    log_info(RED"**Service:"RESET" Creating POSIX Message Queue named '%s' at /dev/mqueue (on Linux)", ipc.reg_mq);
     reg_attr.mq_maxmsg = 10;
-    reg_attr.mq_msgsize = 2048;
-    reg_attrp = &reg_attr;
-    reg_flags = O_CREAT | O_RDWR;
+    reg_attr.mq_msgsize = MQ_MSGSIZE;
+    reg_flags = O_CREAT | O_RDWR | O_NONBLOCK;
     reg_perms = S_IRUSR | S_IWUSR;
-    registration_mqd = mq_open(REG_MQ_NAME, reg_flags, reg_perms, &reg_attr);
+    registration_mqd = mq_open(ipc.reg_mq, reg_flags, reg_perms, &reg_attr);
     if (registration_mqd == (mqd_t) -1)
       error_exit("mq_open (registration) line 221");
 
@@ -248,105 +1563,199 @@ main(int argc, char **argv)
     if (reg_buffer == NULL)
       error_exit("malloc (reg_buffer)");
 
-    /* Set up Client message queue variables */
-    cli_attrp = NULL;
-    cli_attr.mq_maxmsg = 10;
-    cli_attr.mq_msgsize = 2048;
-    cli_attrp = &cli_attr;
-    cli_flags = O_RDWR;
-    cli_perms = S_IRUSR | S_IWUSR;
-    cli_prio=0; // on Linux the max priority is 32,768; see sysconf(_SC_MQ_PRIO_MAX);
-
-    fprintf (stderr, RED"**Service:"RESET" Entering main event loop.\n");
-    /* Main Event Loop */
-    while (1)
+    /* Admission control bounds the waiting registrations, so their pool never grows */
+    sessions = obj_pool_create(sizeof(struct session), max_pending);
+    if (sessions == NULL)
+        error_exit("obj_pool_create (sessions)");
+
+    /* Requests on the ring transport are served by their own thread, in scheduler order */
+    qos = qos_create(weights);
+    if (pthread_create(&ring_thread, NULL, ring_consumer, shared_mem_ptr) != 0)
+      error_exit("pthread_create (ring_consumer)");
+    if (pthread_create(&stats_thread, NULL, stats_sampler, shared_mem_ptr) != 0)
+      error_exit("pthread_create (stats_sampler)");
+
+    /* Unix socket clients are served by their own thread, in their own memfds */
+    if (conns_start(serve_conn, ipc.sock) == -1)
+        log_warn(RED"**Service:"RESET" Socket '@%s' is taken; is another service running? Unix socket transport disabled", ipc.sock);
+
+    /* Requests staged in the payload arena are rotated off the event loop */
+    log_info(RED"**Service:"RESET" Starting %u worker threads", nworkers);
+    pool = work_pool_create(nworkers, serve_request);
+
+    /* On Linux a message queue descriptor is a file descriptor epoll can watch */
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+      error_exit("epoll_create1");
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, registration_mqd, &ev) == -1)
+      error_exit("epoll_ctl (registration queue)");
+    if ((signal_fd = signalfd(-1, &shutdown_signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+      error_exit("signalfd");
+    ev.data.ptr = &signal_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) == -1)
+      error_exit("epoll_ctl (signalfd)");
+
+    if (ipc.ns[0] != '\0')
+        log_info(RED"**Service:"RESET" Serving namespace '%s'", ipc.ns);
+    log_info(RED"**Service:"RESET" Entering main event loop.");
+    /* Main Event Loop, left once a drain has seen every client go */
+    while (state == STATS_SERVING || (clients_left(shared_mem_ptr) > 0 && stats_now_ns() < drain_deadline))
     {
-        /* 1) Check Registration Queue for new Clients - this is a blocking call */
-        numRead = mq_receive(registration_mqd, reg_buffer, reg_attr.mq_msgsize, &reg_prio);
-        if (numRead == -1)
-          error_exit("mq_receive (registration queue)");
-
-        fprintf(stderr, GREEN"++%s Queue:"RESET" Read %ld bytes; priority = %u\n", REG_MQ_NAME, (long) numRead, reg_prio);
-        if ((bytes = write(STDOUT_FILENO, reg_buffer, numRead)) == -1)
-          error_exit("write (registration reg_buffer)");
-        bytes = write(STDOUT_FILENO, "\n", 1);
-
-        memset(client_q_name, '\0', BUFSIZE);
-        strncpy(client_q_name, (char *)reg_buffer, BUFSIZE);
-
-        /* 2) Set client message queue names by the name provided on the registration queue */
-        client_q_send_name = malloc(BUFSIZE);
-        client_q_receive_name = malloc(BUFSIZE);
-        strncpy(client_q_receive_name, "/mq_received_by_", strlen("/mq_received_by_"));
-        strcat(client_q_receive_name, client_q_name);
-        strncpy(client_q_send_name, "/mq_sent_from_", strlen("/mq_sent_from_"));
-        strcat(client_q_send_name, client_q_name);
-
-        fprintf(stderr, RED"**Service:"RESET" Opening client queue, '%s'\n", client_q_receive_name);
-        /* Open received by client queue to send an ack */
-        client_mqd = mq_open(client_q_receive_name, cli_flags, cli_perms, cli_attrp);
-        if (client_mqd == (mqd_t) -1)
-          error_exit("mq_open (client)");
-
-        /* 3) Send 'ack' reply on client receive queue */
-        fprintf(stderr, GREEN"++%s Queue:"RESET" Sending ack\n", client_q_receive_name);
-        if(mq_send(client_mqd, "ack", sizeof("ack"), reg_prio) == -1)
-          error_exit("mq_send ack (client receive queue)");
-        mq_close(client_mqd);
-        fprintf(stderr, RED"**Service:"RESET" Closed client queue, '%s'\n", client_q_receive_name);
-
-        fprintf(stderr, RED"**Service:"RESET" Opening client queue, '%s'\n", client_q_send_name);
-        /* Open sent by client queue to receive 'caesar' instruction */
-        client_mqd = mq_open(client_q_send_name, cli_flags, cli_perms, cli_attrp);
-        if (client_mqd == (mqd_t) -1)
-          error_exit("mq_open (client)");
-
-        if (mq_getattr(client_mqd, &cli_attr) == -1)
-          error_exit("mq_getattr (client)");
-        cli_buffer = malloc(cli_attr.mq_msgsize);
-        if (cli_buffer == NULL)
-          error_exit("malloc (cli_buffer)");
-
-        numRead = mq_receive(client_mqd, cli_buffer, cli_attr.mq_msgsize, &cli_prio);
-        if (numRead == -1)
-          error_exit("mq_receive (registration queue)");
-        fprintf(stderr, GREEN"++%s Queue:"RESET" Read %ld bytes; priority = %u\n", client_q_send_name, (long) numRead, cli_prio);
-        if ((bytes = write(STDOUT_FILENO, cli_buffer, numRead)) == -1)
-          error_exit("write (registration reg_buffer)");
-        bytes = write(STDOUT_FILENO, "\n", 1);
-        mq_close(client_mqd);
-        fprintf(stderr, RED"**Service:"RESET" Closed client queue, '%s'\n", client_q_send_name);
-
-        if(strncmp("caesar", cli_buffer, strlen(reg_buffer)) == 0) {
-            /* 5) Process Data in shared memory (cipher/plaintext and shift value) */
-            printf(RED"**Service:"RESET" rotx entered with: %s\n", shared_mem_ptr->message);
-
-            /* Critical Section */
-            rotx(shared_mem_ptr->message, shared_mem_ptr->shift);
-            memcpy(shared_mem_ptr->message, shared_mem_ptr->message, strlen(shared_mem_ptr->message));
-            /* End Critical Section */
-
-            fprintf(stderr, RED"**Service:"RESET" rotx returned with: %s\n", shared_mem_ptr->message);
-
-            /* 5) Send 'fin' message on received by client queue to let client know the data is ready */
-            client_mqd = mq_open(client_q_receive_name, cli_flags, cli_perms, cli_attrp);
-            if (client_mqd == (mqd_t) -1)
-              error_exit("mq_open (client)");
-            printf(GREEN"++%s Queue:"RESET" Sending fin\n", client_q_receive_name);
-            if(mq_send(client_mqd, "fin", strlen("fin"), cli_prio) == -1)
-              error_exit("mq_send fin (client queue)");
-
-            /* 6) Close client message queue */
-            mq_close(client_mqd);
-            free(client_q_send_name);
-            free(client_q_receive_name);
-            free(cli_buffer);
-            client_q_send_name = NULL;
-            client_q_receive_name = NULL;
-            cli_buffer = NULL;
+        /* Waiting clients take a heartbeat that stops for a dead service */
+        atomic_fetch_add_explicit(&shared_mem_ptr->heartbeat, 1, memory_order_relaxed);
+
+        /* Sleep until a queue is readable, or retry waiting registrations shortly */
+        nready = epoll_wait(epoll_fd, events, MAX_EVENTS,
+                            state != STATS_SERVING ? DRAIN_POLL_MS : pending != NULL ? SLOT_RETRY_MS : REAP_INTERVAL_MS);
+        if (nready == -1) {
+            if (errno == EINTR)
+                continue;
+            error_exit("epoll_wait");
         }
+
+        for (e = 0; e < nready; e++) {
+            /* SIGTERM, SIGINT or SIGUSR1 */
+            if (events[e].data.ptr == &signal_fd) {
+                state = shutdown_signal(state, &drain_deadline);
+                continue;
+            }
+
+            /* A message queue client's instruction */
+            if (events[e].data.ptr != NULL) {
+                client_event(events[e].data.ptr);
+                continue;
+            }
+
+            /* The registration queue belongs to the new service once handed over */
+            if (state == STATS_HANDED_OVER)
+                continue;
+
+            /* 1) Read every registration waiting on the registration queue */
+            while ((numRead = mq_receive(registration_mqd, reg_buffer, reg_attr.mq_msgsize, &reg_prio)) != -1) {
+                log_debug(GREEN"++%s Queue:"RESET" Read %ld bytes; priority = %u", ipc.reg_mq, (long) numRead, reg_prio);
+                if (numRead != sizeof(struct registration)) {
+                    log_warn(RED"**Service:"RESET" Ignoring malformed registration");
+                    continue;
+                }
+                reg = reg_buffer;
+                reg->name[BUFSIZE-1] = '\0';
+
+                /* Ring clients deregister here, since the loop does not watch their queues */
+                if ((reg->flags & REG_DEREGISTER) && reg->generation == shared_mem_ptr->generation) {
+                    if (client_evict(clients, reg->name) == 0) {
+                        log_info(RED"**Service:"RESET" Deregistered '%s'", reg->name);
+                        atomic_fetch_add_explicit(&stats->deregistrations, 1, memory_order_relaxed);
+                    }
+                    continue;
+                }
+                if (reg->flags & REG_DEREGISTER) {
+                    log_debug(RED"**Service:"RESET" '%s' deregistered from the service before, ignoring", reg->name);
+                    continue;
+                }
+                log_info(GREEN"++%s Queue:"RESET" Registration from '%s'; priority = %u", ipc.reg_mq, reg->name, reg_prio);
+
+                /* The client mapped a segment this service replaced */
+                if (reg->generation != shared_mem_ptr->generation) {
+                    log_info(RED"**Service:"RESET" '%s' registered for a replaced segment, telling it stale", reg->name);
+                    send_stale(reg->name, reg_prio);
+                    continue;
+                }
+
+                /* A draining service starts no sessions */
+                if (state != STATS_SERVING) {
+                    send_busy(reg->name, reg_prio);
+                    continue;
+                }
+
+                /* Shed new sessions while the ring is already backed up */
+                if (ring_backlog(shared_mem_ptr) >= max_inflight) {
+                    log_info(RED"**Service:"RESET" Ring backlog over %u, '%s' is told busy", max_inflight, reg->name);
+                    send_busy(reg->name, reg_prio);
+                    continue;
+                }
+
+                snprintf(next.name, BUFSIZE, "%s", reg->name);
+                next.flags = reg->flags;
+                next.prio = reg_prio;
+                next.pid = reg->pid;
+                next.received = stats_now_ns();
+
+                /* 2) Start the session, or queue it behind earlier ones until a slot frees up */
+                if (pending == NULL && start_session(&next) == 0) {
+                    count_registration(reg_prio);
+                    continue;
+                }
+                if (pending_count >= max_pending || (sess = obj_pool_get(sessions)) == NULL) {
+                    log_info(RED"**Service:"RESET" %u registrations waiting, '%s' is told busy", pending_count, reg->name);
+                    send_busy(reg->name, reg_prio);
+                    continue;
+                }
+                count_registration(reg_prio);
+                *sess = next;
+                sess->next = NULL;
+                *pending_tail = sess;
+                pending_tail = &sess->next;
+                pending_count++;
+            }
+            if (errno != EAGAIN && errno != EINTR)
+              error_exit("mq_receive (registration queue)");
+        }
+
+        /* Registrations still waiting when a drain starts are turned away, or sent to the new service */
+        while (state != STATS_SERVING && pending != NULL) {
+            sess = pending;
+            pending = sess->next;
+            if (state == STATS_HANDED_OVER)
+                send_stale(sess->name, sess->prio);
+            else
+                send_busy(sess->name, sess->prio);
+            pending_count--;
+            obj_pool_put(sessions, sess);
+        }
+        if (pending == NULL)
+            pending_tail = &pending;
+
+        /* Clients that died without deregistering, and registrations whose client died waiting */
+        if (stats_now_ns() >= next_reap) {
+            reap_clients();
+            for (link = &pending; *link != NULL; ) {
+                sess = *link;
+                if (client_alive(sess->pid, -1)) {
+                    link = &sess->next;
+                    continue;
+                }
+                log_warn(RED"**Service:"RESET" '%s' exited waiting for a slot, dropping its registration", sess->name);
+                client_unlink(sess->name);
+                *link = sess->next;
+                pending_count--;
+                obj_pool_put(sessions, sess);
+            }
+            pending_tail = link;
+            next_reap = stats_now_ns() + (uint64_t) REAP_INTERVAL_MS * 1000000ull;
+        }
+
+        /* Clients hand their slots back directly, so retry in arrival order */
+        while (pending != NULL && start_session(pending) == 0) {
+            sess = pending;
+            pending = sess->next;
+            if (pending == NULL)
+                pending_tail = &pending;
+            pending_count--;
+            obj_pool_put(sessions, sess);
+        }
+        atomic_store_explicit(&stats->pending_registrations, pending_count, memory_order_relaxed);
+    }
+    if (clients_left(shared_mem_ptr) > 0)
+        log_warn(RED"**Service:"RESET" Stopped draining with %u clients left", clients_left(shared_mem_ptr));
+
+    /* The names are the new service's now */
+    if (state == STATS_HANDED_OVER) {
+        log_info(RED"**Service:"RESET" Handed over, leaving main event loop.");
+        closelog();
+        return EXIT_SUCCESS;
     }
-    fprintf(stderr, RED"**Service:"RESET" Leaving main event loop and calling cleanup.\n");
+    log_info(RED"**Service:"RESET" Leaving main event loop and calling cleanup.");
 
     clean_up();
     return EXIT_SUCCESS;
@@ -7,240 +7,923 @@
 * any later version. This program is distributed without any warranty.    *
 * See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
 \*************************************************************************/
+#include <limits.h> /* UINT_MAX bounds the token sequence */
+#include <errno.h> /* Failures are reported to the caller in errno */
+#include <pthread.h> /* The pool is created once, by whichever thread opens a session first */
+
 #include "service_api.h"
+#include "log.h" /* Asynchronous logging */
+#include "objpool.h" /* Sessions */
+#include "transport.h" /* Session internals and the transports */
+#include "shards.h" /* Which service instance a session goes to */
+
+#define TOKEN_INDEX(token) ((token) & (CAESAR_MAX_INFLIGHT - 1))
+
+/* Indexed by enum service_transport */
+static const struct transport_ops *const transports[CAESAR_NTRANSPORTS] = {
+    &ring_transport,
+    &mq_transport,
+    &unix_transport
+};
+
+/* Transport used by service_register() and service_rotate() */
+static enum service_transport transport = CAESAR_TRANSPORT_RING;
+
+/* Closed sessions are recycled, in slabs of this many */
+#define SESSION_POOL_SIZE 16
+
+static struct obj_pool *session_pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/*
+* Service instances sessions are spread over, by client name.  Until
+* caesar_set_shards() is called the list comes from $CAESAR_SHARDS, read
+* when the first session opens; with no shards every session goes to the
+* instance in $CAESAR_NAMESPACE, or the default one.
+*/
+static struct shard_ring shards;
+static int shards_loaded;
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Sessions opened through the name-based service_register() API, one per name */
+#define MAX_NAMED_SESSIONS 16
+static caesar_session_t *named_sessions[MAX_NAMED_SESSIONS];
+static pthread_mutex_t named_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
-* service_rotate() - request caesar encode/decode from caesar service
-* @client_q_name:  The base name of the client
-* @message: a character array containing the message to be encoded/decoded
-* @shift: a positive or negative direction to shift the message, where
-*         positive values shift the message right, and negative values shift
-*         the message left.
+* caesar_transport_name() - the name of a transport, as --transport takes it
+* @t: a transport
 *
-* Implements protocol following initial client registration.
+* Return: the name, or NULL if t is not a transport
+*/
+const char *caesar_transport_name(enum service_transport t)
+{
+    if ((unsigned int) t >= CAESAR_NTRANSPORTS)
+        return NULL;
+    return transports[t]->name;
+}
+
+/**
+* caesar_transport_lookup() - find a transport by name
+* @name: 'ring', 'mq' or 'unix'
+* @t: receives the transport
 *
+* Return: 0 on success, -1 if there is no such transport
 */
-void service_rotate(const char client_q_name[], char message[], int shift)
+int caesar_transport_lookup(const char *name, enum service_transport *t)
 {
-    /* For shared memory */
-    struct shared_memory *shared_mem_ptr;
-    struct stat sb;
-    int fd_shm;
+    unsigned int i;
 
-    /* Semaphore */
-    sem_t *mutex_sem;
+    for (i = 0; i < CAESAR_NTRANSPORTS; i++) {
+        if (strcmp(name, transports[i]->name) == 0) {
+            *t = (enum service_transport) i;
+            return 0;
+        }
+    }
+    return -1;
+}
 
-    /* Client queue variables */
-    mqd_t mqd_send, mqd_receive;
-    void *buffer;
-    struct mq_attr attr;
-    ssize_t numRead;
-    unsigned int priority;
-    ssize_t bytes;
+/**
+* service_set_transport() - choose how requests reach the service
+* @t: CAESAR_TRANSPORT_RING (default), CAESAR_TRANSPORT_MQ or CAESAR_TRANSPORT_UNIX
+*
+* Must be called before service_register(), since the service is told at
+* registration time which transport the client will use.
+*
+*/
+void service_set_transport(enum service_transport t)
+{
+    transport = t;
+}
 
-    /* Client Queue send/receive queue names */
-    char client_q_send_name[256];
-    char client_q_receive_name[256];
+/**
+* caesar_set_shards() - spread sessions over several service instances
+* @list: comma-separated namespaces of the instances, each started with
+*        'caesar_service -x <namespace>'; NULL or "" for one instance
+*
+* Each session opened afterwards goes to the instance its client name
+* hashes to on a consistent hashing ring, so a name always reaches the
+* same instance, and adding one to the list moves only about 1/K of the
+* names.  Sessions already open stay where they are.
+*
+* Return: 0 on success, -1 with errno set to EINVAL if the list holds an
+*         invalid or repeated namespace, or more than SHARDS_MAX
+*/
+int caesar_set_shards(const char *list)
+{
+    static struct shard_ring ring;
+    static pthread_mutex_t parse_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&parse_lock);
+    ring.nshards = 0;
+    if (list != NULL && list[0] != '\0' && shard_ring_parse(&ring, list) == -1) {
+        pthread_mutex_unlock(&parse_lock);
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&shards_lock);
+    memcpy(&shards, &ring, sizeof(shards));
+    shards_loaded = 1;
+    pthread_mutex_unlock(&shards_lock);
+    pthread_mutex_unlock(&parse_lock);
+    return 0;
+}
 
-    strncpy(client_q_receive_name, "/mq_received_by_", strlen("/mq_received_by_"));
-    strcat(client_q_receive_name, client_q_name);
-    strncpy(client_q_send_name, "/mq_sent_from_", strlen("/mq_sent_from_"));
-    strcat(client_q_send_name, client_q_name);
+/**
+* pick_instance() - name the IPC objects of the instance a session goes to
+* @sess: the session, named
+*
+* Return: 0 on success, -1 with errno set to EINVAL if $CAESAR_SHARDS or
+*         $CAESAR_NAMESPACE is invalid
+*/
+static int pick_instance(caesar_session_t *sess)
+{
+    const char *env, *ns;
+
+    pthread_mutex_lock(&shards_lock);
+    if (!shards_loaded) {
+        env = getenv(SHARDS_ENV);
+        shards.nshards = 0;
+        if (env != NULL && env[0] != '\0' && shard_ring_parse(&shards, env) == -1) {
+            pthread_mutex_unlock(&shards_lock);
+            log_warn(RED"**Service API (caesar_session_open):"RESET" bad %s '%s'", SHARDS_ENV, env);
+            errno = EINVAL;
+            return -1;
+        }
+        shards_loaded = 1;
+    }
+    ns = shards.nshards > 0 ? shard_ring_pick(&shards, sess->name) : ipc_ns_default();
+    if (ipc_names_init(&sess->ipc, ns) == -1) {
+        pthread_mutex_unlock(&shards_lock);
+        log_warn(RED"**Service API (caesar_session_open):"RESET" bad %s '%s'", IPC_NS_ENV, ns);
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_unlock(&shards_lock);
+    if (sess->ipc.ns[0] != '\0')
+        log_info(RED"**Service API (caesar_session_open):"RESET" '%s' goes to instance '%s'", sess->name, sess->ipc.ns);
+    return 0;
+}
 
-    /* First write message and shift to shared memory. */
-    fprintf(stderr, RED"**Service API (service_rotate):"RESET" Writing '%s' with shift of '%d' to %s.\n", message, shift, SHM_NAME);
+static void create_pool(void)
+{
+    session_pool = obj_pool_create(sizeof(caesar_session_t), SESSION_POOL_SIZE);
+}
 
-    /* Get shared memory */
-    if ((fd_shm = shm_open (SHM_NAME, O_RDWR, 0)) == -1)
-      error_exit("shm_open");
+/**
+* async_claim() - take a free entry in the session's request table
+* @sess: the session
+*
+* Return: the entry, with a fresh token, or NULL if all are in use
+*/
+struct async_request *async_claim(caesar_session_t *sess)
+{
+    struct async_request *r;
+    unsigned int i;
+
+    for (i = 0; i < CAESAR_MAX_INFLIGHT && sess->async[i].state != ASYNC_FREE; i++)
+        ;
+    if (i == CAESAR_MAX_INFLIGHT)
+        return NULL;
+    r = &sess->async[i];
+
+    if (++sess->seq > UINT_MAX / CAESAR_MAX_INFLIGHT)
+        sess->seq = 1;
+    r->token = sess->seq * CAESAR_MAX_INFLIGHT + i;
+    return r;
+}
 
-    if (( shared_mem_ptr = mmap(NULL, sizeof (struct shared_memory), PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0)) == MAP_FAILED)
-      error_exit("mmap");
-    fprintf(stderr, "Shared memory virtual address mapping is at %p for %s\n", (void *)shared_mem_ptr, SHM_NAME);
+/**
+* async_claim_wait() - take a free entry, waiting for completions if need be
+* @sess: the session; its transport must reap and wait
+*
+* Return: the entry, with a fresh token
+*/
+struct async_request *async_claim_wait(caesar_session_t *sess)
+{
+    struct async_request *r;
 
-    // Semaphore for mutual exclusion - initial value is 0
-    if ((mutex_sem = sem_open (SEM_MUTEX_NAME, 0, 0, 0)) == SEM_FAILED)
-      error_exit("sem_open");
+    while ((r = async_claim(sess)) == NULL) {
+        if (sess->ops->reap(sess) == 0)
+            sess->ops->wait(sess);
+    }
+    return r;
+}
 
-    if (sem_wait (mutex_sem) == -1)
-      error_exit ("sem_wait: mutex_sem");
+/**
+* async_pending() - the request a completion names
+* @sess: the session
+* @tag: the completion's tag
+*
+* Return: the request, or NULL if no request with that token is pending
+*/
+struct async_request *async_pending(caesar_session_t *sess, caesar_token_t tag)
+{
+    struct async_request *r = &sess->async[TOKEN_INDEX(tag)];
 
-    /* Critical Section */
-    snprintf(shared_mem_ptr->message, strlen(message)+1, "%s", message);
-    shared_mem_ptr->shift = shift;
+    if (r->state != ASYNC_PENDING || r->token != tag)
+        return NULL;
+    return r;
+}
 
-    /* Release mutex sem */
-    if (sem_post (mutex_sem) == -1)
-      error_exit ("sem_post: mutex_sem");
+/**
+* async_finish() - mark a request done; it stays in the table until collected
+* @r: the request, whose result is in place
+* @status: 0 on success
+*
+*/
+void async_finish(struct async_request *r, int status)
+{
+    r->status = status;
+    r->state = ASYNC_DONE;
+}
 
-    /* Now open the client queue registered with the service and send a 'caesar' instruction to the service. */
-    mqd_send = mq_open(client_q_send_name, O_RDWR);
-    if (mqd_send == (mqd_t) -1)
-        error_exit("mq_open");
+/**
+* async_fail_pending() - fail every asynchronous request of a lost service
+* @sess: the session
+*
+* No completion will come for them, so waiting for one must not block.
+*
+*/
+void async_fail_pending(caesar_session_t *sess)
+{
+    unsigned int i;
 
-    priority = 0;
-    if(mq_send(mqd_send, "caesar", strlen("caesar"), priority))
-        error_exit("mq_send");
-    fprintf(stderr, GREEN"++ %s Queue:"RESET" Sent 'caesar' instruction to service.\n", client_q_send_name);
+    for (i = 0; i < CAESAR_MAX_INFLIGHT; i++) {
+        if (sess->async[i].state == ASYNC_PENDING)
+            async_finish(&sess->async[i], -1);
+    }
+}
 
-    mqd_receive = mq_open(client_q_receive_name, O_RDONLY);
-    if (mqd_receive == (mqd_t) -1)
-        error_exit("mq_open");
+/**
+* caesar_session_open() - connect to the service and set up a session
+* @client_q_name:  The base name of the client
+* @priority: registration priority (0 if negative)
+* @t: CAESAR_TRANSPORT_RING, CAESAR_TRANSPORT_MQ or CAESAR_TRANSPORT_UNIX
+*
+* On the ring and message queue transports this creates the client
+* queues, registers with the service (which reserves a request slot and
+* acks with its index), maps the request segment and allocates the
+* receive buffer.  All of it is reused by caesar_rotate() until
+* caesar_session_close().  While the service is overloaded it answers
+* 'busy', and registration is retried with jittered exponential backoff.
+* A Unix socket session only connects: it takes no slot and maps nothing
+* of the service's, and priority does not apply.
+* With several service instances the client name picks one; see
+* caesar_set_shards().
+*
+* Return: the new session, or NULL with errno set to EBUSY if the service
+*         stayed busy, EINVAL for an unknown transport or a bad instance
+*         name, ENOMEM, or to why the service could not be reached
+*/
+caesar_session_t *caesar_session_open(const char client_q_name[], int priority,
+                                      enum service_transport t)
+{
+    caesar_session_t *sess;
+    int saved;
 
-    /* Now receive 'fin' response saying the text has been encoded */
-    if (mq_getattr(mqd_receive, &attr) == -1)
-      error_exit("mq_getattr (service_rotate)");
+    if ((unsigned int) t >= CAESAR_NTRANSPORTS) {
+        errno = EINVAL;
+        return NULL;
+    }
 
-    buffer = malloc(attr.mq_msgsize);
-    if (buffer == NULL)
-      error_exit("malloc (service_rotate buffer)");
+    pthread_once(&pool_once, create_pool);
+    if (session_pool == NULL || (sess = obj_pool_get(session_pool)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    snprintf(sess->name, sizeof(sess->name), "%s", client_q_name);
+    sess->transport = t;
+    sess->ops = transports[t];
+
+    if (pick_instance(sess) == -1 ||
+        sess->ops->open(sess, priority > 0 ? (unsigned int) priority : 0) == -1) {
+        saved = errno;
+        obj_pool_put(session_pool, sess);
+        errno = saved;
+        return NULL;
+    }
+    return sess;
+}
 
-    numRead = mq_receive(mqd_receive, buffer, attr.mq_msgsize, &priority);
-    if (numRead == -1)
-        error_exit("mq_receive (registration queue)");
-    fprintf(stderr, GREEN"++ %s Queue:"RESET" Read %ld bytes; priority = %u\n", client_q_receive_name, (long) numRead, priority);
+/**
+* caesar_rotate() - encode/decode a message over an open session
+* @sess: the session from caesar_session_open()
+* @message: a character array containing the message to be encoded/decoded;
+*           on return it holds the encoded/decoded message
+* @shift: a positive or negative direction to shift the message, where
+*         positive values shift the message right, and negative values shift
+*         the message left.
+*
+* Only the data exchange happens here; queues, mapping and buffers all
+* come from the session.
+*
+* Return: 0 on success, -1 with errno set to EIO if the service did not
+*         process the request, ENOMEM if there was no room to stage it, or
+*         EPIPE (or another errno) if the connection to the service failed
+*/
+int caesar_rotate(caesar_session_t *sess, char message[], int shift)
+{
+    return sess->ops->rotate(sess, message, strlen(message), shift);
+}
 
-    /* Encoded data received, now output result */
-    if ((bytes = write(STDOUT_FILENO, buffer, numRead)) == -1)
-      error_exit("write (client buffer from service_rotate)");
-    bytes = write(STDOUT_FILENO, "\n", 1);
+/**
+* batch_size() - bytes a batch request takes
+* @messages: count NUL-terminated messages
+* @count: number of messages
+*/
+size_t batch_size(char *messages[], size_t count)
+{
+    size_t i, total = sizeof(struct batch_header) + count * sizeof(struct batch_entry);
 
-    if(strncmp(buffer, "fin", strlen(buffer)) == 0) {
+    for (i = 0; i < count; i++)
+        total += strlen(messages[i]);
+    return total;
+}
 
-        if (sem_wait (mutex_sem) == -1)
-          error_exit ("sem_wait: mutex_sem");
+/**
+* pack_batch() - lay out a batch request
+* @data: batch_size() bytes
+* @messages: count NUL-terminated messages
+* @shifts: the shift to apply to each message
+* @count: number of messages
+*
+* A batch_header, one batch_entry per message, then the message bytes.
+*
+*/
+void pack_batch(char *data, char *messages[], const int shifts[], size_t count)
+{
+    struct batch_header *batch = (struct batch_header *) (void *) data;
+    size_t i, off;
+
+    batch->count = count;
+    off = sizeof(*batch) + count * sizeof(struct batch_entry);
+    for (i = 0; i < count; i++) {
+        batch->entries[i].shift = shifts[i];
+        batch->entries[i].len = strlen(messages[i]);
+        batch->entries[i].offset = off;
+        memcpy(data + off, messages[i], batch->entries[i].len);
+        off += batch->entries[i].len;
+    }
+}
 
-        /* Get shared memory */
-        if ((fd_shm = shm_open (SHM_NAME, O_RDONLY, 0)) == -1)
-          error_exit("shm_open");
+/**
+* unpack_batch() - copy the results of a batch back to its messages
+* @data: the batch, as packed by pack_batch()
+* @messages: receive their results
+* @count: number of messages
+*
+*/
+void unpack_batch(const char *data, char *messages[], size_t count)
+{
+    const struct batch_header *batch = (const struct batch_header *) (const void *) data;
+    size_t i;
 
-        if (fstat(fd_shm, &sb) == -1)
-            error_exit("fstat");
+    for (i = 0; i < count; i++)
+        memcpy(messages[i], data + batch->entries[i].offset, batch->entries[i].len);
+}
 
-        if (( shared_mem_ptr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd_shm, 0)) == MAP_FAILED)
-          error_exit("mmap");
-        fprintf(stderr, "Shared memory virtual address mapping is at %p for %s\n", (void *)shared_mem_ptr, SHM_NAME);
-        fprintf(stderr, RED"**Service API (service_rotate):"RESET" Encoded/Decoded message is: %s\n", shared_mem_ptr->message);
+/**
+* caesar_rotate_batch() - encode/decode many messages in one round trip
+* @sess: the session from caesar_session_open()
+* @messages: count NUL-terminated messages; on return each holds its result
+* @shifts: the shift to apply to each message
+* @count: number of messages
+*
+* Packs every message into a single buffer (a batch_header, one
+* batch_entry per message, then the message bytes) and submits it as one
+* request, so the service is signalled once and completes once.
+*
+* Return: 0 on success, -1 with errno set as for caesar_rotate()
+*/
+int caesar_rotate_batch(caesar_session_t *sess, char *messages[], const int shifts[], size_t count)
+{
+    if (count == 0)
+        return 0;
+    return sess->ops->rotate_batch(sess, messages, shifts, count);
+}
 
-        /* Release mutex sem */
-        if (sem_post (mutex_sem) == -1)
-          error_exit ("sem_post: mutex_sem");
+/**
+* caesar_rotate_async() - start encoding/decoding a message without waiting
+* @sess: the session from caesar_session_open()
+* @message: the message; it receives the result, so it must stay valid
+*           until the request is collected by caesar_poll() or caesar_wait()
+* @shift: the shift to apply, as for caesar_rotate()
+*
+* On the ring transport the message is copied into its own payload arena
+* buffer and submitted at once, so up to CAESAR_MAX_INFLIGHT requests can
+* be in the service's pipeline.  On the message queue and Unix socket
+* transports, which stage requests in one place per session, the request
+* completes before this returns.
+*
+* Return: the request's token, or CAESAR_TOKEN_NONE with errno set to
+*         EAGAIN if the session has CAESAR_MAX_INFLIGHT requests
+*         uncollected, or ENOMEM if the arena is full
+*/
+caesar_token_t caesar_rotate_async(caesar_session_t *sess, char message[], int shift)
+{
+    struct async_request *r;
 
-        if (close(fd_shm) == -1)
-            error_exit("close");
+    if ((r = async_claim(sess)) == NULL) {
+        errno = EAGAIN;
+        return CAESAR_TOKEN_NONE;
+    }
+    r->message = message;
+    r->len = strlen(message);
 
-        if (munmap (shared_mem_ptr, sizeof (struct shared_memory)) == -1)
-          error_exit("munmap");
+    if (sess->ops->submit == NULL) {
+        r->payload = ARENA_NONE;
+        async_finish(r, sess->ops->rotate(sess, message, r->len, shift));
+        return r->token;
     }
+    if (sess->ops->submit(sess, r, shift) == -1)
+        return CAESAR_TOKEN_NONE;
+    return r->token;
+}
 
-    free(buffer);
-    mq_close(mqd_send);
-    mq_close(mqd_receive);
+/**
+* caesar_poll() - collect finished asynchronous requests without blocking
+* @sess: the session from caesar_session_open()
+* @done: receives the token and status of each finished request
+* @max: size of done
+*
+* Collected requests are forgotten by the session, and their message
+* buffers hold the results.  When nothing has finished, the session's
+* completion ring is armed: the fd from caesar_session_fd() then turns
+* readable on the next completion, so a caller can sleep in poll(2) or
+* epoll_wait(2) and call caesar_poll() again when it wakes.
+*
+* Return: number of entries filled in done, in no particular order
+*/
+int caesar_poll(caesar_session_t *sess, struct caesar_completion done[], int max)
+{
+    unsigned int i;
+    int n = 0;
+
+    for (;;) {
+        if (sess->ops->reap != NULL)
+            sess->ops->reap(sess);
+        for (i = 0; i < CAESAR_MAX_INFLIGHT && n < max; i++) {
+            if (sess->async[i].state != ASYNC_DONE)
+                continue;
+            done[n].token = sess->async[i].token;
+            done[n].status = sess->async[i].status;
+            sess->async[i].state = ASYNC_FREE;
+            n++;
+        }
+        if (n > 0 || sess->ops->arm == NULL)
+            return n;
+        if (sess->ops->arm(sess) == 0)
+            return 0;
+    }
 }
 
 /**
-* service_register() - register client queues with service
-* @client_q_name:  The base name of the client
-* @priority_arg: defaults to 0, priority provided optionally as a command-line argument
+* caesar_wait() - block until one asynchronous request has finished
+* @sess: the session from caesar_session_open()
+* @token: the token from caesar_rotate_async()
 *
-* Implements registration protocol with service by first sending the client base name,
-* and waiting for an "ack" from service.
+* Other requests finishing meanwhile are kept for caesar_poll().
+*
+* Return: the request's status, 0 on success, or -1 with errno set to
+*         EINVAL for an unknown token
 */
-void service_register(const char client_q_name[], int priority_arg)
+int caesar_wait(caesar_session_t *sess, caesar_token_t token)
 {
-    unsigned int priority;
-    ssize_t numRead;
-    void *buffer;
-    struct mq_attr attr, *attrp;
-    ssize_t bytes;
-    mqd_t mqd;
+    struct async_request *r = &sess->async[TOKEN_INDEX(token)];
 
-    char client_q_send_name[256];
-    char client_q_receive_name[256];
-    strncpy(client_q_receive_name, "/mq_received_by_", sizeof("/mq_received_by_"));
-    strcat(client_q_receive_name, client_q_name);
-    strncpy(client_q_send_name, "/mq_sent_from_", sizeof("/mq_sent_from_"));
-    strcat(client_q_send_name, client_q_name);
+    if (token == CAESAR_TOKEN_NONE || r->state == ASYNC_FREE || r->token != token) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    attrp = NULL;
-    attr.mq_maxmsg = 10;
-    attr.mq_msgsize = 2048;
+    while (r->state == ASYNC_PENDING) {
+        if (sess->ops->reap(sess) == 0)
+            sess->ops->wait(sess);
+    }
+    r->state = ASYNC_FREE;
+    return r->status;
+}
 
-    /* Create client send queue and close for now. */
-    mqd = mq_open(client_q_send_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
-    if (mqd == (mqd_t) -1)
-        error_exit("mq_open");
-    mq_close(mqd);
+/**
+* caesar_session_fd() - file descriptor signalling asynchronous completions
+* @sess: the session from caesar_session_open()
+*
+* The descriptor is the client's receive queue, which is pollable on Linux,
+* or the socket of a Unix socket session.  It only becomes readable after
+* caesar_poll() has returned 0; never read from it directly.
+*
+* Return: the descriptor, for poll(2), select(2) or epoll(7)
+*/
+int caesar_session_fd(caesar_session_t *sess)
+{
+    return sess->ops->fd(sess);
+}
 
-    /* Open Registration queue to register client */
-    mqd = mq_open(REG_MQ_NAME, O_RDWR, S_IRUSR | S_IWUSR, attrp);
-    if (mqd == (mqd_t) -1)
-        error_exit("mq_open");
+/**
+* caesar_set_deadline() - ask for requests to finish within a time budget
+* @sess: the session from caesar_session_open()
+* @usec: microseconds from submission, or 0 for no deadline (the default)
+*
+* Applies to ring requests submitted from now on.  The service normally
+* serves clients in weighted turns by registration priority; a request
+* about to miss its deadline is served ahead of its turn.  Message queue
+* sessions have one request at a time and ignore the deadline.
+*
+*/
+void caesar_set_deadline(caesar_session_t *sess, unsigned long usec)
+{
+    sess->deadline_ns = (uint64_t) usec * 1000u;
+}
 
-    fprintf(stderr, RED"**Service API (service_register):"RESET" Registering '%s' with the service.\n", client_q_name);
+/**
+* caesar_stream_open() - set up a pipeline of chunk buffers on a session
+* @sess: the session from caesar_session_open()
+* @chunk: bytes in each chunk
+* @depth: chunks in rotation, 2 to CAESAR_STREAM_MAX_DEPTH
+* @shift: the shift applied to every chunk
+*
+* Allocates the chunks in the payload arena once.  On the ring transport
+* up to depth chunks are in the service at once; the message queue
+* transport rotates each chunk as it is submitted.  On the Unix socket
+* transport the chunks are laid out in a memfd region of their own, which
+* the service maps, so no byte is copied between the processes.  Chunks
+* complete like asynchronous requests, so do not caesar_poll() a session
+* while it has a stream open.  Close the stream before its session.
+*
+* Return: the stream, or NULL with errno set to EINVAL for a bad chunk or
+*         depth, ENOMEM if the arena has no room for it, or EBUSY if a Unix
+*         socket session has SOCK_REGIONS - 1 streams open already
+*/
+caesar_stream_t *caesar_stream_open(caesar_session_t *sess, size_t chunk, unsigned int depth, int shift)
+{
+    caesar_stream_t *st;
 
-    // First Stage of QoS -- setting priority for registration
-    if(priority_arg > 0) {
-        priority = priority_arg;
-    } else {
-        priority = 0;
+    if (depth < 2 || depth > CAESAR_STREAM_MAX_DEPTH || chunk == 0) {
+        errno = EINVAL;
+        return NULL;
     }
+    st = calloc(1, sizeof(*st));
+    if (st == NULL)
+        return NULL;
+    st->sess = sess;
+    st->chunk = chunk;
+    st->depth = depth;
+    st->shift = shift;
+    if (sess->ops->stream_open(st) == -1) {
+        free(st);
+        return NULL;
+    }
+    return st;
+}
 
-    if(mq_send(mqd, client_q_name, strlen(client_q_name), priority) == -1)
-        error_exit("mq_send");
-    mq_close(mqd);
-    fprintf(stderr, GREEN"++%s Queue:"RESET" Sent '%s'\n", REG_MQ_NAME, client_q_name);
+/**
+* release_held() - give the chunk whose result was read back to the filler
+* @st: the stream
+*/
+static void release_held(caesar_stream_t *st)
+{
+    if (st->held) {
+        st->held = 0;
+        st->head++;
+    }
+}
 
-    /* Now open/creat client receive queue to receive ack from service */
-    fprintf(stderr, GREEN"++%s Queue:"RESET" Listening...\n", client_q_receive_name);
-    mqd = mq_open(client_q_receive_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
-    if (mqd == (mqd_t) -1)
-        error_exit("mq_open");
+/**
+* caesar_stream_buffer() - the next chunk to fill
+* @st: the stream
+*
+* Fill at most the stream's chunk size, then pass the length to
+* caesar_stream_submit().  Ends the caller's use of the last result.
+*
+* Return: the chunk's bytes, or NULL while depth chunks are in flight;
+*         collect one with caesar_stream_result() first
+*/
+char *caesar_stream_buffer(caesar_stream_t *st)
+{
+    release_held(st);
+    if (st->tail - st->head == st->depth)
+        return NULL;
+    return st->sess->ops->chunk_buf(st, &st->chunks[st->tail % st->depth])->data;
+}
 
-    if(mq_getattr(mqd, &attr) == -1)
-        error_exit("mq_getattr");
+/**
+* caesar_stream_submit() - hand the filled chunk to the service
+* @st: the stream
+* @len: bytes filled, at most the chunk size
+*
+* A chunk that could not be sent keeps its place in the stream, and
+* caesar_stream_result() reports it failed.
+*
+* Return: 0 on success, -1 with errno set to EPIPE (or another errno) if
+*         the connection to the service failed
+*/
+int caesar_stream_submit(caesar_stream_t *st, size_t len)
+{
+    struct stream_chunk *c = &st->chunks[st->tail % st->depth];
+
+    if (len > st->chunk)
+        len = st->chunk;
+    st->sess->ops->chunk_buf(st, c)->len = len;
+    st->tail++;
+    if (st->sess->ops->chunk_submit(st, c, len) == -1) {
+        c->token = CAESAR_TOKEN_NONE;
+        c->status = -1;
+        return -1;
+    }
+    return 0;
+}
 
-    buffer = malloc(attr.mq_msgsize);
-    if (buffer == NULL)
-        error_exit("mq_getattr");
+/**
+* caesar_stream_result() - wait for the oldest chunk in flight
+* @st: the stream
+* @data: receives the rotated bytes, valid until the next call on the stream
+* @len: receives their number
+*
+* Chunks come back in the order they were submitted.
+*
+* Return: 1 with a chunk, 0 if none is in flight, -1 with errno set to EIO
+*         if the service failed the chunk or it could not be sent (it is
+*         skipped)
+*/
+int caesar_stream_result(caesar_stream_t *st, const char **data, size_t *len)
+{
+    struct stream_chunk *c;
+    struct arena_buf *buf;
+
+    release_held(st);
+    if (st->head == st->tail)
+        return 0;
+    c = &st->chunks[st->head % st->depth];
+    if (c->token != CAESAR_TOKEN_NONE) {
+        c->status = caesar_wait(st->sess, c->token);
+        c->token = CAESAR_TOKEN_NONE;
+    }
+    st->held = 1;
+    if (c->status != 0) {
+        errno = EIO;
+        return -1;
+    }
+    buf = st->sess->ops->chunk_buf(st, c);
+    *data = buf->data;
+    *len = buf->len;
+    return 1;
+}
 
-    priority = 0;
-    numRead = mq_receive(mqd, buffer, attr.mq_msgsize, &priority);
-    if (numRead == -1)
-        error_exit("mq_receive");
+/**
+* caesar_stream_close() - wait for chunks in flight and free the stream
+* @st: the stream, from caesar_stream_open(); freed here
+*
+* Results not yet read back are discarded.  A Unix socket session keeps
+* the stream's memfd region for its next stream.
+*
+*/
+void caesar_stream_close(caesar_stream_t *st)
+{
+    unsigned int i;
 
-    fprintf(stderr, GREEN"++%s Queue:"RESET" Read %ld bytes; priority = %u\n", client_q_receive_name, (long) numRead, priority);
-    if ((bytes = write(STDOUT_FILENO, buffer, numRead)) == -1)
-        error_exit("write");
-    bytes = write(STDOUT_FILENO, "\n", 1);
+    for (i = 0; i < st->depth; i++) {
+        if (st->chunks[i].token != CAESAR_TOKEN_NONE)
+            caesar_wait(st->sess, st->chunks[i].token);
+    }
+    st->sess->ops->stream_close(st);
+    free(st);
+}
 
-    free(buffer);
+/**
+* caesar_session_close() - deregister and tear down a session
+* @sess: the session from caesar_session_open(); freed here
+*
+* Waits for asynchronous requests still in flight, tells the service that
+* we are done ('bye' to a message queue session's worker, a deregistration
+* for ring sessions), returns the request slot and unlinks the client
+* queues.  A Unix socket session just hangs up and unmaps its regions.
+*
+*/
+void caesar_session_close(caesar_session_t *sess)
+{
+    unsigned int i;
 
-    /* closing client receive queue */
-    mq_close(mqd);
+    /* The service may still write into their buffers */
+    for (i = 0; i < CAESAR_MAX_INFLIGHT; i++) {
+        if (sess->async[i].state == ASYNC_PENDING)
+            caesar_wait(sess, sess->async[i].token);
+    }
+    sess->ops->close(sess);
+    obj_pool_put(session_pool, sess);
 }
 
 /**
-* service_deregister() - deregister client queues
+* named_index() - find the named_sessions entry for a name and slot
+* @client_q_name:  The base name of the client
+* @slot: the request slot handed out by service_register()
+*
+* Context: named_lock must be held.
+*
+* Return: the index in named_sessions, or -1 if the name is not registered
+*         with that slot
+*/
+static int named_index(const char client_q_name[], int slot)
+{
+    int i;
+
+    for (i = 0; i < MAX_NAMED_SESSIONS; i++) {
+        if (named_sessions[i] != NULL && named_sessions[i]->slot == slot &&
+            strcmp(named_sessions[i]->name, client_q_name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/**
+* find_named_session() - look up a session opened by service_register()
+* @client_q_name:  The base name of the client
+* @slot: the request slot handed out by service_register()
+* @caller: for the error message
+*
+* Threads may register and use different names at once; one name is used
+* by one thread at a time.
+*
+* Return: the session, or NULL with errno set to ENOENT if the name is not
+*         registered with that slot
+*/
+static caesar_session_t *find_named_session(const char client_q_name[], int slot, const char *caller)
+{
+    caesar_session_t *sess = NULL;
+    int i;
+
+    pthread_mutex_lock(&named_lock);
+    i = named_index(client_q_name, slot);
+    if (i >= 0)
+        sess = named_sessions[i];
+    pthread_mutex_unlock(&named_lock);
+    if (sess == NULL) {
+        log_warn(RED"**Service API (%s):"RESET" '%s' is not registered with slot %d", caller, client_q_name, slot);
+        errno = ENOENT;
+        return NULL;
+    }
+    return sess;
+}
+
+/**
+* service_rotate() - request caesar encode/decode from caesar service
 * @client_q_name:  The base name of the client
+* @slot: the request slot handed out by service_register()
+* @message: a character array containing the message to be encoded/decoded;
+*           on return it holds the encoded/decoded message
+* @shift: a positive or negative direction to shift the message, where
+*         positive values shift the message right, and negative values shift
+*         the message left.
 *
-* Calls mq_unlink on the send and receive queues associated with the base name
+* Implements protocol following initial client registration, on the
+* session service_register() opened for client_q_name.
 *
+* Return: 0 on success, -1 with errno set to ENOENT for an unknown name or
+*         slot, or as for caesar_rotate()
 */
-void service_deregister(const char client_q_name[])
+int service_rotate(const char client_q_name[], int slot, char message[], int shift)
 {
-    char client_q_send_name[256];
-    char client_q_receive_name[256];
-    strncpy(client_q_receive_name, "/mq_received_by_", sizeof("/mq_received_by_"));
-    strcat(client_q_receive_name, client_q_name);
-    strncpy(client_q_send_name, "/mq_sent_from_", sizeof("/mq_sent_from_"));
-    strcat(client_q_send_name, client_q_name);
+    caesar_session_t *sess = find_named_session(client_q_name, slot, "service_rotate");
+
+    if (sess == NULL)
+        return -1;
+    log_debug(RED"**Service API (service_rotate):"RESET" Writing %zu bytes with shift of '%d' to %s slot %d.", strlen(message), shift, SHM_NAME, slot);
+    if (caesar_rotate(sess, message, shift) == -1) {
+        log_warn(RED"**Service API (service_rotate):"RESET" Service did not process the request");
+        return -1;
+    }
+    log_debug(RED"**Service API (service_rotate):"RESET" Encoded/Decoded message is: %s", message);
+    return 0;
+}
 
-    fprintf(stderr, RED"**Service API (service_deregister):"RESET" unlinking %s and %s\n", client_q_send_name, client_q_receive_name);
+/**
+* service_rotate_batch() - request caesar encode/decode of many messages
+* @client_q_name:  The base name of the client
+* @slot: the request slot handed out by service_register()
+* @messages: count NUL-terminated messages; on return each holds its result
+* @shifts: the shift to apply to each message
+* @count: number of messages
+*
+* Sends all messages to the service as a single request on the session
+* service_register() opened for client_q_name.
+*
+* Return: 0 on success, -1 with errno set as for service_rotate()
+*/
+int service_rotate_batch(const char client_q_name[], int slot, char *messages[], const int shifts[], size_t count)
+{
+    caesar_session_t *sess = find_named_session(client_q_name, slot, "service_rotate_batch");
+
+    if (sess == NULL)
+        return -1;
+    log_debug(RED"**Service API (service_rotate_batch):"RESET" Sending %zu messages to %s slot %d.", count, SHM_NAME, slot);
+    if (caesar_rotate_batch(sess, messages, shifts, count) == -1) {
+        log_warn(RED"**Service API (service_rotate_batch):"RESET" Service did not process the batch");
+        return -1;
+    }
+    return 0;
+}
 
-    // Unlink Client Queue
-    if(mq_unlink(client_q_receive_name) == -1)
-        error_exit("mq_unlink (client_q_receive_name) in service_deregister");
-    if(mq_unlink(client_q_send_name) == -1)
-        error_exit("mq_unlink (client_q_send_name) in service_deregister");
+/**
+* service_rotate_async() - start a caesar encode/decode without waiting
+* @client_q_name:  The base name of the client
+* @slot: the request slot handed out by service_register()
+* @message: the message; receives the result once the request finishes
+* @shift: the shift to apply
+*
+* Collect the result with caesar_poll() or caesar_wait() on the session
+* returned by service_session().
+*
+* Return: the request's token, or CAESAR_TOKEN_NONE with errno set to
+*         ENOENT for an unknown name or slot, or as for caesar_rotate_async()
+*/
+caesar_token_t service_rotate_async(const char client_q_name[], int slot, char message[], int shift)
+{
+    caesar_session_t *sess = service_session(client_q_name, slot);
+
+    if (sess == NULL)
+        return CAESAR_TOKEN_NONE;
+    return caesar_rotate_async(sess, message, shift);
+}
+
+/**
+* service_session() - the session service_register() opened for a client
+* @client_q_name:  The base name of the client
+* @slot: the request slot handed out by service_register()
+*
+* Return: the session, for the caesar_* calls, or NULL with errno set to
+*         ENOENT for an unknown name or slot
+*/
+caesar_session_t *service_session(const char client_q_name[], int slot)
+{
+    return find_named_session(client_q_name, slot, "service_session");
+}
+
+/**
+* service_register() - register client queues with service
+* @client_q_name:  The base name of the client
+* @priority_arg: defaults to 0, priority provided optionally as a command-line argument
+*
+* Opens a session on the transport chosen with service_set_transport()
+* and remembers it under client_q_name.
+*
+* Return: the request slot index to pass to service_rotate(), or -1 with
+*         errno set to EAGAIN if MAX_NAMED_SESSIONS names are registered,
+*         or as for caesar_session_open(), EBUSY if the service is too busy
+*         to take the client
+*/
+int service_register(const char client_q_name[], int priority_arg)
+{
+    caesar_session_t *sess;
+    int i;
+
+    /* Registering can take a while, so the table is not locked meanwhile */
+    sess = caesar_session_open(client_q_name, priority_arg, transport);
+    if (sess == NULL)
+        return -1;
+
+    pthread_mutex_lock(&named_lock);
+    for (i = 0; i < MAX_NAMED_SESSIONS && named_sessions[i] != NULL; i++)
+        ;
+    if (i == MAX_NAMED_SESSIONS) {
+        pthread_mutex_unlock(&named_lock);
+        log_warn(RED"**Service API (service_register):"RESET" more than %d clients registered", MAX_NAMED_SESSIONS);
+        caesar_session_close(sess);
+        errno = EAGAIN;
+        return -1;
+    }
+    named_sessions[i] = sess;
+    pthread_mutex_unlock(&named_lock);
+    return sess->slot;
+}
+
+/**
+* service_deregister() - deregister client queues
+* @client_q_name:  The base name of the client
+* @slot: the request slot handed out by service_register()
+*
+* Closes the session opened by service_register(), which returns the
+* request slot and calls mq_unlink on the client queues.
+*
+* Return: 0 on success, -1 with errno set to ENOENT for an unknown name or
+*         slot
+*/
+int service_deregister(const char client_q_name[], int slot)
+{
+    caesar_session_t *sess;
+    int i;
+
+    /* Look up and remove in one go so two callers cannot both close it */
+    pthread_mutex_lock(&named_lock);
+    i = named_index(client_q_name, slot);
+    if (i < 0) {
+        pthread_mutex_unlock(&named_lock);
+        log_warn(RED"**Service API (service_deregister):"RESET" '%s' is not registered with slot %d", client_q_name, slot);
+        errno = ENOENT;
+        return -1;
+    }
+    sess = named_sessions[i];
+    named_sessions[i] = NULL;
+    pthread_mutex_unlock(&named_lock);
+    caesar_session_close(sess);
+    return 0;
 }
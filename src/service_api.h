@@ -9,36 +9,127 @@
 #ifndef SERVICE_API_H
 #define SERVICE_API_H
 
-#include <string.h>
-#include <stdlib.h>  /* Used for malloc */
-#include <sys/mman.h> /* mmap and munmap */
-#include <sys/stat.h>   /* Defines mode constants */
-#include <fcntl.h>  /* Defines file descriptor constants: O_ */
-#include <mqueue.h>   /* Required to implement POSIX message queues */
-#include <semaphore.h> /* Needed for semaphore */
-#include <unistd.h> /* Needed for write function */
-
-#include "errors.h"
-
-#define SHM_NAME "/shm_caesar"
-#define REG_MQ_NAME "/mq_registration"
-#define SEM_MUTEX_NAME "/sem_mutex"
-#define BUFSIZE 256
-
-/* Used for color in Linux terminal output */
-#define RESET "\033[0m"
-#define RED "\033[31m"
-#define GREEN "\033[32m"
-
-struct shared_memory {
-  char message[BUFSIZE+1];
-  int shift;
+/*
+* The public interface of the client library.  Everything behind it, the
+* shared memory layout included, is private to the library and the service.
+*/
+#include <stddef.h> /* size_t */
+
+/* How requests travel to the service after registration */
+enum service_transport {
+  CAESAR_TRANSPORT_RING,  /* lock-free rings in shared memory (default) */
+  CAESAR_TRANSPORT_MQ,    /* 'caesar'/'fin' handshake on the client message queues */
+  CAESAR_TRANSPORT_UNIX,  /* a Unix socket, with payloads in memfds shared over it */
+  CAESAR_NTRANSPORTS
+};
+
+/*
+* A registered client: queues, shared memory mapping and buffers are set
+* up once by caesar_session_open() and reused by every caesar_rotate().
+* Calls on one session must not overlap; threads share sessions through
+* a caesar_pool_t.
+*/
+typedef struct caesar_session caesar_session_t;
+
+/*
+* Identifies a request started with caesar_rotate_async() until it is
+* collected by caesar_poll() or caesar_wait().  Never CAESAR_TOKEN_NONE.
+*/
+typedef unsigned int caesar_token_t;
+
+#define CAESAR_TOKEN_NONE 0
+
+/* Most requests a session can have started but not yet collected */
+#define CAESAR_MAX_INFLIGHT 64
+
+/*
+* A pipeline of payload arena buffers for streaming data through a
+* session: chunks are filled, rotated and read back in place, so the
+* caller can fill one while the service rotates another.
+*/
+typedef struct caesar_stream caesar_stream_t;
+
+/* Most chunks a stream can have in the service at once */
+#define CAESAR_STREAM_MAX_DEPTH 16
+
+/*
+* Sessions shared by the threads of a process.  A session serves one
+* thread at a time; a pool lends its sessions out per request, so any
+* number of threads are multiplexed over a few registrations.
+*/
+typedef struct caesar_pool caesar_pool_t;
+
+/* Most sessions in a pool */
+#define CAESAR_POOL_MAX 16
+
+struct caesar_completion {
+  caesar_token_t token;
+  int status;              /* 0 on success, as from caesar_rotate() */
 };
 
-void service_rotate(const char client_q_name[], char message[], int shift);
+const char *caesar_transport_name(enum service_transport transport);
+
+int caesar_transport_lookup(const char *name, enum service_transport *transport);
+
+int caesar_set_shards(const char *list);
+
+caesar_session_t *caesar_session_open(const char client_q_name[], int priority,
+                                      enum service_transport transport);
+
+int caesar_rotate(caesar_session_t *session, char message[], int shift);
+
+int caesar_rotate_batch(caesar_session_t *session, char *messages[], const int shifts[], size_t count);
+
+caesar_token_t caesar_rotate_async(caesar_session_t *session, char message[], int shift);
+
+int caesar_poll(caesar_session_t *session, struct caesar_completion done[], int max);
+
+int caesar_wait(caesar_session_t *session, caesar_token_t token);
+
+int caesar_session_fd(caesar_session_t *session);
+
+void caesar_set_deadline(caesar_session_t *session, unsigned long usec);
+
+caesar_stream_t *caesar_stream_open(caesar_session_t *session, size_t chunk, unsigned int depth, int shift);
+
+char *caesar_stream_buffer(caesar_stream_t *stream);
+
+int caesar_stream_submit(caesar_stream_t *stream, size_t len);
+
+int caesar_stream_result(caesar_stream_t *stream, const char **data, size_t *len);
+
+void caesar_stream_close(caesar_stream_t *stream);
+
+void caesar_session_close(caesar_session_t *session);
+
+caesar_pool_t *caesar_pool_open(const char prefix[], unsigned int nsessions, int priority,
+                                enum service_transport transport);
+
+int caesar_pool_rotate(caesar_pool_t *pool, char message[], int shift);
+
+int caesar_pool_rotate_batch(caesar_pool_t *pool, char *messages[], const int shifts[], size_t count);
+
+caesar_session_t *caesar_pool_acquire(caesar_pool_t *pool);
+
+void caesar_pool_release(caesar_pool_t *pool, caesar_session_t *session);
+
+unsigned int caesar_pool_sessions(const caesar_pool_t *pool);
+
+void caesar_pool_close(caesar_pool_t *pool);
+
+/* Name-based API, kept for existing callers; built on the session API */
+void service_set_transport(enum service_transport transport);
+
+int service_rotate(const char client_q_name[], int slot, char message[], int shift);
+
+int service_rotate_batch(const char client_q_name[], int slot, char *messages[], const int shifts[], size_t count);
+
+caesar_token_t service_rotate_async(const char client_q_name[], int slot, char message[], int shift);
+
+caesar_session_t *service_session(const char client_q_name[], int slot);
 
-void service_register(const char client_q_name[], int priority_arg);
+int service_register(const char client_q_name[], int priority_arg);
 
-void service_deregister(const char client_q_name[]);
+int service_deregister(const char client_q_name[], int slot);
 
 #endif
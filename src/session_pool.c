@@ -0,0 +1,207 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <errno.h> /* Failures are reported to the caller in errno */
+#include <pthread.h> /* Idle sessions are handed out under a lock */
+#include <unistd.h> /* sysconf */
+
+#include "service_api.h"
+#include "log.h" /* Asynchronous logging */
+#include "transport.h" /* RED and RESET */
+
+/*
+* Sessions shared by the threads of one process.  A session serves one
+* request at a time, so each call borrows an idle one for the length of a
+* request and hands it back; threads wait on 'returned' while every
+* session is out.  Idle sessions are a stack, so under light load the same
+* few stay warm.
+*/
+struct caesar_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t returned;
+    unsigned int nsessions;
+    unsigned int nidle;
+    caesar_session_t *sessions[CAESAR_POOL_MAX];
+    caesar_session_t *idle[CAESAR_POOL_MAX];
+};
+
+/**
+* caesar_pool_open() - open sessions for many threads to share
+* @prefix: base name of the sessions, which are named '<prefix>_<n>'; it
+*          must be unique on the host, so include the pid
+* @nsessions: sessions to open, at most CAESAR_POOL_MAX; 0 for one per
+*             online CPU
+* @priority: registration priority of every session
+* @t: CAESAR_TRANSPORT_RING, CAESAR_TRANSPORT_MQ or CAESAR_TRANSPORT_UNIX
+*
+* Sessions the service turns away are left out, so the pool may be
+* smaller than asked for.  With several service instances each session
+* goes to the instance its name hashes to; see caesar_set_shards().
+*
+* Return: the pool, or NULL with errno set as caesar_session_open() set
+*         it if the service took no session, EINVAL if prefix is too long,
+*         or ENOMEM
+*/
+caesar_pool_t *caesar_pool_open(const char prefix[], unsigned int nsessions, int priority,
+                                enum service_transport t)
+{
+    caesar_pool_t *pool;
+    char name[BUFSIZE];
+    unsigned int i;
+    int saved = EBUSY;
+
+    if (strlen(prefix) + 4 >= BUFSIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (nsessions == 0)
+        nsessions = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? (unsigned int) sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (nsessions > CAESAR_POOL_MAX)
+        nsessions = CAESAR_POOL_MAX;
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    for (i = 0; i < nsessions; i++) {
+        snprintf(name, sizeof(name), "%s_%u", prefix, i);
+        pool->sessions[pool->nsessions] = caesar_session_open(name, priority, t);
+        if (pool->sessions[pool->nsessions] != NULL)
+            pool->nsessions++;
+        else
+            saved = errno;
+    }
+    if (pool->nsessions == 0) {
+        free(pool);
+        errno = saved;
+        return NULL;
+    }
+    if (pool->nsessions < nsessions)
+        log_warn(RED"**Service API (caesar_pool_open):"RESET" Service busy, '%s' has %u of %u sessions",
+                 prefix, pool->nsessions, nsessions);
+
+    /* The first session sits on top of the stack */
+    for (i = 0; i < pool->nsessions; i++)
+        pool->idle[i] = pool->sessions[pool->nsessions - 1 - i];
+    pool->nidle = pool->nsessions;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->returned, NULL);
+    return pool;
+}
+
+/**
+* caesar_pool_acquire() - borrow a session for the calling thread alone
+* @pool: the pool from caesar_pool_open()
+*
+* Waits while every session is lent out.  The session is the caller's
+* until caesar_pool_release(), for asynchronous requests or a stream; it
+* must not be closed.
+*
+* Return: an idle session
+*/
+caesar_session_t *caesar_pool_acquire(caesar_pool_t *pool)
+{
+    caesar_session_t *sess;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->nidle == 0)
+        pthread_cond_wait(&pool->returned, &pool->lock);
+    sess = pool->idle[--pool->nidle];
+    pthread_mutex_unlock(&pool->lock);
+    return sess;
+}
+
+/**
+* caesar_pool_release() - hand a borrowed session back
+* @pool: the pool it came from
+* @sess: the session, with no request in flight and no stream open
+*
+*/
+void caesar_pool_release(caesar_pool_t *pool, caesar_session_t *sess)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->idle[pool->nidle++] = sess;
+    if (pool->nidle == pool->nsessions)
+        pthread_cond_broadcast(&pool->returned); /* caesar_pool_close() may be waiting too */
+    else
+        pthread_cond_signal(&pool->returned);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+* caesar_pool_rotate() - caesar_rotate() on any idle session of a pool
+* @pool: the pool from caesar_pool_open()
+* @message: the message; on return it holds the result
+* @shift: the shift to apply
+*
+* Safe to call from any number of threads at once.
+*
+* Return: 0 on success, -1 with errno set as for caesar_rotate()
+*/
+int caesar_pool_rotate(caesar_pool_t *pool, char message[], int shift)
+{
+    caesar_session_t *sess = caesar_pool_acquire(pool);
+    int status;
+
+    status = caesar_rotate(sess, message, shift);
+    caesar_pool_release(pool, sess);
+    return status;
+}
+
+/**
+* caesar_pool_rotate_batch() - caesar_rotate_batch() on any idle session
+* @pool: the pool from caesar_pool_open()
+* @messages: count NUL-terminated messages; on return each holds its result
+* @shifts: the shift to apply to each message
+* @count: number of messages
+*
+* Safe to call from any number of threads at once.
+*
+* Return: 0 on success, -1 with errno set as for caesar_rotate_batch()
+*/
+int caesar_pool_rotate_batch(caesar_pool_t *pool, char *messages[], const int shifts[], size_t count)
+{
+    caesar_session_t *sess = caesar_pool_acquire(pool);
+    int status;
+
+    status = caesar_rotate_batch(sess, messages, shifts, count);
+    caesar_pool_release(pool, sess);
+    return status;
+}
+
+/**
+* caesar_pool_sessions() - how many sessions a pool holds
+* @pool: the pool from caesar_pool_open()
+*/
+unsigned int caesar_pool_sessions(const caesar_pool_t *pool)
+{
+    return pool->nsessions;
+}
+
+/**
+* caesar_pool_close() - close every session of a pool
+* @pool: the pool from caesar_pool_open(); freed here
+*
+* Waits for sessions still lent out to be released first.
+*
+*/
+void caesar_pool_close(caesar_pool_t *pool)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->nidle < pool->nsessions)
+        pthread_cond_wait(&pool->returned, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nsessions; i++)
+        caesar_session_close(pool->sessions[i]);
+    pthread_cond_destroy(&pool->returned);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
@@ -0,0 +1,115 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdio.h> /* Needed for snprintf */
+#include <stdlib.h> /* Needed for qsort */
+#include <string.h> /* Needed for strcspn */
+
+#include "shards.h"
+
+/**
+* hash_key() - FNV-1a hash of a string, with a final mix
+* @key: NUL-terminated string
+* @salt: distinguishes a shard's points from each other
+*
+* FNV-1a alone leaves similar names (client1, client2, ...) close
+* together on the ring; the final mix spreads them out.
+*
+*/
+static uint64_t hash_key(const char *key, unsigned int salt)
+{
+    uint64_t h = 14695981039346656037ull ^ salt;
+
+    while (*key != '\0') {
+        h ^= (unsigned char) *key++;
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 33);
+}
+
+static int compare_points(const void *a, const void *b)
+{
+    const struct shard_point *pa = a, *pb = b;
+
+    if (pa->pos != pb->pos)
+        return pa->pos < pb->pos ? -1 : 1;
+    return pa->shard < pb->shard ? -1 : (pa->shard > pb->shard);
+}
+
+/**
+* shard_ring_parse() - build a ring from a list of namespaces
+* @ring: filled in
+* @list: comma-separated namespaces, e.g. "s0,s1,s2"
+*
+* A list of one namespace sends every name to that instance.
+*
+* Return: 0 on success, -1 if the list is empty, too long or holds an
+*         invalid or repeated namespace
+*/
+int shard_ring_parse(struct shard_ring *ring, const char *list)
+{
+    unsigned int i, j;
+    size_t len;
+
+    ring->nshards = 0;
+    for (;;) {
+        len = strcspn(list, ",");
+        if (ring->nshards == SHARDS_MAX || len == 0 || len >= IPC_NS_MAX)
+            return -1;
+        snprintf(ring->ns[ring->nshards], IPC_NS_MAX, "%.*s", (int) len, list);
+        if (!ipc_ns_valid(ring->ns[ring->nshards]))
+            return -1;
+        for (i = 0; i < ring->nshards; i++) {
+            if (strcmp(ring->ns[i], ring->ns[ring->nshards]) == 0)
+                return -1;
+        }
+        ring->nshards++;
+        if (list[len] == '\0')
+            break;
+        list += len + 1;
+    }
+
+    ring->npoints = 0;
+    for (i = 0; i < ring->nshards; i++) {
+        for (j = 0; j < SHARD_POINTS; j++) {
+            ring->points[ring->npoints].pos = hash_key(ring->ns[i], j + 1);
+            ring->points[ring->npoints].shard = i;
+            ring->npoints++;
+        }
+    }
+    qsort(ring->points, ring->npoints, sizeof(ring->points[0]), compare_points);
+    return 0;
+}
+
+/**
+* shard_ring_pick() - the shard a name belongs to
+* @ring: a ring from shard_ring_parse()
+* @key: the client name
+*
+* Return: the shard's namespace
+*/
+const char *shard_ring_pick(const struct shard_ring *ring, const char *key)
+{
+    uint64_t h = hash_key(key, 0);
+    unsigned int lo = 0, hi = ring->npoints, mid;
+
+    /* First point at or after h; past the last one the ring wraps around */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].pos < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return ring->ns[ring->points[lo % ring->npoints].shard];
+}
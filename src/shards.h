@@ -0,0 +1,50 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <stdint.h> /* Ring positions */
+
+#include "ipcns.h" /* IPC_NS_MAX */
+
+/* Environment variable listing the shards when none are set by the caller */
+#define SHARDS_ENV "CAESAR_SHARDS"
+
+/* Most service instances a client spreads its sessions over */
+#define SHARDS_MAX 16
+
+/* Points each shard has on the ring; more even out the shares */
+#define SHARD_POINTS 160
+
+struct shard_point {
+  uint64_t pos;
+  unsigned int shard;
+};
+
+/*
+* Consistent hashing of client names over service instances, each known
+* by its namespace.  Every shard owns SHARD_POINTS pseudo-random points on
+* a 64-bit ring, placed by hashing its namespace, and a name goes to the
+* owner of the first point at or after its own hash.  A shard's points do
+* not depend on the others, so adding or removing one moves only the
+* names it gains or loses, about 1/K of them.
+*/
+struct shard_ring {
+  unsigned int nshards;
+  char ns[SHARDS_MAX][IPC_NS_MAX];
+  unsigned int npoints;
+  struct shard_point points[SHARDS_MAX * SHARD_POINTS];
+};
+
+int shard_ring_parse(struct shard_ring *ring, const char *list);
+
+const char *shard_ring_pick(const struct shard_ring *ring, const char *key);
+
+#endif
@@ -0,0 +1,178 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdio.h> /* Needed for snprintf */
+#include <string.h> /* Needed for memset */
+#include <time.h> /* clock_gettime */
+#include <unistd.h> /* Needed for getpid */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h>   /* Defines mode constants */
+#include <fcntl.h>  /* Defines file descriptor constants: O_ */
+
+#include "errors.h"
+#include "stats.h"
+
+/**
+* stats_create() - create and map the statistics segment
+* @name: the segment's name, from struct ipc_names
+* @nslots: number of request slots, shown by viewers
+* @rotx_kernel: name of the rotx kernel in use
+*
+* The segment is readable by group and others so a viewer needs no write
+* access; a stale segment from a previous run is replaced.
+*
+* Return: the zeroed statistics; failures are fatal
+*/
+struct service_stats *stats_create(const char *name, unsigned int nslots, const char *rotx_kernel)
+{
+    struct service_stats *stats;
+    int fd;
+
+    shm_unlink(name);
+    if ((fd = shm_open(name, O_CREAT | O_RDWR, 0644)) == -1)
+        error_exit("shm_open (%s)", name);
+    if (ftruncate(fd, sizeof(*stats)) == -1)
+        error_exit("ftruncate (%s)", name);
+    stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (stats == MAP_FAILED)
+        error_exit("mmap (%s)", name);
+    close(fd);
+
+    /* ftruncate zero-fills, which is a valid initial state for every atomic */
+    stats->nslots = nslots;
+    stats->pid = getpid();
+    stats->start_time = time(NULL);
+    snprintf(stats->rotx_kernel, sizeof(stats->rotx_kernel), "%s", rotx_kernel);
+    atomic_thread_fence(memory_order_release);
+    stats->magic = STATS_MAGIC;
+    return stats;
+}
+
+/**
+* stats_attach() - map a running service's statistics read-only
+* @name: the segment's name, from struct ipc_names
+*
+* Return: the statistics, or NULL if no service has published them
+*/
+const struct service_stats *stats_attach(const char *name)
+{
+    const struct service_stats *stats;
+    struct stat sb;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) == -1)
+        return NULL;
+    if (fstat(fd, &sb) == -1 || (size_t) sb.st_size < sizeof(*stats)) {
+        close(fd);
+        return NULL;
+    }
+    stats = mmap(NULL, sizeof(*stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED || stats->magic != STATS_MAGIC)
+        return NULL;
+    return stats;
+}
+
+/**
+* stats_now_ns() - monotonic clock in nanoseconds
+*/
+uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+* stats_hist_add() - record one latency sample
+* @hist: the histogram
+* @ns: the sample in nanoseconds
+*
+*/
+void stats_hist_add(struct stats_hist *hist, uint64_t ns)
+{
+    unsigned int b = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+
+    if (b >= STATS_BUCKETS)
+        b = STATS_BUCKETS - 1;
+    atomic_fetch_add_explicit(&hist->buckets[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+}
+
+/**
+* stats_hist_read() - copy a histogram
+* @hist: the live histogram
+* @snap: receives the copy
+*
+*/
+void stats_hist_read(const struct stats_hist *hist, struct stats_hist_snap *snap)
+{
+    unsigned int b;
+
+    snap->count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    snap->sum_ns = atomic_load_explicit(&hist->sum_ns, memory_order_relaxed);
+    for (b = 0; b < STATS_BUCKETS; b++)
+        snap->buckets[b] = atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+}
+
+/**
+* stats_hist_percentile() - estimate a percentile from a histogram copy
+* @snap: the copy, or the difference of two copies
+* @p: percentile, 0 < p <= 100
+*
+* Return: upper bound in nanoseconds of the bucket holding the percentile,
+*         or 0 for an empty histogram
+*/
+uint64_t stats_hist_percentile(const struct stats_hist_snap *snap, double p)
+{
+    unsigned long long total = 0, seen = 0, rank;
+    unsigned int b;
+
+    for (b = 0; b < STATS_BUCKETS; b++)
+        total += snap->buckets[b];
+    if (total == 0)
+        return 0;
+
+    rank = (unsigned long long) (p / 100.0 * total + 0.999999);
+    for (b = 0; b < STATS_BUCKETS - 1; b++) {
+        seen += snap->buckets[b];
+        if (seen >= rank)
+            break;
+    }
+    return b == 0 ? 0 : (uint64_t) 1 << b;
+}
+
+/**
+* stats_prio_class() - index of a registration priority in the per-priority counters
+* @prio: message queue priority
+*/
+unsigned int stats_prio_class(unsigned int prio)
+{
+    return prio < STATS_PRIOS ? prio : STATS_PRIOS - 1;
+}
+
+/**
+* stats_gauge_max() - set a gauge and raise its high-water mark
+* @gauge: the gauge
+* @max: its high-water mark
+* @value: the sampled value
+*
+*/
+void stats_gauge_max(atomic_uint *gauge, atomic_uint *max, unsigned int value)
+{
+    unsigned int old = atomic_load_explicit(max, memory_order_relaxed);
+
+    atomic_store_explicit(gauge, value, memory_order_relaxed);
+    while (value > old &&
+           !atomic_compare_exchange_weak_explicit(max, &old, value,
+                memory_order_relaxed, memory_order_relaxed))
+        ;
+}
@@ -0,0 +1,112 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h> /* Fixed-width counters shared between processes */
+#include <stdatomic.h> /* Counters are bumped by several service threads */
+#include <sys/types.h> /* pid_t */
+
+/* Statistics segment, written by the service and mapped read-only by viewers; see ipcns.h */
+#define STATS_SHM_NAME "/shm_caesar_stats"
+#define STATS_MAGIC 0x43535431u /* "CST1" */
+
+/* Bucket i of a histogram counts samples in [2^(i-1), 2^i) nanoseconds */
+#define STATS_BUCKETS 48
+
+/* Registration priorities are counted separately up to 10; higher ones go in the last class */
+#define STATS_PRIOS 11
+
+/* How often the sampler thread refreshes the gauges, in milliseconds */
+#define STATS_SAMPLE_MS 100
+
+/* Values of the service's state gauge */
+#define STATS_SERVING 0
+#define STATS_DRAINING 1      /* refusing registrations until its clients leave */
+#define STATS_HANDED_OVER 2   /* draining, with a new service taking registrations */
+
+struct stats_hist {
+  atomic_ullong count;
+  atomic_ullong sum_ns;
+  atomic_ullong buckets[STATS_BUCKETS];
+};
+
+/* A copy of a histogram; differences of two copies cover an interval */
+struct stats_hist_snap {
+  unsigned long long count;
+  unsigned long long sum_ns;
+  unsigned long long buckets[STATS_BUCKETS];
+};
+
+/*
+* Counters only ever grow, so a viewer computes rates from two snapshots.
+* Gauges are sampled every STATS_SAMPLE_MS by the service; everything is
+* updated with relaxed atomics and may be read while it changes.
+*/
+struct service_stats {
+  uint32_t magic;
+  uint32_t nslots;
+  pid_t pid;
+  int64_t start_time;              /* seconds since the Epoch */
+  char rotx_kernel[16];
+
+  /* Counters */
+  atomic_ullong requests;          /* requests processed, both transports */
+  atomic_ullong ring_requests;     /* popped off the submission ring */
+  atomic_ullong mq_requests;       /* 'caesar' instructions */
+  atomic_ullong sock_requests;     /* on Unix socket connections */
+  atomic_ullong batches;
+  atomic_ullong failures;          /* requests with nothing valid staged */
+  atomic_ullong bytes_rotated;
+  atomic_ullong registrations;
+  atomic_ullong deregistrations;
+  atomic_ullong dropped_clients;
+  atomic_ullong reaped_clients;    /* clients that exited without deregistering */
+  atomic_ullong busy_replies;      /* registrations turned away by admission control */
+  atomic_ullong sched_urgent;      /* ring requests served ahead of their turn for a deadline */
+  atomic_ullong sched_late;        /* ring requests finished after their deadline */
+  atomic_ullong cache_hits;        /* messages answered from the result cache */
+  atomic_ullong cache_misses;      /* messages rotated and added to it */
+  atomic_ullong cache_collapsed;   /* messages that waited for an identical one being rotated */
+  atomic_ullong prio_registrations[STATS_PRIOS];
+  atomic_ullong prio_requests[STATS_PRIOS];
+  atomic_ullong prio_wait_ns[STATS_PRIOS]; /* time ring requests spent in the scheduler */
+
+  /* Gauges */
+  atomic_uint state;               /* STATS_SERVING, STATS_DRAINING or STATS_HANDED_OVER */
+  atomic_uint reg_queue_depth;     /* mq_curmsgs of the registration queue */
+  atomic_uint reg_queue_max;
+  atomic_uint ring_depth;          /* requests waiting on the submission ring */
+  atomic_uint ring_depth_max;
+  atomic_uint slots_in_use;
+  atomic_uint pending_registrations; /* registrations waiting for a free slot */
+
+  /* Latency histograms */
+  struct stats_hist rotx;          /* service time of one request */
+  struct stats_hist sem_wait;      /* waiting for a free request slot */
+};
+
+struct service_stats *stats_create(const char *name, unsigned int nslots, const char *rotx_kernel);
+
+const struct service_stats *stats_attach(const char *name);
+
+uint64_t stats_now_ns(void);
+
+void stats_hist_add(struct stats_hist *hist, uint64_t ns);
+
+void stats_hist_read(const struct stats_hist *hist, struct stats_hist_snap *snap);
+
+uint64_t stats_hist_percentile(const struct stats_hist_snap *snap, double p);
+
+unsigned int stats_prio_class(unsigned int prio);
+
+void stats_gauge_max(atomic_uint *gauge, atomic_uint *max, unsigned int value);
+
+#endif
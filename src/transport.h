@@ -0,0 +1,196 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+/*
+* Internals of the client library, shared by service_api.c and the
+* transports; callers only see service_api.h.
+*/
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>  /* Used for malloc */
+#include <sys/mman.h> /* mmap and munmap */
+#include <sys/stat.h>   /* Defines mode constants */
+#include <fcntl.h>  /* Defines file descriptor constants: O_ */
+#include <mqueue.h>   /* Required to implement POSIX message queues */
+#include <semaphore.h> /* Needed for semaphore */
+#include <unistd.h> /* Needed for write function */
+
+#include "service_api.h"
+#include "errors.h"
+#include "caesar_ipc.h" /* Shared memory layout and IPC object names */
+#include "ipcns.h" /* The session's service instance */
+
+/* Used for color in Linux terminal output */
+#define RESET "\033[0m"
+#define RED "\033[31m"
+#define GREEN "\033[32m"
+
+/*
+* Every started request needs a completion queue entry, and tokens keep
+* the table index in their low bits.
+*/
+#if CAESAR_MAX_INFLIGHT > CQ_SIZE || (CAESAR_MAX_INFLIGHT & (CAESAR_MAX_INFLIGHT - 1)) != 0
+#error "CAESAR_MAX_INFLIGHT must be a power of two no larger than CQ_SIZE"
+#endif
+
+/*
+* A request started by caesar_rotate_async().  Its message travels in its
+* own payload arena buffer, so any number of them can share the session's
+* slot.  The token's low bits are the index in the session's table.
+*/
+enum async_state {
+    ASYNC_FREE,
+    ASYNC_PENDING,   /* submitted, not completed yet */
+    ASYNC_DONE       /* result copied back, not collected yet */
+};
+
+struct async_request {
+    enum async_state state;
+    caesar_token_t token;
+    char *message;    /* caller's buffer, receives the result */
+    size_t len;
+    uint64_t payload;
+    int status;
+};
+
+/*
+* Chunks of a stream form a ring of 'depth' buffers.  [head, tail) are in
+* the service or waiting to be read back, in submission order; 'held' is
+* set while the caller reads the result at head.  Where the buffers live
+* is up to the transport: 'payload' is an arena buffer, or the offset of
+* a chunk's header in a memfd region on the Unix socket transport.
+*/
+struct stream_chunk {
+    uint64_t payload;
+    caesar_token_t token;
+    int status;
+};
+
+struct caesar_stream {
+    caesar_session_t *sess;
+    size_t chunk;
+    unsigned int depth;
+    int shift;
+    unsigned int region;  /* Unix socket transport only */
+    unsigned int head;
+    unsigned int tail;
+    int held;
+    struct stream_chunk chunks[CAESAR_STREAM_MAX_DEPTH];
+};
+
+/*
+* A memfd shared with the service over the Unix socket transport, holding
+* arena_buf headers and their data.  Region 0 stages synchronous requests;
+* each open stream holds one of the others.
+*/
+struct sock_region {
+    int fd;
+    char *base;       /* NULL until first used */
+    size_t size;
+    int shared;       /* the service has mapped it at its current size */
+    int in_use;       /* held by a stream */
+};
+
+/*
+* Everything a client needs to talk to the service, set up once by
+* caesar_session_open() and reused by every caesar_rotate().  The fields
+* after 'ops' belong to the transports.
+*/
+struct caesar_session {
+    char name[BUFSIZE];
+    enum service_transport transport;
+    const struct transport_ops *ops;
+    struct ipc_names ipc;  /* of the shard the name hashes to */
+    int slot;              /* 0 on transports without slots */
+    uint64_t deadline_ns;  /* budget of each ring request, 0 for none */
+
+    /* Mapping of the service's request segment */
+    struct shared_memory *shm;
+    size_t shm_size;
+
+    /* Client queues, kept open for the life of the session */
+    char send_name[BUFSIZE + 32];
+    char receive_name[BUFSIZE + 32];
+    mqd_t mqd_send;
+    mqd_t mqd_receive;
+    char *buffer;
+    long msgsize;
+    int armed;        /* completion ring armed, notifications may be queued */
+
+    /* Unix socket transport: the connection and the memfds shared over it */
+    int sock;
+    struct sock_region regions[SOCK_REGIONS];
+
+    /* Asynchronous requests; synchronous ones complete with tag CAESAR_TOKEN_NONE */
+    struct async_request async[CAESAR_MAX_INFLIGHT];
+    unsigned int seq;
+};
+
+/*
+* One way of carrying requests to the service.  service_api.c keeps the
+* bookkeeping every transport shares (sessions, tokens, stream order) and
+* calls through a session's ops for the rest.  A transport without
+* submit runs caesar_rotate_async() requests before returning them, one
+* without arm never lets caesar_poll() sleep, and reap and wait may only
+* be NULL if nothing completes asynchronously, stream chunks included.
+* Adding a transport takes a struct like this and an entry in the table
+* in service_api.c.
+*/
+struct transport_ops {
+  const char *name;            /* as given to --transport */
+
+  /* Connect or register; -1 with errno set if the service turned us away or failed */
+  int (*open)(caesar_session_t *sess, unsigned int prio);
+  void (*close)(caesar_session_t *sess);
+
+  /* Synchronous requests; the result replaces the input */
+  int (*rotate)(caesar_session_t *sess, char *message, size_t len, int shift);
+  int (*rotate_batch)(caesar_session_t *sess, char *messages[], const int shifts[], size_t count);
+
+  /* Start r, claimed by async_claim(); -1 with errno set if it could not be */
+  int (*submit)(caesar_session_t *sess, struct async_request *r, int shift);
+  /* Finish requests whose completions have arrived; returns how many */
+  int (*reap)(caesar_session_t *sess);
+  /* Sleep until a completion may have arrived */
+  void (*wait)(caesar_session_t *sess);
+  /* Make the session fd signal the next completion; -1 if one came meanwhile */
+  int (*arm)(caesar_session_t *sess);
+  int (*fd)(caesar_session_t *sess);
+
+  /* Stream chunk buffers: set up st->chunks, find one, send one, free them */
+  int (*stream_open)(caesar_stream_t *st);
+  struct arena_buf *(*chunk_buf)(caesar_stream_t *st, const struct stream_chunk *c);
+  int (*chunk_submit)(caesar_stream_t *st, struct stream_chunk *c, size_t len);
+  void (*stream_close)(caesar_stream_t *st);
+};
+
+extern const struct transport_ops ring_transport;
+extern const struct transport_ops mq_transport;
+extern const struct transport_ops unix_transport;
+
+struct async_request *async_claim(caesar_session_t *sess);
+
+struct async_request *async_claim_wait(caesar_session_t *sess);
+
+struct async_request *async_pending(caesar_session_t *sess, caesar_token_t tag);
+
+void async_finish(struct async_request *r, int status);
+
+void async_fail_pending(caesar_session_t *sess);
+
+size_t batch_size(char *messages[], size_t count);
+
+void pack_batch(char *data, char *messages[], const int shifts[], size_t count);
+
+void unpack_batch(const char *data, char *messages[], size_t count);
+
+#endif
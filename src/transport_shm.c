@@ -0,0 +1,938 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <time.h> /* struct timespec for mq_timedreceive */
+#include <errno.h> /* Failures are reported to the caller in errno */
+#include <pthread.h> /* The buffer pool is created once, by whichever thread registers first */
+
+#include "log.h" /* Asynchronous logging */
+#include "objpool.h" /* Receive buffers */
+#include "transport.h"
+
+/*
+* The registered transports: clients register over the registration
+* queue for a request slot in the shared memory segment, and payloads
+* are staged in the slot or the segment's payload arena.  'ring' then
+* signals requests on the lock-free rings, 'mq' with the original
+* 'caesar'/'fin' handshake on the client message queues.
+*/
+
+/* Registration attempts before caesar_session_open() gives up on a busy service */
+#define REGISTER_ATTEMPTS 8
+
+/* How long one attempt waits for room on the registration queue */
+#define REGISTER_TIMEOUT_MS 250
+
+/* Longest backoff after the first busy attempt is BACKOFF_BASE_US, doubling up to BACKOFF_CAP_US */
+#define BACKOFF_BASE_US 2000
+#define BACKOFF_CAP_US 1000000
+
+/* How long a client waits for a segment being replaced by a new service */
+#define MAP_RETRY_MS 500
+
+/* A service whose heartbeat stood still this long while we waited on it has died */
+#define SERVICE_TIMEOUT_MS 3000
+
+/* Receive buffers of closed sessions are recycled, in slabs of this many */
+#define BUFFER_POOL_SIZE 16
+
+static struct obj_pool *buffer_pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/* Runs the request staged in the session's slot; 0 on success */
+typedef int (*slot_run_fn)(caesar_session_t *sess);
+
+/**
+* create_pool() - create the receive buffer pool
+*
+* A receive buffer holds a whole message plus a terminating NUL.  If it
+* cannot be created, sessions on these transports fail to open.
+*
+*/
+static void create_pool(void)
+{
+    buffer_pool = obj_pool_create(MQ_MSGSIZE + 1, BUFFER_POOL_SIZE);
+}
+
+/**
+* map_shared_memory() - map the service's request segment read/write
+* @name: the segment's name in the session's namespace
+* @size: set to the size of the mapping, needed later for munmap
+*
+* The number of slots is chosen by the service, so the size of the segment
+* is taken from the shared memory object itself.  If the service
+* prefaulted the segment the client does too, so its requests do not pay
+* page faults on first touch.  A service taking over unlinks the segment
+* and creates its own, so a missing or still empty one is waited for.
+*
+* Return: pointer to the mapped segment, or NULL with errno set; ENOENT
+*         if no service has created it
+*/
+static struct shared_memory *map_shared_memory(const char *name, size_t *size)
+{
+    struct shared_memory *shared_mem_ptr;
+    struct timespec tick = { 0, 1000000L };
+    struct stat sb;
+    unsigned int waited;
+    int fd_shm, saved;
+
+    for (waited = 0; ; waited++) {
+        if ((fd_shm = shm_open (name, O_RDWR, 0)) == -1) {
+            if (errno != ENOENT || waited == MAP_RETRY_MS)
+                return NULL;
+        } else {
+            if (fstat(fd_shm, &sb) == -1) {
+                saved = errno;
+                close(fd_shm);
+                errno = saved;
+                return NULL;
+            }
+            if ((size_t) sb.st_size >= sizeof(*shared_mem_ptr))
+                break;
+            close(fd_shm);
+            if (waited == MAP_RETRY_MS) {
+                errno = ENOENT;
+                return NULL;
+            }
+        }
+        nanosleep(&tick, NULL);
+    }
+
+    shared_mem_ptr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0);
+    saved = errno;
+    close(fd_shm);
+    if (shared_mem_ptr == MAP_FAILED) {
+        errno = saved;
+        return NULL;
+    }
+
+    placement_attach(shared_mem_ptr, sb.st_size, shared_mem_ptr->arena_offset, shared_mem_ptr->placement);
+    *size = sb.st_size;
+    return shared_mem_ptr;
+}
+
+/**
+* stage_request() - write a message and shift into a request slot
+* @shm: the mapped request segment
+* @slot: our request slot
+* @message: the message to encode/decode
+* @len: length of message
+* @shift: the shift to apply
+*
+* Messages that fit in the slot are copied inline, larger ones into a
+* buffer allocated from the payload arena.  The slot is ours until
+* deregistration, so no lock is needed on it.
+*
+* Return: 0 on success, -1 with errno set to ENOMEM if the arena has no
+*         room for the message
+*/
+static int stage_request(struct shared_memory *shm, unsigned int slot,
+                         const char *message, size_t len, int shift)
+{
+    struct request_slot *req = &shm->slots[slot];
+    struct arena_buf *buf;
+
+    if (len <= BUFSIZE) {
+        memcpy(req->message, message, len);
+        req->message[len] = '\0';
+        req->payload = ARENA_NONE;
+    } else {
+        req->payload = arena_alloc(&shm->arena, SHM_ARENA(shm), len, slot);
+        if (req->payload == ARENA_NONE)
+            return -1;
+        buf = arena_get(&shm->arena, SHM_ARENA(shm), req->payload);
+        memcpy(buf->data, message, len);
+    }
+    req->kind = REQ_MESSAGE;
+    req->shift = shift;
+    atomic_store_explicit(&req->state, SLOT_READY, memory_order_release);
+    return 0;
+}
+
+/**
+* collect_result() - copy a rotated message out of a request slot
+* @shm: the mapped request segment
+* @req: our request slot, in state DONE
+* @message: receives the result; rotx preserves length so it fits
+* @len: length of message
+*
+* Frees the arena buffer, if any, and hands the slot back for reuse.
+*
+*/
+static void collect_result(struct shared_memory *shm, struct request_slot *req,
+                           char *message, size_t len)
+{
+    if (req->payload == ARENA_NONE) {
+        memcpy(message, req->message, len);
+    } else {
+        memcpy(message, arena_get(&shm->arena, SHM_ARENA(shm), req->payload)->data, len);
+        arena_free(&shm->arena, SHM_ARENA(shm), req->payload);
+        req->payload = ARENA_NONE;
+    }
+    atomic_store_explicit(&req->state, SLOT_CLAIMED, memory_order_release);
+}
+
+/**
+* release_request() - free a request's arena buffer and reset the slot
+* @shm: the mapped request segment
+* @req: our request slot
+*
+*/
+static void release_request(struct shared_memory *shm, struct request_slot *req)
+{
+    if (req->payload != ARENA_NONE) {
+        arena_free(&shm->arena, SHM_ARENA(shm), req->payload);
+        req->payload = ARENA_NONE;
+    }
+    req->kind = REQ_MESSAGE;
+    atomic_store_explicit(&req->state, SLOT_CLAIMED, memory_order_release);
+}
+
+/**
+* ring_complete() - finish the asynchronous request a completion names
+* @sess: the session
+* @done: the completion popped off the slot's completion ring
+*
+* Copies the result into the caller's buffer and frees the request's arena
+* buffer.  The request stays in the table until it is collected.
+*
+*/
+static void ring_complete(caesar_session_t *sess, const struct cq_entry *done)
+{
+    struct async_request *r = async_pending(sess, done->tag);
+
+    if (r == NULL)
+        return;
+
+    /* Stream chunks have no message; their buffer belongs to the stream */
+    if (r->message != NULL) {
+        if (done->status == 0)
+            memcpy(r->message, arena_get(&sess->shm->arena, SHM_ARENA(sess->shm), r->payload)->data, r->len);
+        arena_free(&sess->shm->arena, SHM_ARENA(sess->shm), r->payload);
+    }
+    r->payload = ARENA_NONE;
+    async_finish(r, done->status);
+}
+
+/**
+* request_deadline() - deadline of a request submitted now
+* @sess: the session
+*
+* Return: CLOCK_MONOTONIC nanoseconds, or 0 if the session sets no deadline
+*/
+static uint64_t request_deadline(caesar_session_t *sess)
+{
+    struct timespec ts;
+
+    if (sess->deadline_ns == 0)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec + sess->deadline_ns;
+}
+
+/**
+* service_gone() - tell whether the service died while we waited on it
+* @sess: the session
+* @beat: the segment's heartbeat from before the wait
+*
+* Called after a wait of SERVICE_TIMEOUT_MS.  Requests still in flight
+* will never complete, so they are failed.
+*
+* Return: nonzero, with errno set to EPIPE, if the heartbeat has not moved
+*/
+static int service_gone(caesar_session_t *sess, unsigned int beat)
+{
+    if (atomic_load_explicit(&sess->shm->heartbeat, memory_order_relaxed) != beat)
+        return 0;
+    async_fail_pending(sess);
+    errno = EPIPE;
+    return 1;
+}
+
+/**
+* ring_submit() - push a request onto the service's submission ring
+* @sess: the session
+* @tag: CAESAR_TOKEN_NONE for the request staged in the slot, or an
+*       asynchronous request's token
+* @kind: REQ_MESSAGE or REQ_BATCH
+* @shift: the shift to apply
+* @payload: the request's arena buffer, or ARENA_NONE for the slot's
+*
+* While the ring is full we sleep until the service frees a cell.
+*
+* Return: 0 on success, -1 with errno set to EPIPE if the service died
+*/
+static int ring_submit(caesar_session_t *sess, caesar_token_t tag, unsigned int kind,
+                       int shift, uint64_t payload)
+{
+    struct request_slot *req = &sess->shm->slots[sess->slot];
+    struct sq_entry sqe;
+    unsigned int beat;
+
+    sqe.slot = sess->slot;
+    sqe.tag = tag;
+    sqe.shift = shift;
+    sqe.kind = kind;
+    sqe.payload = payload;
+    sqe.deadline = request_deadline(sess);
+    atomic_fetch_add_explicit(&req->submitted, 1, memory_order_relaxed);
+    while (sq_push(&sess->shm->sq, &sqe, &req->sq_claim) == -1) {
+        beat = atomic_load_explicit(&sess->shm->heartbeat, memory_order_relaxed);
+        if (sq_wait_room(&sess->shm->sq, SERVICE_TIMEOUT_MS) == -1 && service_gone(sess, beat)) {
+            atomic_fetch_sub_explicit(&req->submitted, 1, memory_order_relaxed);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+* ring_run() - run one request over the shared memory rings
+* @sess: the session, whose slot is already staged (state READY)
+*
+* Submits the slot on the service's submission ring and waits for its
+* completion on the slot's own completion ring.  While the service is busy
+* neither side makes a system call.  Completions of asynchronous requests
+* that arrive meanwhile are handled on the way.
+*
+* Return: 0 on success, -1 with errno set to EIO if the service failed the
+*         request, or to EPIPE if the service died
+*/
+static int ring_run(caesar_session_t *sess)
+{
+    struct complete_ring *cq = &sess->shm->slots[sess->slot].cq;
+    struct cq_entry done;
+    unsigned int beat;
+
+    if (ring_submit(sess, CAESAR_TOKEN_NONE, 0, 0, ARENA_NONE) == -1)
+        return -1;
+    for (;;) {
+        if (cq_pop(cq, &done) == -1) {
+            beat = atomic_load_explicit(&sess->shm->heartbeat, memory_order_relaxed);
+            if (cq_wait(cq, SERVICE_TIMEOUT_MS) == -1 && service_gone(sess, beat))
+                return -1;
+            continue;
+        }
+        if (done.tag == CAESAR_TOKEN_NONE) {
+            if (done.status != 0) {
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+        }
+        ring_complete(sess, &done);
+    }
+}
+
+/**
+* mq_run() - run one request over the 'caesar'/'fin' handshake
+* @sess: the session, whose slot is already staged (state READY)
+*
+* Return: 0 once 'fin' has arrived, -1 with errno set if either queue
+*         failed, EPIPE if the service died, or EIO on any other reply
+*/
+static int mq_run(caesar_session_t *sess)
+{
+    struct timespec until;
+    ssize_t numRead;
+    unsigned int priority = 0, beat;
+
+    if(mq_send(sess->mqd_send, "caesar", strlen("caesar"), priority))
+        return -1;
+
+    /* Now receive 'fin' response saying the text has been encoded */
+    do {
+        beat = atomic_load_explicit(&sess->shm->heartbeat, memory_order_relaxed);
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += SERVICE_TIMEOUT_MS / 1000;
+        numRead = mq_timedreceive(sess->mqd_receive, sess->buffer, sess->msgsize, &priority, &until);
+    } while (numRead == -1 && (errno == EINTR || (errno == ETIMEDOUT && !service_gone(sess, beat))));
+    if (numRead == -1)
+        return -1;
+
+    if (numRead == 3 && strncmp(sess->buffer, "fin", 3) == 0)
+        return 0;
+    errno = EIO;
+    return -1;
+}
+
+/**
+* send_registration() - send a registration message to the service
+* @sess: the session, named, with the namespace of its service and its
+*        segment mapped
+* @flags: REG_* flags
+* @prio: message priority
+*
+* Waits at most REGISTER_TIMEOUT_MS for room on the registration queue,
+* so an overloaded service is noticed instead of blocking forever.  The
+* segment's generation tells the service which segment the slot is in.
+*
+* Return: 0 on success, -1 with errno set to ETIMEDOUT if the queue
+*         stayed full, or to why it could not be opened or written
+*/
+static int send_registration(const caesar_session_t *sess, unsigned int flags, unsigned int prio)
+{
+    struct registration reg;
+    struct timespec timeout;
+    mqd_t mqd;
+    int ret = 0, saved;
+
+    /* Open Registration queue to register client */
+    mqd = mq_open(sess->ipc.reg_mq, O_RDWR);
+    if (mqd == (mqd_t) -1)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.flags = flags;
+    reg.generation = sess->shm->generation;
+    reg.pid = getpid();
+    snprintf(reg.name, sizeof(reg.name), "%s", sess->name);
+
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_nsec += REGISTER_TIMEOUT_MS * 1000000L;
+    timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+    timeout.tv_nsec %= 1000000000L;
+    if (mq_timedsend(mqd, (const char *) &reg, sizeof(reg), prio, &timeout) == -1)
+        ret = -1;
+    saved = errno;
+    mq_close(mqd);
+    errno = saved;
+    return ret;
+}
+
+/**
+* backoff() - sleep before retrying a registration the service turned down
+* @attempt: attempts made so far, from 1
+* @seed: per-session random state
+*
+* Sleeps a uniformly random time up to BACKOFF_BASE_US * 2^(attempt - 1),
+* capped at BACKOFF_CAP_US ("full jitter"), so clients turned away
+* together do not come back together.
+*
+*/
+static void backoff(unsigned int attempt, unsigned int *seed)
+{
+    struct timespec delay;
+    unsigned long limit = BACKOFF_BASE_US, usec;
+
+    while (--attempt > 0 && limit < BACKOFF_CAP_US)
+        limit *= 2;
+    if (limit > BACKOFF_CAP_US)
+        limit = BACKOFF_CAP_US;
+    usec = (unsigned long) rand_r(seed) % (limit + 1);
+    delay.tv_sec = usec / 1000000;
+    delay.tv_nsec = (usec % 1000000) * 1000;
+    nanosleep(&delay, NULL);
+}
+
+/**
+* register_session() - register with the service, backing off while it is busy
+* @sess: the session, whose queues are open
+* @prio: registration priority
+*
+* The service answers 'ack <slot>', or 'busy' while it sheds load; a
+* registration queue that stays full counts as busy too.  The segment is
+* mapped first, since the slot is in it; 'stale' means a new service has
+* replaced it, which is mapped and registered with right away.
+*
+* Return: 0 once acked, -1 with errno set to EBUSY if the service was busy
+*         REGISTER_ATTEMPTS times, EPROTO if it sent something else, or to
+*         why the segment or a queue failed
+*/
+static int register_session(caesar_session_t *sess, unsigned int prio)
+{
+    unsigned int attempt, reply_prio, seed;
+    ssize_t numRead;
+
+    seed = (unsigned int) getpid() ^ (unsigned int) (uintptr_t) sess ^ (unsigned int) time(NULL);
+    for (attempt = 1; ; attempt++) {
+        if (sess->shm == NULL &&
+            (sess->shm = map_shared_memory(sess->ipc.shm, &sess->shm_size)) == NULL)
+            return -1;
+        if (send_registration(sess, (sess->transport == CAESAR_TRANSPORT_RING) ? REG_RING : 0, prio) == 0) {
+            /* Now wait on the client receive queue for the service's reply */
+            do {
+                numRead = mq_receive(sess->mqd_receive, sess->buffer, sess->msgsize, &reply_prio);
+            } while (numRead == -1 && errno == EINTR);
+            if (numRead == -1)
+                return -1;
+            sess->buffer[numRead] = '\0';
+            log_info(GREEN"++%s Queue:"RESET" Read '%s'; priority = %u", sess->receive_name, sess->buffer, reply_prio);
+            if (sscanf(sess->buffer, "ack %d", &sess->slot) == 1)
+                return 0;
+            if (strcmp(sess->buffer, "stale") == 0 && attempt < REGISTER_ATTEMPTS) {
+                munmap(sess->shm, sess->shm_size);
+                sess->shm = NULL;
+                continue;
+            }
+            if (strcmp(sess->buffer, "busy") != 0 && strcmp(sess->buffer, "stale") != 0) {
+                log_warn(RED"**Service API (caesar_session_open):"RESET" unexpected reply '%s'", sess->buffer);
+                errno = EPROTO;
+                return -1;
+            }
+        } else if (errno != ETIMEDOUT) {
+            return -1;
+        }
+        if (attempt == REGISTER_ATTEMPTS) {
+            errno = EBUSY;
+            return -1;
+        }
+        log_warn(RED"**Service API (caesar_session_open):"RESET" Service busy, retrying '%s'", sess->name);
+        backoff(attempt, &seed);
+    }
+}
+
+/**
+* shm_open_session() - register for a request slot and map the segment
+* @sess: the session, named
+* @prio: registration priority
+*
+* Creates the client queues, maps the request segment, registers with the
+* service (which reserves a request slot and acks with its index) and
+* takes a receive buffer.  While the service is overloaded it answers
+* 'busy', and registration is retried with jittered exponential backoff.
+*
+* Return: 0 on success, -1 with errno set to EBUSY if the service stayed
+*         busy, or to why the queues, segment or buffer could not be set up
+*/
+static int shm_open_session(caesar_session_t *sess, unsigned int prio)
+{
+    struct mq_attr attr;
+    int saved;
+
+    pthread_once(&pool_once, create_pool);
+    if (buffer_pool == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(sess->receive_name, sizeof(sess->receive_name), "/mq_received_by_%s", sess->name);
+    snprintf(sess->send_name, sizeof(sess->send_name), "/mq_sent_from_%s", sess->name);
+
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = MQ_MSGSIZE;
+    sess->mqd_receive = (mqd_t) -1;
+    sess->buffer = NULL;
+    sess->shm = NULL;
+
+    /* Create both client queues before registering so the ack cannot race them */
+    sess->mqd_send = mq_open(sess->send_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
+    if (sess->mqd_send == (mqd_t) -1)
+        return -1;
+    sess->mqd_receive = mq_open(sess->receive_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
+    if (sess->mqd_receive == (mqd_t) -1)
+        goto fail;
+
+    /* A stale queue of the same name keeps its own attributes */
+    if(mq_getattr(sess->mqd_receive, &attr) == -1)
+        goto fail;
+    if (attr.mq_msgsize > MQ_MSGSIZE) {
+        log_warn(RED"**Service API (caesar_session_open):"RESET" %s has messages of %ld bytes", sess->receive_name, attr.mq_msgsize);
+        errno = EINVAL;
+        goto fail;
+    }
+    sess->msgsize = attr.mq_msgsize;
+    if ((sess->buffer = obj_pool_get(buffer_pool)) == NULL)
+        goto fail;
+
+    log_info(RED"**Service API (caesar_session_open):"RESET" Registering '%s' with the service.", sess->name);
+
+    // First Stage of QoS -- setting priority for registration
+    if (register_session(sess, prio) == -1) {
+        if (errno == EBUSY) {
+            log_warn(RED"**Service API (caesar_session_open):"RESET" Service busy, giving up on '%s'", sess->name);
+            errno = EBUSY;
+        }
+        goto fail;
+    }
+
+    if (sess->slot < 0 || (unsigned int) sess->slot >= sess->shm->nslots) {
+        errno = EPROTO;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    saved = errno;
+    mq_close(sess->mqd_send);
+    mq_unlink(sess->send_name);
+    if (sess->mqd_receive != (mqd_t) -1) {
+        mq_close(sess->mqd_receive);
+        mq_unlink(sess->receive_name);
+    }
+    obj_pool_put(buffer_pool, sess->buffer);
+    if (sess->shm != NULL)
+        munmap(sess->shm, sess->shm_size);
+    errno = saved;
+    return -1;
+}
+
+/**
+* shm_close_session() - return the request slot and unlink the client queues
+* @sess: the session, already deregistered
+*
+* Failures are only logged: the session is gone either way.
+*
+*/
+static void shm_close_session(caesar_session_t *sess)
+{
+    /* Release our request slot and count it as free again */
+    atomic_store_explicit(&sess->shm->slots[sess->slot].state, SLOT_FREE, memory_order_release);
+    if (sem_post (&sess->shm->free_slots) == -1)
+        log_warn(RED"**Service API (caesar_session_close):"RESET" sem_post: %s", strerror(errno));
+
+    munmap(sess->shm, sess->shm_size);
+
+    mq_close(sess->mqd_send);
+    mq_close(sess->mqd_receive);
+    if(mq_unlink(sess->receive_name) == -1)
+        log_warn(RED"**Service API (caesar_session_close):"RESET" mq_unlink (%s): %s", sess->receive_name, strerror(errno));
+    if(mq_unlink(sess->send_name) == -1)
+        log_warn(RED"**Service API (caesar_session_close):"RESET" mq_unlink (%s): %s", sess->send_name, strerror(errno));
+
+    obj_pool_put(buffer_pool, sess->buffer);
+}
+
+/**
+* slot_rotate() - run one message through the session's request slot
+* @sess: the session
+* @message: the message; receives the result
+* @len: length of message
+* @shift: the shift to apply
+* @run: signals the staged slot and waits for the service
+*
+* Return: 0 on success, -1 with errno set to ENOMEM if the arena has no
+*         room for the message, or EIO if the service did not process it
+*/
+static int slot_rotate(caesar_session_t *sess, char *message, size_t len, int shift, slot_run_fn run)
+{
+    struct request_slot *req = &sess->shm->slots[sess->slot];
+    int status;
+
+    if (stage_request(sess->shm, sess->slot, message, len, shift) == -1)
+        return -1;
+    status = run(sess);
+    if (status == 0 && atomic_load_explicit(&req->state, memory_order_acquire) == SLOT_DONE) {
+        collect_result(sess->shm, req, message, len);
+        return 0;
+    }
+    if (status == 0)
+        errno = EIO;
+    release_request(sess->shm, req);
+    return -1;
+}
+
+/**
+* slot_rotate_batch() - run a batch through the session's request slot
+* @sess: the session
+* @messages: count NUL-terminated messages; on return each holds its result
+* @shifts: the shift to apply to each message
+* @count: number of messages, at least 1
+* @run: signals the staged slot and waits for the service
+*
+* The whole batch travels in one payload arena buffer, so the service is
+* signalled once and completes once.
+*
+* Return: 0 on success, -1 with errno set to ENOMEM if the arena has no
+*         room for the batch, or EIO if the service did not process it
+*/
+static int slot_rotate_batch(caesar_session_t *sess, char *messages[], const int shifts[],
+                             size_t count, slot_run_fn run)
+{
+    struct request_slot *req = &sess->shm->slots[sess->slot];
+    struct arena_buf *buf;
+    size_t total = batch_size(messages, count);
+    int status;
+
+    req->payload = arena_alloc(&sess->shm->arena, SHM_ARENA(sess->shm), total, sess->slot);
+    if (req->payload == ARENA_NONE)
+        return -1;
+    buf = arena_get(&sess->shm->arena, SHM_ARENA(sess->shm), req->payload);
+    pack_batch(buf->data, messages, shifts, count);
+    req->kind = REQ_BATCH;
+    atomic_store_explicit(&req->state, SLOT_READY, memory_order_release);
+
+    status = run(sess);
+    if (status == 0 && atomic_load_explicit(&req->state, memory_order_acquire) == SLOT_DONE) {
+        unpack_batch(buf->data, messages, count);
+    } else {
+        if (status == 0)
+            errno = EIO;
+        status = -1;
+    }
+    release_request(sess->shm, req);
+    return status;
+}
+
+/**
+* arena_stream_open() - allocate a stream's chunks in the payload arena
+* @st: the stream
+*
+* Return: 0 on success, -1 if the arena has no room for them
+*/
+static int arena_stream_open(caesar_stream_t *st)
+{
+    caesar_session_t *sess = st->sess;
+    unsigned int i;
+
+    for (i = 0; i < st->depth; i++) {
+        st->chunks[i].payload = arena_alloc(&sess->shm->arena, SHM_ARENA(sess->shm), st->chunk, sess->slot);
+        if (st->chunks[i].payload == ARENA_NONE) {
+            while (i-- > 0)
+                arena_free(&sess->shm->arena, SHM_ARENA(sess->shm), st->chunks[i].payload);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static struct arena_buf *arena_chunk_buf(caesar_stream_t *st, const struct stream_chunk *c)
+{
+    return arena_get(&st->sess->shm->arena, SHM_ARENA(st->sess->shm), c->payload);
+}
+
+static void arena_stream_close(caesar_stream_t *st)
+{
+    unsigned int i;
+
+    for (i = 0; i < st->depth; i++)
+        arena_free(&st->sess->shm->arena, SHM_ARENA(st->sess->shm), st->chunks[i].payload);
+}
+
+/**
+* ring_close() - deregister a ring session
+* @sess: the session
+*
+*/
+static void ring_close(caesar_session_t *sess)
+{
+    unsigned int i;
+
+    log_info(RED"**Service API (caesar_session_close):"RESET" releasing slot %d, unlinking %s and %s", sess->slot, sess->send_name, sess->receive_name);
+
+    /* A deregistration is never turned away, it only waits for room */
+    for (i = 0; i < REGISTER_ATTEMPTS && send_registration(sess, REG_RING | REG_DEREGISTER, 0) == -1; i++)
+        ;
+    shm_close_session(sess);
+}
+
+static int ring_rotate(caesar_session_t *sess, char *message, size_t len, int shift)
+{
+    return slot_rotate(sess, message, len, shift, ring_run);
+}
+
+static int ring_rotate_batch(caesar_session_t *sess, char *messages[], const int shifts[], size_t count)
+{
+    return slot_rotate_batch(sess, messages, shifts, count, ring_run);
+}
+
+/**
+* ring_async() - submit an asynchronous request on the ring
+* @sess: the session
+* @r: the request, with its message
+* @shift: the shift to apply
+*
+* The message is copied into its own payload arena buffer, so up to
+* CAESAR_MAX_INFLIGHT requests can be in the service's pipeline.
+*
+* Return: 0 on success, -1 with errno set to ENOMEM if the arena is full,
+*         or to EPIPE if the service died
+*/
+static int ring_async(caesar_session_t *sess, struct async_request *r, int shift)
+{
+    r->payload = arena_alloc(&sess->shm->arena, SHM_ARENA(sess->shm), r->len, sess->slot);
+    if (r->payload == ARENA_NONE)
+        return -1;
+    memcpy(arena_get(&sess->shm->arena, SHM_ARENA(sess->shm), r->payload)->data, r->message, r->len);
+    if (ring_submit(sess, r->token, REQ_MESSAGE, shift, r->payload) == -1) {
+        arena_free(&sess->shm->arena, SHM_ARENA(sess->shm), r->payload);
+        return -1;
+    }
+    r->state = ASYNC_PENDING;
+    return 0;
+}
+
+/**
+* drain_notifications() - empty the receive queue of completion notifications
+* @sess: the session
+*
+* A zero absolute timeout makes mq_timedreceive() return at once, so the
+* queue can stay in blocking mode for the handshake.
+*
+*/
+static void drain_notifications(caesar_session_t *sess)
+{
+    struct timespec now = { 0, 0 };
+
+    while (mq_timedreceive(sess->mqd_receive, sess->buffer, sess->msgsize, NULL, &now) != -1)
+        ;
+}
+
+/**
+* ring_reap() - handle every completion already posted for the slot
+* @sess: the session
+*
+* Notifications queued while the ring was armed are drained first.
+*
+* Return: number of completions handled
+*/
+static int ring_reap(caesar_session_t *sess)
+{
+    struct complete_ring *cq = &sess->shm->slots[sess->slot].cq;
+    struct cq_entry done;
+    int n = 0;
+
+    if (sess->armed) {
+        drain_notifications(sess);
+        sess->armed = 0;
+    }
+    while (cq_pop(cq, &done) == 0) {
+        ring_complete(sess, &done);
+        n++;
+    }
+    return n;
+}
+
+/**
+* ring_wait() - sleep until a completion has been posted
+* @sess: the session
+*
+* Should the service die meanwhile, the requests in flight are failed.
+*
+*/
+static void ring_wait(caesar_session_t *sess)
+{
+    unsigned int beat = atomic_load_explicit(&sess->shm->heartbeat, memory_order_relaxed);
+
+    if (cq_wait(&sess->shm->slots[sess->slot].cq, SERVICE_TIMEOUT_MS) == -1)
+        service_gone(sess, beat);
+}
+
+static int ring_arm(caesar_session_t *sess)
+{
+    if (cq_arm(&sess->shm->slots[sess->slot].cq) == -1)
+        return -1;
+    sess->armed = 1;
+    return 0;
+}
+
+/* The receive queue is pollable on Linux, and receives the ring's wakeups */
+static int shm_fd(caesar_session_t *sess)
+{
+    return (int) sess->mqd_receive;
+}
+
+/**
+* ring_chunk_submit() - submit a stream chunk as an asynchronous request
+* @st: the stream
+* @c: the chunk, filled
+* @len: bytes filled
+*
+* Return: 0 on success, -1 with errno set to EPIPE if the service died
+*/
+static int ring_chunk_submit(caesar_stream_t *st, struct stream_chunk *c, size_t len)
+{
+    struct async_request *r = async_claim_wait(st->sess);
+
+    r->message = NULL;
+    r->len = len;
+    r->payload = c->payload;
+    if (ring_submit(st->sess, r->token, REQ_MESSAGE, st->shift, c->payload) == -1)
+        return -1;
+    r->state = ASYNC_PENDING;
+    c->token = r->token;
+    return 0;
+}
+
+/**
+* mq_bye() - say 'bye' to the session's worker and clean up
+* @sess: the session
+*
+*/
+static void mq_bye(caesar_session_t *sess)
+{
+    log_info(RED"**Service API (caesar_session_close):"RESET" releasing slot %d, unlinking %s and %s", sess->slot, sess->send_name, sess->receive_name);
+
+    if (mq_send(sess->mqd_send, "bye", strlen("bye"), 0) == -1)
+        log_warn(RED"**Service API (caesar_session_close):"RESET" mq_send (bye): %s", strerror(errno));
+    shm_close_session(sess);
+}
+
+static int mq_rotate(caesar_session_t *sess, char *message, size_t len, int shift)
+{
+    return slot_rotate(sess, message, len, shift, mq_run);
+}
+
+static int mq_rotate_batch(caesar_session_t *sess, char *messages[], const int shifts[], size_t count)
+{
+    return slot_rotate_batch(sess, messages, shifts, count, mq_run);
+}
+
+/**
+* mq_chunk_submit() - rotate a stream chunk through the session's slot
+* @st: the stream
+* @c: the chunk, filled
+* @len: bytes filled
+*
+* One request at a time on this transport, so the chunk is done when this
+* returns.
+*
+* Return: 0; a failed chunk is failed in its status
+*/
+static int mq_chunk_submit(caesar_stream_t *st, struct stream_chunk *c, size_t len)
+{
+    caesar_session_t *sess = st->sess;
+    struct request_slot *req = &sess->shm->slots[sess->slot];
+
+    (void) len;
+    c->token = CAESAR_TOKEN_NONE;
+    req->payload = c->payload;
+    req->kind = REQ_MESSAGE;
+    req->shift = st->shift;
+    atomic_store_explicit(&req->state, SLOT_READY, memory_order_release);
+    c->status = mq_run(sess);
+    if (atomic_load_explicit(&req->state, memory_order_acquire) != SLOT_DONE)
+        c->status = -1;
+    req->payload = ARENA_NONE;
+    atomic_store_explicit(&req->state, SLOT_CLAIMED, memory_order_release);
+    return 0;
+}
+
+const struct transport_ops ring_transport = {
+    .name = "ring",
+    .open = shm_open_session,
+    .close = ring_close,
+    .rotate = ring_rotate,
+    .rotate_batch = ring_rotate_batch,
+    .submit = ring_async,
+    .reap = ring_reap,
+    .wait = ring_wait,
+    .arm = ring_arm,
+    .fd = shm_fd,
+    .stream_open = arena_stream_open,
+    .chunk_buf = arena_chunk_buf,
+    .chunk_submit = ring_chunk_submit,
+    .stream_close = arena_stream_close
+};
+
+const struct transport_ops mq_transport = {
+    .name = "mq",
+    .open = shm_open_session,
+    .close = mq_bye,
+    .rotate = mq_rotate,
+    .rotate_batch = mq_rotate_batch,
+    .submit = NULL,
+    .reap = NULL,
+    .wait = NULL,
+    .arm = NULL,
+    .fd = shm_fd,
+    .stream_open = arena_stream_open,
+    .chunk_buf = arena_chunk_buf,
+    .chunk_submit = mq_chunk_submit,
+    .stream_close = arena_stream_close
+};
@@ -0,0 +1,377 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#define _GNU_SOURCE /* memfd_create and F_ADD_SEALS */
+#include <errno.h>
+#include <poll.h> /* Waiting for socket replies */
+#include <sys/socket.h> /* MSG_DONTWAIT */
+#include <time.h> /* nanosleep between connection attempts */
+
+#include "log.h" /* Asynchronous logging */
+#include "usock.h"
+#include "transport.h"
+
+/*
+* The 'unix' transport: a SOCK_SEQPACKET connection to the service and
+* memfds shared over it (see caesar_ipc.h).  Nothing of the service's is
+* mapped and no slot is held, so opening a session is one connect().
+*/
+
+/* Smallest memfd region; bigger requests grow region 0 by doubling */
+#define SOCK_REGION_MIN (64 * 1024)
+
+/* How long a refused connection is retried, while a new service takes the name over */
+#define CONNECT_RETRY_MS 2000
+
+/**
+* sock_reply() - read one reply off the session's socket
+* @sess: the session
+* @done: receives the reply's tag and status
+* @flags: 0 to wait for it, MSG_DONTWAIT not to
+*
+* Return: 0 with a reply, -1 with errno set to EAGAIN if none has arrived,
+*         or to EPIPE if the service closed the connection
+*/
+static int sock_reply(caesar_session_t *sess, struct cq_entry *done, int flags)
+{
+    struct sock_reply reply;
+    ssize_t n;
+
+    do {
+        n = usock_recv(sess->sock, &reply, sizeof(reply), NULL, flags);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1 && errno == EAGAIN)
+        return -1;
+    if (n != (ssize_t) sizeof(reply)) {
+        log_warn(RED"**Service API:"RESET" the service closed the connection @%s", sess->ipc.sock);
+        async_fail_pending(sess);
+        errno = EPIPE;
+        return -1;
+    }
+    done->tag = (unsigned int) reply.tag;
+    done->status = reply.status;
+    return 0;
+}
+
+/**
+* sock_complete() - finish the asynchronous request a reply names
+* @sess: the session
+* @done: the reply
+*
+* Only stream chunks are asynchronous here, and they complete in place.
+*
+*/
+static void sock_complete(caesar_session_t *sess, const struct cq_entry *done)
+{
+    struct async_request *r = async_pending(sess, done->tag);
+
+    if (r != NULL)
+        async_finish(r, done->status);
+}
+
+/**
+* region_reserve() - make sure a memfd region has room
+* @sess: the session
+* @idx: the region
+* @size: bytes needed, headers included
+*
+* The memfd is created on first use and sealed against shrinking, as the
+* service requires.  A region that has to grow is extended and remapped,
+* and sent to the service again with its next request.  The old mapping
+* is only dropped once the new one is in place, so a region that cannot
+* grow is left as it was.
+*
+* Return: the region's mapping, or NULL with errno set
+*/
+static char *region_reserve(caesar_session_t *sess, unsigned int idx, size_t size)
+{
+    struct sock_region *r = &sess->regions[idx];
+    size_t want = r->base != NULL ? r->size : SOCK_REGION_MIN;
+    char *base;
+    int saved;
+
+    while (want < size)
+        want *= 2;
+    if (r->base != NULL && want == r->size)
+        return r->base;
+
+    if (r->base == NULL) {
+        r->fd = memfd_create("caesar_region", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (r->fd == -1)
+            return NULL;
+    }
+    if (ftruncate(r->fd, want) == -1 || fcntl(r->fd, F_ADD_SEALS, F_SEAL_SHRINK) == -1 ||
+        (base = mmap(NULL, want, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0)) == MAP_FAILED) {
+        if (r->base == NULL) {
+            saved = errno;
+            close(r->fd);
+            errno = saved;
+        }
+        return NULL;
+    }
+    if (r->base != NULL)
+        munmap(r->base, r->size);
+    r->base = base;
+    r->size = want;
+    r->shared = 0;
+    return r->base;
+}
+
+/**
+* region_buf() - the arena_buf header at an offset in a region
+* @sess: the session
+* @idx: the region
+* @offset: a multiple of ARENA_ALIGN
+*/
+static struct arena_buf *region_buf(caesar_session_t *sess, unsigned int idx, uint64_t offset)
+{
+    return (struct arena_buf *) (void *) (sess->regions[idx].base + offset);
+}
+
+/**
+* sock_submit() - send one request
+* @sess: the session
+* @idx: the region holding the request
+* @offset: of the request's arena_buf header in the region
+* @kind: REQ_MESSAGE or REQ_BATCH
+* @shift: the shift, for a REQ_MESSAGE
+* @tag: echoed in the reply; CAESAR_TOKEN_NONE for a synchronous request
+*
+* The region's memfd travels with the first request after it was created
+* or grown.
+*
+* Return: 0 on success, -1 with errno set, EPIPE if the service closed
+*         the connection
+*/
+static int sock_submit(caesar_session_t *sess, unsigned int idx, uint64_t offset,
+                        unsigned int kind, int shift, caesar_token_t tag)
+{
+    struct sock_region *r = &sess->regions[idx];
+    struct sock_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.tag = tag;
+    req.offset = offset;
+    req.region = idx;
+    req.kind = kind;
+    req.shift = shift;
+    if (usock_send(sess->sock, &req, sizeof(req), r->shared ? -1 : r->fd) != (ssize_t) sizeof(req))
+        return -1;
+    r->shared = 1;
+    return 0;
+}
+
+/**
+* sock_run() - run one request staged at the start of region 0
+* @sess: the session
+* @kind: REQ_MESSAGE or REQ_BATCH
+* @shift: the shift, for a REQ_MESSAGE
+*
+* Replies to stream chunks that arrive first are handled on the way.
+*
+* Return: 0 on success, -1 with errno set to EIO if the service failed the
+*         request, or to why the connection failed
+*/
+static int sock_run(caesar_session_t *sess, unsigned int kind, int shift)
+{
+    struct cq_entry done = { CAESAR_TOKEN_NONE, -1 };
+
+    if (sock_submit(sess, 0, 0, kind, shift, CAESAR_TOKEN_NONE) == -1)
+        return -1;
+    for (;;) {
+        if (sock_reply(sess, &done, 0) == -1)
+            return -1;
+        if (done.tag == CAESAR_TOKEN_NONE) {
+            if (done.status != 0) {
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+        }
+        sock_complete(sess, &done);
+    }
+}
+
+/**
+* sock_open() - connect to the service
+* @sess: the session
+* @prio: unused; connections are not prioritised
+*
+* A service handing over closes its socket before the one taking over
+* binds the name, so connections refused meanwhile are retried.
+*
+* Return: 0 on success, -1 with errno set if no service accepted the
+*         connection
+*/
+static int sock_open(caesar_session_t *sess, unsigned int prio)
+{
+    struct timespec tick = { 0, 1000000L };
+    unsigned int waited = 0;
+
+    (void) prio;
+    while ((sess->sock = usock_connect(sess->ipc.sock)) == -1) {
+        if (errno != ECONNREFUSED || waited++ == CONNECT_RETRY_MS)
+            return -1;
+        nanosleep(&tick, NULL);
+    }
+    log_info(RED"**Service API (caesar_session_open):"RESET" '%s' connected to @%s", sess->name, sess->ipc.sock);
+    return 0;
+}
+
+/**
+* sock_close() - hang up and unmap the session's regions
+* @sess: the session
+*
+*/
+static void sock_close(caesar_session_t *sess)
+{
+    unsigned int i;
+
+    log_info(RED"**Service API (caesar_session_close):"RESET" '%s' hanging up", sess->name);
+    close(sess->sock);
+    for (i = 0; i < SOCK_REGIONS; i++) {
+        if (sess->regions[i].base != NULL) {
+            munmap(sess->regions[i].base, sess->regions[i].size);
+            close(sess->regions[i].fd);
+        }
+    }
+}
+
+/* Copied through region 0; streams avoid the copies */
+static int sock_rotate(caesar_session_t *sess, char *message, size_t len, int shift)
+{
+    struct arena_buf *buf;
+    int status;
+
+    if (region_reserve(sess, 0, sizeof(*buf) + len) == NULL)
+        return -1;
+    buf = region_buf(sess, 0, 0);
+    memcpy(buf->data, message, len);
+    buf->len = len;
+    status = sock_run(sess, REQ_MESSAGE, shift);
+    if (status == 0)
+        memcpy(message, buf->data, len);
+    return status;
+}
+
+static int sock_rotate_batch(caesar_session_t *sess, char *messages[], const int shifts[], size_t count)
+{
+    struct arena_buf *buf;
+    size_t total = batch_size(messages, count);
+    int status;
+
+    if (region_reserve(sess, 0, sizeof(*buf) + total) == NULL)
+        return -1;
+    buf = region_buf(sess, 0, 0);
+    pack_batch(buf->data, messages, shifts, count);
+    buf->len = total;
+    status = sock_run(sess, REQ_BATCH, 0);
+    if (status == 0)
+        unpack_batch(buf->data, messages, count);
+    return status;
+}
+
+static int sock_reap(caesar_session_t *sess)
+{
+    struct cq_entry done;
+    int n = 0;
+
+    while (sock_reply(sess, &done, MSG_DONTWAIT) == 0) {
+        sock_complete(sess, &done);
+        n++;
+    }
+    return n;
+}
+
+/* A failed poll returns to the caller, whose next reap finds out why */
+static void sock_wait(caesar_session_t *sess)
+{
+    struct pollfd pfd;
+
+    pfd.fd = sess->sock;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+}
+
+static int sock_fd(caesar_session_t *sess)
+{
+    return sess->sock;
+}
+
+/**
+* sock_stream_open() - lay a stream's chunks out in a memfd region
+* @st: the stream
+*
+* The service maps the region once, so chunks are filled and read back in
+* place and no payload byte is copied between the processes.
+*
+* Return: 0 on success, -1 with errno set to EBUSY if SOCK_REGIONS - 1
+*         streams are open already, or to why the region could not be made
+*/
+static int sock_stream_open(caesar_stream_t *st)
+{
+    caesar_session_t *sess = st->sess;
+    size_t stride = (sizeof(struct arena_buf) + st->chunk + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    unsigned int i;
+
+    for (st->region = 1; st->region < SOCK_REGIONS && sess->regions[st->region].in_use; st->region++)
+        ;
+    if (st->region == SOCK_REGIONS) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (region_reserve(sess, st->region, st->depth * stride) == NULL)
+        return -1;
+    sess->regions[st->region].in_use = 1;
+    for (i = 0; i < st->depth; i++)
+        st->chunks[i].payload = i * stride;
+    return 0;
+}
+
+static struct arena_buf *sock_chunk_buf(caesar_stream_t *st, const struct stream_chunk *c)
+{
+    return region_buf(st->sess, st->region, c->payload);
+}
+
+static int sock_chunk_submit(caesar_stream_t *st, struct stream_chunk *c, size_t len)
+{
+    struct async_request *r = async_claim_wait(st->sess);
+
+    if (sock_submit(st->sess, st->region, c->payload, REQ_MESSAGE, st->shift, r->token) == -1)
+        return -1;
+    r->message = NULL;
+    r->len = len;
+    r->payload = c->payload;
+    r->state = ASYNC_PENDING;
+    c->token = r->token;
+    return 0;
+}
+
+/* The region stays with the session for its next stream */
+static void sock_stream_close(caesar_stream_t *st)
+{
+    st->sess->regions[st->region].in_use = 0;
+}
+
+const struct transport_ops unix_transport = {
+    .name = "unix",
+    .open = sock_open,
+    .close = sock_close,
+    .rotate = sock_rotate,
+    .rotate_batch = sock_rotate_batch,
+    .submit = NULL,
+    .reap = sock_reap,
+    .wait = sock_wait,
+    .arm = NULL,
+    .fd = sock_fd,
+    .stream_open = sock_stream_open,
+    .chunk_buf = sock_chunk_buf,
+    .chunk_submit = sock_chunk_submit,
+    .stream_close = sock_stream_close
+};
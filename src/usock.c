@@ -0,0 +1,180 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdint.h> /* uintptr_t */
+#include <string.h> /* Needed for memset and memcpy */
+#include <unistd.h> /* Needed for close */
+#include <errno.h>
+#include <sys/socket.h> /* sendmsg, recvmsg, SCM_RIGHTS */
+#include <sys/un.h> /* struct sockaddr_un */
+
+#include "usock.h"
+
+/* Keeps the casts to struct sockaddr within the aliasing rules */
+union usock_addr {
+  struct sockaddr sa;
+  struct sockaddr_un un;
+};
+
+/**
+* usock_address() - a service's socket address
+* @addr: filled in
+* @name: the socket's name, from struct ipc_names
+*
+* The name is in the abstract namespace (a leading NUL byte), so nothing
+* is left in the file system when the service exits.
+*
+* Return: the address length to pass to bind() or connect()
+*/
+static socklen_t usock_address(union usock_addr *addr, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len > sizeof(addr->un.sun_path) - 1)
+        len = sizeof(addr->un.sun_path) - 1;
+    memset(addr, 0, sizeof(*addr));
+    addr->un.sun_family = AF_UNIX;
+    memcpy(addr->un.sun_path + 1, name, len);
+    return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+/**
+* usock_listen() - bind and listen on a service's socket
+* @name: the socket's name
+*
+* Return: a nonblocking listening socket, or -1 with errno set (EADDRINUSE
+*         when another service holds the name)
+*/
+int usock_listen(const char *name)
+{
+    union usock_addr addr;
+    socklen_t addrlen = usock_address(&addr, name);
+    int sock, saved;
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+    if (bind(sock, &addr.sa, addrlen) == -1 || listen(sock, SOMAXCONN) == -1) {
+        saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    return sock;
+}
+
+/**
+* usock_connect() - connect to a service's socket
+* @name: the socket's name
+*
+* Return: a blocking connected socket, or -1 with errno set (ECONNREFUSED
+*         when no service is listening)
+*/
+int usock_connect(const char *name)
+{
+    union usock_addr addr;
+    socklen_t addrlen = usock_address(&addr, name);
+    int sock, saved;
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+    if (connect(sock, &addr.sa, addrlen) == -1) {
+        saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    return sock;
+}
+
+/**
+* usock_send() - send one message, optionally passing a descriptor
+* @sock: a connected SOCK_SEQPACKET socket
+* @msg: the message
+* @len: its length
+* @fd: descriptor to pass with SCM_RIGHTS, or -1
+*
+* Return: bytes sent, or -1 with errno set
+*/
+ssize_t usock_send(int sock, const void *msg, size_t len, int fd)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = (void *) (uintptr_t) msg;
+    iov.iov_len = len;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (fd != -1) {
+        memset(&control, 0, sizeof(control));
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &mh, MSG_NOSIGNAL);
+}
+
+/**
+* usock_recv() - receive one message and any descriptor passed with it
+* @sock: a connected SOCK_SEQPACKET socket
+* @msg: receives the message
+* @len: size of msg
+* @fd: receives the passed descriptor (close-on-exec), or -1; may be NULL
+*      to refuse descriptors
+* @flags: recvmsg() flags, e.g. MSG_DONTWAIT
+*
+* Return: bytes received, 0 when the peer has closed, or -1 with errno set
+*/
+ssize_t usock_recv(int sock, void *msg, size_t len, int *fd, int flags)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+    int passed;
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = msg;
+    iov.iov_len = len;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    if (fd != NULL)
+        *fd = -1;
+
+    n = recvmsg(sock, &mh, flags | MSG_CMSG_CLOEXEC);
+    if (n <= 0)
+        return n;
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+        if (fd != NULL)
+            *fd = passed;
+        else
+            close(passed);
+    }
+    return n;
+}
@@ -7,23 +7,18 @@
 * any later version. This program is distributed without any warranty.    *
 * See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
 \*************************************************************************/
-#ifndef POSIXMQ_H
-#define POSIXMQ_H
+#ifndef USOCK_H
+#define USOCK_H
 
-#include <fcntl.h>  /* Defines file descriptor constants: O_ */
-#include <sys/stat.h>   /* Defines mode constants */
-#include <mqueue.h>   /* Required to implement POSIX message queues */
-#include <stddef.h> /* Define NULL */
-#include <stdlib.h> /* define EXIT_SUCCESS and EXIT_FAILURE */
-#include <stdio.h> /* allow for printf */
-#include "errors.h"
+#include <stddef.h> /* Needed for size_t */
+#include <sys/types.h> /* ssize_t */
 
-extern int create_mq(const char *name);
+int usock_listen(const char *name);
 
-extern int write_mq(const char *name, const char *data);
+int usock_connect(const char *name);
 
-extern int read_mq(const char *name);
+ssize_t usock_send(int sock, const void *msg, size_t len, int fd);
 
-extern int close_mq(const char *name, mqd_t mqd);
+ssize_t usock_recv(int sock, void *msg, size_t len, int *fd, int flags);
 
 #endif
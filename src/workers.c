@@ -0,0 +1,105 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#include <stdlib.h> /* Needed for malloc */
+#include <unistd.h> /* Needed for sysconf */
+
+#include "errors.h"
+#include "workers.h"
+
+/**
+* worker_main() - body of every pool thread
+* @arg: the pool
+*
+* Waits for an item, takes it off the queue and runs the pool's function
+* on it outside the lock.
+*
+*/
+static void *worker_main(void *arg)
+{
+    struct work_pool *pool = arg;
+    void *item;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->count == 0)
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        item = pool->items[pool->head];
+        pool->head = (pool->head + 1) % WORK_QUEUE_SIZE;
+        pool->count--;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->fn(item);
+    }
+    return NULL;
+}
+
+/**
+* work_pool_create() - start a pool of worker threads
+* @nthreads: number of workers
+* @fn: function each worker runs on the items it is handed
+*
+* Return: the new pool; failures are fatal
+*/
+struct work_pool *work_pool_create(unsigned int nthreads, work_fn fn)
+{
+    struct work_pool *pool;
+    unsigned int i;
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        error_exit("calloc (work_pool)");
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    if (pool->threads == NULL)
+        error_exit("calloc (work_pool threads)");
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+    pool->fn = fn;
+    pool->nthreads = nthreads;
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0)
+            error_exit("pthread_create (worker %u)", i);
+    }
+    return pool;
+}
+
+/**
+* work_submit() - hand an item to the pool
+* @pool: the pool
+* @item: passed to the pool's function by whichever worker picks it up
+*
+* Blocks while WORK_QUEUE_SIZE items are already waiting for a worker.
+*
+*/
+void work_submit(struct work_pool *pool, void *item)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == WORK_QUEUE_SIZE)
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+    pool->items[(pool->head + pool->count) % WORK_QUEUE_SIZE] = item;
+    pool->count++;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+* default_worker_count() - number of online CPU cores
+*
+* Return: the core count, or 1 if it cannot be determined
+*/
+unsigned int default_worker_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (unsigned int) n : 1;
+}
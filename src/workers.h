@@ -0,0 +1,43 @@
+/*************************************************************************\
+*                     Copyright (C) Nathan Hicks, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <pthread.h> /* Worker threads, mutex and condition variables */
+
+/* Items waiting for a worker before work_submit() blocks */
+#define WORK_QUEUE_SIZE 256
+
+typedef void (*work_fn)(void *item);
+
+/*
+* A fixed-size pool of threads fed from a bounded FIFO.  The dispatcher
+* pushes items with work_submit(); each worker pops one at a time and
+* calls fn on it.  Items are owned by fn once popped.
+*/
+struct work_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  void *items[WORK_QUEUE_SIZE];
+  unsigned int head;
+  unsigned int count;
+  work_fn fn;
+  unsigned int nthreads;
+  pthread_t *threads;
+};
+
+struct work_pool *work_pool_create(unsigned int nthreads, work_fn fn);
+
+void work_submit(struct work_pool *pool, void *item);
+
+unsigned int default_worker_count(void);
+
+#endif